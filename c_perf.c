@@ -20,32 +20,594 @@
 	when the last packet was received and total data received by server.
 	The client the computes and displays the throughput.
 
-	Usage: ./c_perf [server] [port] [transport protocol] [network protocol] [datasize]
+	The server also says how long it took from the first to the last chunk by its
+	own clock, and we time the sending by ours. These two throughputs don't need
+	the clocks to agree on anything.
+
+	Usage: ./c_perf [options] [server] [port] [transport protocol] [network protocol] [datasize]
 			Where 
-				network protocol can be 4 (ipv4) or 6 (ipv6)
+				network protocol can be 4 (ipv4) or 6 (ipv6), or 46 to
+				compare the two head to head. Then the server can be one
+				name for both or "ipv4 address,ipv6 address" and the
+				server has to run with 46 and -D
 				transport protocol can be TCP or UDP (case sensitive)
 				datasize for TCP is number of bytes
 				datasize for UDP is number of messages
 
-	NOTE: The assumption is that the NTP daemon is running on both the machines 
-		to keep the clocks in sync.
+			Options
+				-P N	open N parallel TCP test connections, each driven by its
+						own thread. The datasize is split evenly across them.
+				-B N	UDP batch depth. Up to N datagrams are handed to the
+						kernel per sendmmsg() (and taken per recvmmsg() on the
+						server). Default 1, i.e. one syscall per datagram.
+				-Z mode	TCP transmit path. copy (default) is plain write(),
+						zerocopy is send(MSG_ZEROCOPY) with the completions
+						reaped from the error queue, sendfile sends pages of
+						a memfd with sendfile(). CPU time per byte is
+						reported for all of them.
+				-R mode	receive path on the server. copy (default) reads
+						into a small reusable buffer, big into a large one,
+						discard never copies the data to user space (splice
+						to /dev/null for TCP, MSG_TRUNC for UDP).
+				-G mode	UDP segmentation offload. gso sends super-datagrams
+						of up to 64KB with UDP_SEGMENT and lets the stack cut
+						them into datagrams, gro makes the server receive with
+						UDP_GRO, both does both. Default none. The datagrams
+						(-s) have to fit the path MTU for gso, a sweep sends
+						the ones that don't without it
+				-b rate	pace the UDP datagrams at rate bits per second (K, M
+						and G suffixes are understood). Default is as fast
+						as we can.
+				-i ms	print what we have sent every ms milliseconds while
+						the test runs (the server has its own -i for what it
+						received and lost)
+				-T N	trials per family when comparing (default 5)
+				-O order	abab (default) runs every pair ipv4 first, random
+						picks the order of every pair at random
+				-C		with network protocol 46, run an ipv4 and an ipv6 test
+						at the same time and show how fairly they share the
+						path (Jain's index every -i ms, default a second).
+						The server has to run with -D, or it serves one
+						test after the other
+				-L req[,resp]	request/response test instead of a transfer.
+						We send req bytes, the server answers with resp
+						bytes (default req), datasize round trips one after
+						the other. Shows transactions per second and the
+						latency percentiles
+				-N bytes	TCP connection rate test. datasize connections
+						one after the other, each opened, used to send
+						bytes and get them back (0 for nothing) and closed
+				-F		use TCP Fast Open for -N, the message goes in the SYN
+				-r		reverse: the server sends, we receive. Over UDP it
+						sends with our -b, -B and -G gso
+				-d		both ways at once, our receiving in a thread of its
+						own. Every direction gets its own numbers
+				-s bytes	size of every UDP datagram (TCP write), default 2999
+				-f mode	fragmentation of our UDP datagrams. do sets DF (for
+						ipv6 IPV6_DONTFRAG), so a datagram bigger than the
+						path MTU is refused, dont lets them be fragmented
+						on the way too. Default is what the kernel does
+				-S		UDP size sweep: run the test once for every size from
+						small datagrams up to the path MTU and past it, and
+						show which sizes fragment
+				-E engine	sys (default) sends with a system call per write,
+						uring keeps a queue of writes in flight on an io_uring
+						and the server receives with multishot recv
+				-o fmt:file	append every test (every trial, every size of a
+						sweep) to file as a line of json or csv, with all the
+						parameters and numbers. - is stdout
+				-c file[,pct]	compare the results with those in file (written
+						with -o) and exit with 2 if a throughput or rate is
+						lower, or a p99 latency higher, by more than pct %
+						(default 5)
+				-A cpus	pin the test threads to these CPUs (a list like
+						0-3,8, thread after thread). auto picks the CPUs of
+						the NIC's NUMA node that don't take its interrupts
+				-M node	allocate the buffers from this NUMA node (with -A
+						auto, the NIC's node unless given)
+				-I ms[,file]	sample TCP_INFO of the test connections every
+						ms milliseconds, on both sides: cwnd, srtt, rttvar,
+						retransmits, pacing and delivery rate and the time
+						busy, rwnd limited and sndbuf limited. Printed after
+						the test or appended to file as CSV
+				-t sec	timed test: send for sec seconds instead of a given
+						size. The datasize (up to 2^63-1) is then only a cap,
+						0 for none. The server stops when we say we are done
+				-V		payload check: every stream (TCP connection, the UDP
+						datagrams) carries a pattern seeded for it and by
+						offset, and the server checks every byte. The bytes
+						and reads (datagrams) that were off are reported per
+						family
+				-p data	what we send: zeros (default), repeat (0 to 255
+						over and over) or random, for a path that compresses.
+						It comes out of a pool set up once, before the first
+						test, which every sender walks through
+				-H		keep that pool in huge pages (or transparent ones),
+						locked in memory
+
+	Every test reports what it cost both ends: CPU time, context switches and,
+	where perf_event_open can count them, cycles, instructions and cache misses,
+	with cycles per byte and per packet. Comparing both families adds a table of
+	those per family.
+
+	NOTE: The end to end throughput assumes that the NTP daemon is running on both
+		the machines to keep the clocks in sync. The sender and receiver numbers
+		don't.
 */
 
 
+#define _GNU_SOURCE			// sendmmsg(), recvmmsg() and friends
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/tcp.h>			// the struct tcp_info with all the fields, glibc's is older
 #include <netdb.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <endian.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdarg.h>
+#include <sched.h>
+#include <dirent.h>
+#include <ifaddrs.h>
+#include <linux/mempolicy.h>
 
 
 
 
 #define BUFF_SIZE 3000		// size of the buffer. Maybe we need two separate
 							// buffers for UDP and TCP
+#define MIN_MSG_SIZE 24		// smallest datagram (-s), it has to hold struct dgram_hdr
+#define MAX_MSG_SIZE 65507	// largest datagram, what fits in an ipv4 packet
+#define MAX_SWEEP 32		// upper limit on the sizes of a sweep (-S)
+#define MAX_STREAMS 128		// upper limit on parallel test connections (-P)
+#define MAX_BATCH 1024		// upper limit on UDP batch depth (-B), same as UIO_MAXIOV
+#define CACHE_LINE 64		// keep per-stream counters on separate cache lines
+#define PAYLOAD_SIZE (1 << 20)	// size of the memfd we sendfile() from
+#define ZC_REAP_EVERY 64	// reap MSG_ZEROCOPY completions every so many sends
+#define GSO_MAX_SEGS 64		// kernel limit on segments per UDP_SEGMENT send (UDP_MAX_SEGMENTS)
+#define GSO_MAX_SIZE 65000	// ... and the payload of one super-datagram has to fit in an IP packet
+#define PACING_SPIN_NS 50000	// below this, we spin instead of sleeping till a datagram is due
+#define MIN_INTERVAL 10		// shortest reporting interval in ms (-i)
+#define MAX_TRIALS 1000		// upper limit on trials per family in compare mode (-T)
+#define UDP_START_WAIT 10	// seconds to wait for the first datagram when we receive UDP
+#define RX_BUFF_SIZE (1 << 16)	// what we read into when we receive TCP
+#define MAX_RR_SIZE 65507	// largest request or response (-L), what fits in a UDP datagram
+#define RR_TIMEOUT_MS 500	// a UDP request unanswered for this long is lost
+#define HIST_SUB_BITS 6		// latency histogram: 64 linear buckets per power of two (< 1.6 % error)
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)	// enough for any positive long int
+#define URING_DEPTH 64		// operations the io_uring engine keeps in flight (-E uring)
+#define REGRESSION_PCT 5.0	// worse than the baseline by more than this is a regression (-c)
+#define MAX_LINE 8192		// longest line of a result file we read back
+#define MAX_PIN 256			// CPUs the test threads are spread over (-A)
+#define MAX_TCPI 100000		// TCP_INFO samples we keep per test and side (-I)
+#define MAX_DURATION 86400	// longest timed test in seconds (-t)
+#define PAT_STEP 0x9e3779b97f4a7c15ULL	// payload pattern (-V), odd so it takes 2^64 words to repeat
+#define PAT_LANES 4			// ... made and checked so many words at a time
+#define HUGE_PAGE (2 << 20)	// size of a (transparent) huge page
+#define POOL_SIZE (2 * HUGE_PAGE)	// the payload the senders walk through, bigger than any compression window
+
+
+
+/* TCP transmit paths (-Z) */
+
+enum tx_mode {
+	TX_COPY,						/* write() from a user buffer, the kernel copies it */
+	TX_ZEROCOPY,					/* send(MSG_ZEROCOPY), the kernel pins our pages */
+	TX_SENDFILE						/* sendfile() from a memfd, no user buffer at all */
+	};
+
+static const char * tx_mode_name[] = { "copy", "zerocopy", "sendfile" };
+
+/* Receive paths of the server (-R). We only pass the name on */
+
+static const char * rx_mode_name[] = { "copy", "big", "discard", NULL };
+
+/* UDP segmentation offload (-G). GSO is ours, GRO is the server's */
+
+#define OFFLOAD_GSO 1
+#define OFFLOAD_GRO 2
+
+static const char * offload_name[] = { "none", "gso", "gro", "both", NULL };
+
+/* Which way the data goes (-r, -d) */
+
+enum direction {
+	DIR_FORWARD,					/* We send, the server receives. The usual */
+	DIR_REVERSE,					/* The server sends, we receive */
+	DIR_BOTH						/* Both at once */
+	};
+
+/* Fragmentation of our datagrams (-f) */
+
+enum df_mode {
+	DF_KERNEL,						/* Whatever the kernel does (path MTU discovery for ipv4) */
+	DF_DO,							/* DF set, too big is an error (IP_PMTUDISC_DO, IPV6_DONTFRAG) */
+	DF_DONT							/* DF clear, routers may fragment (IP_PMTUDISC_DONT) */
+	};
+
+static const char * df_name[] = { "kernel", "do", "dont", NULL };
+
+/* How the test data is handed to the kernel (-E). The server receives the same way */
+
+enum engine {
+	ENGINE_SYS,						/* One system call per write() or sendmmsg(), like we always did */
+	ENGINE_URING					/* io_uring, a queue of writes in flight */
+	};
+
+static const char * engine_name[] = { "sys", "uring", NULL };
+
+static const char * direction_name[] = { "forward", "reverse", "both" };
+
+/* What the data we send is made of (-p). Compression on the path makes short work
+	of zeros, and of a pattern too, but not of random bytes */
+
+enum payload {
+	PAYLOAD_ZEROS,					/* What we always sent */
+	PAYLOAD_REPEAT,					/* 0, 1 ... 255, over and over */
+	PAYLOAD_RANDOM					/* A PRNG's, as good as incompressible */
+	};
+
+static const char * payload_name[] = { "zeros", "repeat", "random", NULL };
+
+
+
+/* Every UDP datagram starts with this header, in network byte order. The server
+	uses the sequence number for loss, reordering and duplicates and the send time
+	for the interarrival jitter. It has to stay the same as in s_perf.c */
+
+struct dgram_hdr {
+
+	uint64_t seq;								/* 0, 1, 2 ... in the order we send them */
+	uint64_t sec;								/* CLOCK_REALTIME when it was handed to the kernel */
+	uint32_t nsec;
+	uint32_t pad;
+	} __attribute__((packed));
+
+
+
+/* The control protocol. Every message on the control connection is a header and
+	then len bytes of parameters. A parameter is a 2 byte type, a 2 byte length and
+	the value: numbers are 8 bytes, names are plain strings without the '\0'. All in
+	network byte order. Parameters nobody knows about are skipped, so either side can
+	learn new ones without breaking the other; anything else bumps CTRL_VERSION.
+	It has to stay the same as in s_perf.c */
+
+#define CTRL_MAGIC 0x6970		// "ip"
+#define CTRL_VERSION 1
+#define CTRL_MAX 4096			// largest message body
+
+enum ctrl_type {
+	MSG_HELLO = 1,					/* Client: this is the test I want to run */
+	MSG_READY,						/* Server: all set up, go (P_TEST_PORT) */
+	MSG_RESULT,						/* Server: what we received */
+	MSG_ERROR,						/* Server: refused, P_TEXT says why */
+	MSG_SAMPLES,					/* Server: TCP_INFO samples (P_SAMPLES), before the result */
+	MSG_END							/* Client: done sending a timed UDP test (P_SENT_PKTS) */
+	};
+
+enum ctrl_param {
+	P_PROTO = 1,					/* Hello: TCP = 1, UDP = 0 */
+	P_SIZE,							/* Hello: bytes (TCP) or datagrams (UDP) */
+	P_STREAMS,						/* Hello: parallel TCP streams */
+	P_BATCH,						/* Hello: UDP batch depth */
+	P_OFFLOAD,						/* Hello: UDP offload, index into offload_name */
+	P_RXMODE,						/* Hello: receive path, by name */
+	P_TEST_PORT,					/* Ready: where the test runs */
+	P_END_SEC,						/* Result: CLOCK_REALTIME of the last chunk */
+	P_END_NSEC,
+	P_RECEIVED,						/* Result: bytes */
+	P_RX_TIME,						/* Result: first to last chunk, ns */
+	P_UNIQUE,						/* Result, UDP: struct seq_stats */
+	P_DUPLICATES,
+	P_REORDERED,
+	P_MAX_REORDER,
+	P_HIGHEST,
+	P_JITTER,						/* Result, UDP: ns */
+	P_TEXT,							/* Error: what went wrong */
+	P_REQ_SIZE,						/* Hello: request/response test, bytes per request */
+	P_RESP_SIZE,					/* Hello: ... and per response */
+	P_CRR_SIZE,						/* Hello: connection rate test, bytes each way per connection */
+	P_FASTOPEN,						/* Hello: ... with TCP Fast Open */
+	P_CONNS,						/* Result, connection rate: connections accepted */
+	P_TFO_CONNS,					/* Result, connection rate: ... with data in the SYN */
+	P_DIRECTION,					/* Hello: enum direction */
+	P_UDP_PORT,						/* Hello: where we receive UDP (reverse and both) */
+	P_SENT,							/* Result: bytes the server sent (reverse and both) */
+	P_SENT_PKTS,					/* Result: ... in so many datagrams */
+	P_TX_TIME,						/* Result: first to last send, ns */
+	P_MSG_SIZE,						/* Hello: bytes per datagram */
+	P_ENGINE,						/* Hello: enum engine */
+	P_CPU_USER,						/* Result: the server's struct cpu_cost, times in us */
+	P_CPU_SYS,
+	P_VCSW,
+	P_IVCSW,
+	P_CYCLES,
+	P_INSTRUCTIONS,
+	P_CACHE_MISSES,
+	P_HW_USER_ONLY,
+	P_HW_ERROR,
+	P_CPU_BYTES,
+	P_CPU_PACKETS,
+	P_PLACEMENT,					/* Result: where the server ran the test */
+	P_TCPI_INTERVAL,				/* Hello: sample TCP_INFO every so many ms */
+	P_SAMPLES,						/* Samples: struct tcpi_sample, as many as fit */
+	P_DURATION,						/* Hello: timed test, ms. The size (0 for none) is only a cap */
+	P_VERIFY,						/* Hello: seed of the payload pattern, to be checked (-V) */
+	P_CHECKED,						/* Result: payload bytes checked ... */
+	P_CORRUPT_BYTES,				/* ... how many of them were not what we sent ... */
+	P_CORRUPT_CHUNKS,				/* ... and in how many reads (datagrams) */
+	P_RATE							/* Hello: UDP target rate (bits/s) of whoever sends */
+	};
+
+struct ctrl_hdr {
+
+	uint16_t magic;
+	uint8_t version;
+	uint8_t type;					/* enum ctrl_type */
+	uint32_t len;					/* Bytes of parameters after the header */
+	} __attribute__((packed));
+
+struct ctrl_msg {
+
+	int type;
+	uint32_t len;
+	char body[CTRL_MAX];
+	};
+
+
+
+/* One TCP_INFO sample of a test connection (-I). The server sends us its own, every
+	field in network byte order. It has to stay the same as in s_perf.c */
+
+struct tcpi_sample {
+
+	uint64_t t;									/* us since the test started */
+	uint64_t stream;							/* Which connection of the test */
+	uint64_t cwnd;								/* Congestion window (segments) */
+	uint64_t srtt, rttvar;						/* Smoothed round trip time and its variation (us) */
+	uint64_t retrans;							/* Segments retransmitted so far */
+	uint64_t pacing_rate, delivery_rate;		/* Bytes per second */
+	uint64_t busy;								/* Time so far with data in flight (us) ... */
+	uint64_t rwnd_limited;						/* ... held up by the receive window ... */
+	uint64_t sndbuf_limited;					/* ... or by the send buffer */
+	} __attribute__((packed));
+
+#define TCPI_FIELDS (sizeof(struct tcpi_sample) / sizeof(uint64_t))
+
+/* The samples of one side of a test */
+
+struct tcpi_series {
+
+	struct tcpi_sample * s;
+	int n;
+	int size;									/* Room for so many before we realloc() */
+	};
+
+
+
+/* What the server found out about our datagrams (see struct seq_stats in s_perf.c) */
+
+struct udp_stats {
+
+	long int unique;							/* Distinct datagrams received */
+	long int duplicates;						/* Datagrams received more than once */
+	long int reordered;							/* Datagrams that came after a later one */
+	long int max_reorder;						/* Furthest back a late datagram was */
+	long int highest;							/* Highest sequence number seen + 1 */
+	long int jitter;							/* RFC 3550 interarrival jitter (ns) */
+	};
+
+
+
+/* Every thread that sends TCP data keeps one of these. MSG_ZEROCOPY completions
+	are counted per socket, so we need to know how many sends are still in flight.
+	For sendfile, the offset walks around the memfd */
+
+struct tx_state {
+
+	char * buff;								/* What we send in copy and zerocopy mode */
+	off_t off;									/* Where in the memfd the next sendfile starts */
+	size_t cur;									/* Where in the pool the next chunk comes from */
+	uint64_t seed;								/* Payload pattern of this connection (-V) */
+	long int pos;								/* ... and where in it the next write starts */
+	unsigned int zc_sent;						/* MSG_ZEROCOPY sends made */
+	unsigned int zc_done;						/* ... and completions reaped for them */
+	unsigned int zc_copied;						/* Completions where the kernel copied after all */
+	};
+
+
+
+/* What the send loops have done so far. The loops store their running totals here
+	(relaxed atomic stores, plain stores on anything we run on) and the interval
+	reporter reads them whenever it wakes up. With parallel streams the bytes are in
+	the stream structures instead */
+
+struct live_counters {
+
+	long int bytes;								/* Bytes sent */
+	long int packets;							/* Datagrams sent */
+	long int rx_bytes;							/* Bytes received (reverse and both) */
+	int done;									/* Sending is over */
+	struct timespec begin, end;					/* ... and when (CLOCK_MONOTONIC) it ran */
+	};
+
+
+
+/* The interval reporter. It sleeps on the condition variable so that we can wake
+	it up (and stop it) as soon as the sending is over */
+
+struct sampler {
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;						/* Waits on CLOCK_MONOTONIC */
+	int stop;
+	int running;
+	};
+
+
+
+/* Round trip times of the request/response test, in ns. Log-linear like HdrHistogram:
+	below HIST_SUB every value has a bucket of its own, above that every power of two
+	is cut into HIST_SUB equal buckets. So the memory is fixed (some 30KB) whatever the
+	range, and every bucket is within 1/HIST_SUB of the values in it */
+
+struct histogram {
+
+	long int count[HIST_BUCKETS];
+	long int n;									/* Values recorded */
+	long int min, max;
+	double sum;
+	};
+
+
+
+/* A bare io_uring for the uring engine. We talk to the kernel with the three system
+	calls ourselves, liburing would be one dependency more for a few dozen lines. The
+	rings are shared with the kernel: we fill submission entries and move the tail, the
+	kernel moves the head as it takes them. Completions go the other way round */
+
+struct uring {
+
+	int fd;
+	unsigned int * sq_khead, * sq_ktail;		/* Submission ring, shared with the kernel */
+	unsigned int * sq_array;
+	unsigned int sq_mask, sq_entries;
+	unsigned int sq_tail;						/* Entries we have filled ... */
+	unsigned int sq_submitted;					/* ... and handed over */
+	unsigned int * cq_khead, * cq_ktail;		/* Completion ring */
+	unsigned int cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_ring, * cq_ring;					/* The mappings, for uring_free() */
+	size_t sq_len, cq_len, sqes_len;
+	long int enters;							/* io_uring_enter() calls */
+	};
+
+
+
+/* A test as the baseline comparison (-c) sees it. The result files (-o) have a lot
+	more in them, this is what we read back */
+
+struct result {
+
+	int family;									/* 4 or 6 */
+	char config[256];							/* Everything that has to be the same to compare two results */
+	double value;								/* ti.result */
+	char unit[8];								/* ... in result_unit() */
+	double p99;									/* Round trip (setup) p99 in us, 0 for a transfer */
+	};
+
+/* One name and value of a line in the result file */
+
+struct field {
+
+	const char * name;
+	char value[256];
+	int quoted;									/* A string, for JSON */
+	};
+
+
+
+/* The hardware counters we read around a test (perf_event_open), in this order */
+
+enum hw_counter { HW_CYCLES, HW_INSTRUCTIONS, HW_CACHE_MISSES, N_HW };
+
+/* What a test cost the CPU. We count ours, the server counts its own and sends them
+	along with the result */
+
+struct cpu_cost {
+
+	long int user, sys;							/* CPU time (us) */
+	long int vcsw, ivcsw;						/* Voluntary and involuntary context switches */
+	long int hw[N_HW];							/* -1 for a counter we did not get */
+	int user_only;								/* The counters left the kernel out (perf_event_paranoid) */
+	int hw_error;								/* errno when we got no counters at all */
+	long int bytes;								/* What the CPU time went into: bytes sent and received ... */
+	long int packets;							/* ... in so many cost_unit()s */
+	};
+
+
+
+/* Where the test threads run and where their memory comes from (-A, -M). Thread k
+	of a test runs on cpus[(base + k) % n_cpus] */
+
+struct placement {
+
+	int cpus[MAX_PIN];
+	int n_cpus;									/* 0 leaves it to the scheduler */
+	int automatic;								/* -A auto, place_auto() picks the CPUs */
+	int base;									/* Thread 0 goes on the base'th CPU (the ipv6 test of -C on the next) */
+	int node_opt;								/* NUMA node of -M, -1 for none */
+	int node;									/* ... or the NIC's with -A auto */
+	cpu_set_t allowed;							/* What we may run on at all, before we pinned anything */
+	char why[192];								/* How auto came to its choice */
+	char desc[320];								/* What we chose, for the report */
+	};
+
+
+
+/* One size of a sweep */
+
+struct sweep_point {
+
+	int size;									/* Bytes per datagram */
+	int frags;									/* Fragments per datagram, by the path MTU */
+	int skipped;								/* Too big to send with DF */
+	double mbps;								/* Receiver throughput */
+	double tx_pps, rx_pps;						/* Packets per second sent and received */
+	double loss;								/* % */
+	long int frag_made;							/* Fragments this host made while it ran */
+	};
+
+
+
+/* In contention mode, the two test processes and we share this */
+
+struct contention {
+
+	struct live_counters live[2];				/* ipv4, ipv6 */
+	double result[2];							/* Receiver throughput (Mbit/s) */
+	struct result rec[2];						/* ... and everything the baseline needs */
+	int have_rec[2];
+	};
+
+
+
+/* Every parallel stream gets one of these. The byte counter is bumped on every
+	write() by the stream's own thread, so the structure is aligned (and hence
+	padded) to a cache line. Otherwise the threads keep stealing the same line
+	from each other and we end up measuring cache coherency instead of the network */
+
+struct stream_info {
+
+	long int sent;								/* Bytes written on this stream so far */
+	long int target;							/* Bytes this stream is supposed to send */
+	int sock;									/* Socket descriptor of this test connection */
+	int id;										/* Stream number (for reporting) */
+	pthread_t thread;							/* Thread driving this stream */
+	struct timespec end;						/* When this stream wrote its last chunk */
+	} __attribute__((aligned(CACHE_LINE)));
 
 
 
@@ -62,18 +624,108 @@ struct test_info {
 	char * ctrl_port_str;						/* String representation of the same port */
 	int test_port;								/* Port on which test will be run (same as ctrl for TCP) */
 	char * test_port_str;						/* String representation of the same port */
+	char test_port_buf[16];						/* The server tells us the test port, we keep it here */
 
 	int ctrlsock;								/* Socket descriptor for control connection */
 	int testsock;								/* Socket descriptor for test connection (same as ctrl for TCP) */
 
 	struct addrinfo ctrl_serv, test_serv;		/* Server info for ctrl and test connections */
 	struct addrinfo * ctrl_ptr, * test_ptr;		/* Pointers for name resolution of ctrl and test serv */
+	struct addrinfo * ctrl_ai;					/* The address we actually connected ctrl to */
 
 	char * serv_name;							/* Input string with name of the server or its ip address */
 	int n_prot;									/* Network layer protocol */
 	int t_prot;									/* Transport layer protocol (TCP = 1, UDP = 0) */
-	long int data_info;							/* Info about how much data to be transfered (bytes/packets) */
+	long int data_info;							/* Info about how much data to be transfered (bytes/packets),
+													LONG_MAX for as much as fits in -t */
+	long int duration;							/* Timed test: send for so many ms, 0 for none (-t) */
+	struct timespec deadline;					/* ... CLOCK_MONOTONIC when the time is up */
+	enum payload payload;						/* What the data we send is made of (-p) ... */
+	int huge;									/* ... in huge pages, locked in memory (-H) */
+	char * pool;								/* ... POOL_SIZE bytes of it, set up once */
+	char pool_desc[96];							/* ... and what we got */
+	int pool_node;								/* ... the NUMA node we moved it to, -1 for none */
+	int verify;									/* Send a pattern the server checks (-V) */
+	uint64_t seed;								/* ... seeded with this, new for every test */
+	long int checked;							/* Payload bytes the server checked ... */
+	long int corrupt_bytes, corrupt_chunks;		/* ... and what it found wrong */
 	int domain;									/* AF_INET or AF_INET6 depending on n_prot */
+
+	int n_streams;								/* Number of parallel TCP test connections (-P) */
+	int batch;									/* UDP datagrams per sendmmsg()/recvmmsg() (-B) */
+	long int sent_packets;						/* Datagrams sent in the UDP test */
+	enum tx_mode tx_mode;						/* TCP transmit path (-Z) */
+	const char * rx_mode;						/* Server receive path (-R) */
+	int offload;								/* UDP GSO/GRO, OFFLOAD_* bits (-G) */
+	int gso_segs;								/* Datagrams per GSO super-datagram */
+	long int gso_sends;							/* Super-datagrams handed to the kernel */
+	struct udp_stats us;						/* Server's statistics of the UDP test */
+
+	double rate;								/* UDP target rate in bits/s (-b), 0 is unpaced */
+	double pace_time;							/* How long the paced send took (s) */
+	double pace_err_sum, pace_err_max;			/* How late the sends were against schedule (ns) */
+	long int pace_sends;						/* Number of paced sends */
+	int memfd;									/* Payload for the sendfile transmit path */
+	unsigned int zc_sent, zc_copied;			/* MSG_ZEROCOPY totals over all the streams */
+	int interval;								/* Report every this many ms, 0 for never (-i) */
+	struct live_counters * live;				/* Progress of the test, for the interval reports
+													(shared with the parent when contending) */
+	struct sampler smp;
+	struct stream_info * streams;				/* Per stream state, n_streams of them */
+
+	int trials;									/* Trials per family in compare mode (-T) */
+	int order_random;							/* Random order within every pair (-O random) */
+	int contend;								/* Run both families at the same time (-C) */
+	double result;								/* Receiver throughput of the last test (Mbit/s),
+													transactions per second with -L */
+
+	int req_size;								/* Request/response test: bytes per request, 0 for a transfer (-L) */
+	int resp_size;								/* ... and per response */
+	struct histogram * hist;					/* Round trip times (connection setup with -N) */
+	struct histogram * conn_hist;				/* Whole connections, from socket() to the answer (-N) */
+	long int rr_done;							/* Transactions that got their response */
+	long int rr_lost;							/* UDP requests (or responses) that got lost */
+
+	int crr_size;								/* Connection rate test: bytes each way, -1 for none (-N) */
+	int fastopen;								/* ... over TCP Fast Open (-F) */
+
+	enum direction direction;					/* Which way the data goes (-r, -d) */
+	int udp_port;								/* Where we receive UDP from the server */
+	pthread_t rx_thread;						/* Our receiving, when both ways */
+	long int rx_bytes, rx_packets;				/* What we received */
+	struct timespec rx_first, rx_last;			/* CLOCK_MONOTONIC of the first and last chunk */
+	struct udp_stats rs;						/* Our statistics of the server's datagrams */
+
+	int msg_size;								/* Bytes per datagram (TCP write) (-s) */
+	enum df_mode df;							/* Fragmentation of our datagrams (-f) */
+	int sweep;									/* Size sweep (-S) */
+	int mtu;									/* Path MTU of the UDP test socket */
+	double tx_pps, rx_pps, loss;				/* UDP packet rates and loss % of the last test */
+
+	enum engine engine;							/* How we send (-E) */
+	long int uring_ops, uring_enters;			/* Writes completed by io_uring, in so many system calls */
+
+	struct cpu_cost cpu;						/* What the last test cost us ... */
+	struct cpu_cost peer_cpu;					/* ... and the server, user < 0 if it did not say */
+	struct placement place;						/* CPUs and NUMA node of the test (-A, -M) */
+	char peer_place[320];						/* ... and where the server ran it */
+
+	int tcpi_interval;							/* Sample TCP_INFO every so many ms, 0 for never (-I) */
+	const char * tcpi_name;						/* ... into this CSV file, NULL to print them */
+	struct sampler tcpi_smp;					/* The thread taking our samples */
+	struct timespec tcpi_t0;					/* CLOCK_MONOTONIC the samples count from */
+	time_t tcpi_start;							/* ... and the wall clock then, to tell the tests apart */
+	struct tcpi_series tcpi;					/* Our samples of the last test ... */
+	struct tcpi_series peer_tcpi;				/* ... and the server's */
+	const char * out_name;						/* Result file (-o), "-" for stdout */
+	int out_csv;								/* ... CSV rather than JSON */
+	FILE * out;									/* ... once it is open, NULL for none */
+	struct result * records;					/* Results of this run, n_records of them */
+	int n_records;
+	const char * base_name;						/* Baseline result file (-c) */
+	struct result * base;						/* ... what was in it */
+	int n_base;
+	double threshold;							/* Regression beyond this many % */
 	} ti;
 
 
@@ -84,9 +736,117 @@ void perf_test ();
 void raise_error (const char *);
 void shake_hands ();
 void calc_throughput (long int, struct timespec, struct timespec);
-void itoa (long int, char *);
+void calc_packet_rate (long int, long int, long int, long int);
+void show_durations (long int, long int, long int, long int);
+void show_udp_stats (long int, struct udp_stats *);
+void pace_wait (struct timespec *, long int);
+void show_pacing (long int);
+double parse_rate (const char *);
+void ctrl_init (struct ctrl_msg *, int);
+int ctrl_put_raw (struct ctrl_msg *, int, const void *, int);
+int ctrl_put (struct ctrl_msg *, int, long int);
+int ctrl_put_str (struct ctrl_msg *, int, const char *);
+const char * ctrl_find (struct ctrl_msg *, int, int *);
+long int ctrl_get (struct ctrl_msg *, int, long int);
+int ctrl_get_str (struct ctrl_msg *, int, char *, int);
+int ctrl_check (struct ctrl_hdr *, struct ctrl_msg *);
+int ctrl_send (int, struct ctrl_msg *);
+int ctrl_recv (int, struct ctrl_msg *);
+int time_up ();
+void end_test ();
 long int run_tcp_test();
 long int run_udp_test();
+long int run_parallel_tcp_test();
+void * run_tcp_stream (void *);
+void tx_init (struct tx_state *, int);
+int tx_send (struct tx_state *, int, long int);
+void tx_finish (struct tx_state *, int);
+void tx_reap_zerocopy (struct tx_state *, int);
+void calc_cpu_cost (struct rusage *, struct rusage *, long int, long int, struct ctrl_msg *);
+void show_cpu_cost (const char *, struct cpu_cost *);
+const char * cost_unit ();
+int tcp_mss (int);
+void hw_open (struct cpu_cost *, int *);
+void hw_read (struct cpu_cost *, int *);
+void show_cost_compare (struct cpu_cost *, struct cpu_cost *, int);
+double cyc_per (struct cpu_cost *, long int);
+void place_test ();
+void place_auto (struct placement *, int);
+void pin_thread (int);
+int bind_node (int);
+int pool_move (int);
+int parse_cpus (const char *, int *, int);
+void show_cpus (char *, int, int *, int);
+int read_line (const char *, char *, int);
+void tcpi_begin ();
+void tcpi_end ();
+void * run_tcpi (void *);
+void tcpi_add (struct tcpi_series *, int, int, long int);
+void tcpi_take (struct ctrl_msg *);
+void show_tcpi ();
+void show_tcpi_series (FILE *, const char *, struct tcpi_series *);
+void setup_payload ();
+void pool_init ();
+char * pool_next (size_t *, size_t);
+uint64_t pat_word (uint64_t, uint64_t);
+unsigned char pat_byte (uint64_t, uint64_t);
+uint64_t pat_seed (uint64_t, int);
+void pat_fill (char *, size_t, uint64_t, uint64_t);
+int local_port (int);
+void show_verify (struct ctrl_msg *);
+void connect_streams ();
+void connect_ctrl ();
+void end_trial ();
+void compare ();
+void show_compare (double *, double *, int);
+void contend ();
+double jain (double *, int);
+double t_critical (int);
+double incbeta (double, double, double);
+void sampler_start ();
+void sampler_stop ();
+void * run_sampler (void *);
+long int run_tcp_rr ();
+long int run_udp_rr ();
+void hist_record (struct histogram *, long int);
+long int hist_percentile (struct histogram *, double);
+void show_latency (long int);
+void show_hist (struct histogram *);
+void hist_merge (struct histogram *, struct histogram *);
+void show_hist_compare (struct histogram *, struct histogram *);
+long int run_crr ();
+void show_crr (long int, long int, long int);
+const char * result_unit ();
+void * run_receiver (void *);
+void run_tcp_recv ();
+void run_udp_recv ();
+void show_reverse (struct ctrl_msg *);
+void set_df (int, int);
+int path_mtu (int, int);
+int probe_mtu ();
+int frag_count (int, int, int);
+long int frag_creates (int);
+void sweep ();
+void show_sweep (struct sweep_point *, int, int);
+long int run_tcp_uring ();
+long int run_udp_uring ();
+int uring_init (struct uring *, unsigned int);
+struct io_uring_sqe * uring_sqe (struct uring *);
+int uring_enter (struct uring *, unsigned int);
+struct io_uring_cqe * uring_cqe (struct uring *);
+void uring_seen (struct uring *);
+int uring_register (struct uring *, unsigned int, void *, unsigned int);
+void uring_free (struct uring *);
+void save_result (long int, long int, long int, long int);
+void result_config (char *, int);
+void add_record (struct result *);
+void add_field (struct field *, int *, int, const char *, const char *, ...);
+int result_fields (struct field *, long int, long int, long int, long int);
+const char * test_name ();
+void open_output ();
+void load_baseline ();
+int json_field (const char *, const char *, char *, int);
+int check_baseline ();
 
 
 
@@ -98,19 +858,26 @@ long int run_udp_test();
 int main (int argc, char * argv[]) {
 
 	check_input(argc,argv);
-	
-	int status;
-	struct addrinfo * s;
+	sched_getaffinity(0, sizeof(ti.place.allowed), &ti.place.allowed);
 
+	static struct live_counters live;
+	static struct histogram hist, conn_hist;
+	ti.live = &live;
+	ti.hist = &hist;
+	ti.conn_hist = &conn_hist;
+
+	/* check_input() has consumed the options. Shift argv so that the positional
+	arguments stay at argv[1] .. argv[5] */
+	argv += optind - 1;
 
-	int type = SOCK_STREAM;			/* ctrl socket type is TCP */
-	
 	ti.serv_name = argv[1];			/* Store the server name first */
 	ti.ctrl_port_str = argv[2];		/* Port string */
-	ti.test_port_str = argv[2];		/* In case of UDP, we use same port with UDP type socket */
+	ti.test_port_str = argv[2];		/* Until the server tells us which port to run the test on */
 	ti.ctrl_port = atoi(argv[2]);	/* Convert the port from string to number */
 	ti.n_prot = atoi(argv[4]);		/* Store the network layer protocol to be used */
 	ti.data_info = atol(argv[5]);	/* Size of the data to be sent */
+	if (ti.data_info == 0)
+		ti.data_info = LONG_MAX;	/* Timed test without a cap, check_input() made sure */
 
 	/* For convinience, store transport layer protocol as an int */
 	if (strcmp(argv[3],"TCP") == 0)
@@ -133,74 +900,53 @@ int main (int argc, char * argv[]) {
 		case 6: ti.domain = AF_INET6;
 				break;
 
+		/* Both, one after the other. compare() takes care of it */
+		case 46:
+				break;
+
 		default:
 				fprintf(stderr,"[ERROR]: Invalid network protocol %d\n",ti.n_prot);
 				exit(1);
 		}
 
 
-	/* Now lookup the server and populate the hostent structure
-
-	Apparently, gethostbyname() function is now obsolete. So I will have to try and use getaddrinfo()
-	which is new one.
-	server = gethostbyname(serv_name); 
-	
-	
-	getaddrinfo simplifies the matter a lot. I could remove all the ipv4/ipv6 specific things from the
-	previous case statement and now getaddrinfo will take care of it
-	*/
-
-	int ret;
-
-	/* Setting all the fields of addrinfo structure. Doing it for control as well as test connection.
-	This is because of the difference in the type of the socket.
-	If test is TCP test, the test addrinfo structure will be ignored */
-
-	memset(&ti.ctrl_serv, 0, sizeof(ti.ctrl_serv));
-	memset(&ti.test_serv, 0, sizeof(ti.test_serv));
-
-	ti.ctrl_serv.ai_family = ti.domain;			/* AF_INET or AF_INET6 */
-	ti.test_serv.ai_family = ti.domain;
-
-	ti.ctrl_serv.ai_socktype = SOCK_STREAM;		/* Stream of datagram */
-	ti.test_serv.ai_socktype = SOCK_DGRAM;
-
-	ti.ctrl_serv.ai_protocol = 0;				/* TCP or UDP - let OS chose */
-	ti.test_serv.ai_protocol = 0;
-
-	ti.ctrl_serv.ai_flags = AI_CANONNAME|AI_ADDRCONFIG;				/* Flags */
-	ti.test_serv.ai_flags = AI_CANONNAME|AI_ADDRCONFIG;
+	/* What we send comes out of the pool, the sendfile transmit path has a copy */
+	pool_init();
+	if (ti.tx_mode == TX_SENDFILE)
+		setup_payload();
 
-	/* Get address information for control connection. If needed, we will get the addr info
-	for test connection later (server won't know it has to setup UDP socket before handshake */
 
-	ret = getaddrinfo(ti.serv_name, ti.ctrl_port_str, &ti.ctrl_serv, &ti.ctrl_ptr);
-	if (ret != 0)
-		raise_error("[ERROR]: No such host");
-	
+	/* Read the baseline before we run anything, it may be the file we write to */
+	if (ti.base_name != NULL)
+		load_baseline();
+	if (ti.out_name != NULL)
+		open_output();
 
-	/* We have got a linked list of addresses. Parse through it, create the socket and try to connet
-	till we succeed */
+	if (ti.sweep)
+		sweep();
+	else if (ti.n_prot == 46 && ti.contend)
+		contend();
+	else if (ti.n_prot == 46)
+		compare();
+	else {
+		connect_ctrl();
 
-	for (s = ti.ctrl_ptr; s != NULL; s = s->ai_next) {
+		/* Call the function to start the tests. This function should take care of handshakes */
 
-		/* First create a socket */
-		ti.ctrlsock = socket(s->ai_family, s->ai_socktype, s->ai_protocol);
-		if (ti.ctrlsock == -1)
-			continue;
-		if (connect(ti.ctrlsock, s->ai_addr, s->ai_addrlen) == 0)
-			break;
+		perf_test();
 		close(ti.ctrlsock);
 		}
-	
 
-	/* Call the function to start the tests. This function should take care of handshakes */
-
-	perf_test();
+	if (ti.out != NULL && ti.out != stdout)
+		fclose(ti.out);
 
+	/* A regression is an exit status of its own, for whatever runs us nightly */
+	if (check_baseline() > 0) {
+		printf("[INFO]: Terminating client\n");
+		exit(2);
+		}
 
 	printf("[INFO]: Terminating client\n");
-	close(ti.ctrlsock);
 	exit(0);
 
 	}
@@ -217,63 +963,195 @@ int main (int argc, char * argv[]) {
 
 void perf_test () {
 
-	long int sent = 0;
 	long int sent_data = 0;
 	long int rcvd_data = 0;
-	char buff[BUFF_SIZE];
-	int stat = 0;
-	struct timespec start, start1, end;
+	long int send_time, rcvd_time = 0;
+	struct ctrl_msg m;
+	struct timespec start, send_end, end;
+	struct timespec mono_start, mono_end;
+	struct rusage ru_start, ru_end;
+	int hw[N_HW];
 
 	/* First we need to do initial handshake with the server.*/
 	
 	shake_hands();
-
-	/* Register the start time before we send first packet. */
+	place_test();
+
+	/* Register the start time before we send first packet. The resource usage
+	tells us how much CPU sending the data took (all threads together), the
+	hardware counters what it was spent on. Both count the threads we start from
+	here on too */
+	hw_open(&ti.cpu, hw);
+	getrusage(RUSAGE_SELF, &ru_start);
 	clock_gettime(CLOCK_REALTIME, &start);
+	clock_gettime(CLOCK_MONOTONIC, &mono_start);
+	ti.deadline.tv_sec = mono_start.tv_sec + ti.duration / 1000;
+	ti.deadline.tv_nsec = mono_start.tv_nsec + (ti.duration % 1000) * 1000000;
+	if (ti.deadline.tv_nsec >= 1000000000) {
+		ti.deadline.tv_sec++;
+		ti.deadline.tv_nsec -= 1000000000;
+		}
+	ti.live->begin = mono_start;
+	sampler_start();
+	tcpi_begin();
+
+	/* Both ways, our receiving runs next to the sending */
+	if (ti.direction == DIR_BOTH && pthread_create(&ti.rx_thread, NULL, run_receiver, NULL) != 0)
+		raise_error("[ERROR]: Could not start the receiver thread");
 
 	/* Call appropriate test function */
-	if (ti.t_prot == 1)
+	if (ti.direction == DIR_REVERSE)
+		run_receiver(NULL);
+	else if (ti.crr_size >= 0)
+		sent_data = run_crr();
+	else if (ti.req_size > 0 && ti.t_prot == 1)
+		sent_data = run_tcp_rr();
+	else if (ti.req_size > 0)
+		sent_data = run_udp_rr();
+	else if (ti.t_prot == 1 && ti.n_streams > 1)
+		sent_data = run_parallel_tcp_test();
+	else if (ti.t_prot == 1)
 		sent_data = run_tcp_test();
 	else if (ti.t_prot == 0)
 		sent_data = run_udp_test();
 	else
 		raise_error("[ERROR]: Invalid transport layer protocol");
 
-	/* We have sent all the data. Now wait for the server to send back the time when he received
-	the last chunk. 
-	I was hoping to transfer the timing info by simply transferring the raw timespec structure
-	from server to client. But that is not working as expected. Client always receives 0. Hence
-	now we convert the longs to strings and send */
+	clock_gettime(CLOCK_MONOTONIC, &mono_end);
+	clock_gettime(CLOCK_REALTIME, &send_end);
+	send_time = (mono_end.tv_sec - mono_start.tv_sec) * 1000000000L + (mono_end.tv_nsec - mono_start.tv_nsec);
+
+	/* In a timed test the server can't know when we are done */
+	if (ti.duration > 0)
+		end_test();
+
+	if (ti.direction == DIR_BOTH)
+		pthread_join(ti.rx_thread, NULL);
+
+	sampler_stop();
+	tcpi_end();
+	ti.live->end = mono_end;
+	__atomic_store_n(&ti.live->done, 1, __ATOMIC_RELAXED);
+	getrusage(RUSAGE_SELF, &ru_end);
+	hw_read(&ti.cpu, hw);
+
+	/* We have sent all the data. Now wait for the server to send back the time when he
+	received the last chunk, how much data it received and how long that took by its
+	clock. For UDP, also what it made of the sequence numbers. Its TCP_INFO samples,
+	if we asked for them, come first */
+
+	ti.peer_tcpi.n = 0;
+	while (ctrl_recv(ti.ctrlsock, &m) == 0 && m.type == MSG_SAMPLES)
+		tcpi_take(&m);
+	if (m.type != MSG_RESULT)
+		raise_error("[ERROR]: Receiving the results failed");
+	show_tcpi();
+
+	end.tv_sec = ctrl_get(&m, P_END_SEC, 0);
+	end.tv_nsec = ctrl_get(&m, P_END_NSEC, 0);
+	rcvd_data = ctrl_get(&m, P_RECEIVED, 0);
+	rcvd_time = ctrl_get(&m, P_RX_TIME, 0);
+	if (ctrl_get_str(&m, P_PLACEMENT, ti.peer_place, sizeof(ti.peer_place)) == 0)
+		printf("[INFO]: Placement (server): %s\n", ti.peer_place);
+	else
+		ti.peer_place[0] = '\0';
+	printf("Actual tranmitted data: %ld, Received data: %ld\n",sent_data, rcvd_data);
+
+	/* In a request/response test the round trips are what counts, and we timed
+	those ourselves */
+	if (ti.crr_size >= 0) {
+		show_crr(send_time, ctrl_get(&m, P_CONNS, 0), ctrl_get(&m, P_TFO_CONNS, 0));
+		ti.result = send_time > 0 ? ti.rr_done * 1000000000.0 / send_time : 0;
+		calc_cpu_cost(&ru_start, &ru_end, sent_data, 0, &m);
+		save_result(sent_data, rcvd_data, send_time, rcvd_time);
+		return;
+		}
+
+	if (ti.req_size > 0) {
+		show_latency(send_time);
+		ti.result = send_time > 0 ? ti.rr_done * 1000000000.0 / send_time : 0;
+		calc_cpu_cost(&ru_start, &ru_end, sent_data, 0, &m);
+		save_result(sent_data, rcvd_data, send_time, rcvd_time);
+		return;
+		}
 
-	bzero(buff, BUFF_SIZE);
-	stat = read(ti.ctrlsock, buff, BUFF_SIZE-1);		/* Receive the second information */
-	if (stat < 0)
-		raise_error("[ERROR]: Receiving the end timestamp failed");
-	end.tv_sec = atol(buff);
+	/* Only the server sent, so the numbers are all ours */
+	if (ti.direction == DIR_REVERSE) {
+		show_reverse(&m);
+		calc_cpu_cost(&ru_start, &ru_end, ti.rx_bytes, ti.rx_packets, &m);
+		save_result(sent_data, rcvd_data, send_time, rcvd_time);
+		return;
+		}
 
+	if (ti.t_prot == 0) {
+		ti.us.unique = ctrl_get(&m, P_UNIQUE, 0);
+		ti.us.duplicates = ctrl_get(&m, P_DUPLICATES, 0);
+		ti.us.reordered = ctrl_get(&m, P_REORDERED, 0);
+		ti.us.max_reorder = ctrl_get(&m, P_MAX_REORDER, 0);
+		ti.us.highest = ctrl_get(&m, P_HIGHEST, 0);
+		ti.us.jitter = ctrl_get(&m, P_JITTER, 0);
+		}
 
-	bzero(buff, BUFF_SIZE);
-	stat = read(ti.ctrlsock, buff, BUFF_SIZE-1);		/* Receive the nanosecond information */
-	if (stat < 0)
-		raise_error("[ERROR]: Receiving the end timestamp failed");
-	end.tv_nsec = atol(buff);
 
+	/* Now calculate the throughput. With parallel streams, first show what each
+	stream managed on its own. The server only tells us the aggregate, so the
+	per stream numbers are what we sent, timed by our own clock */
+	if (ti.direction == DIR_BOTH)
+		printf("\n[INFO]: Client to server\n");
 
+	if (ti.t_prot == 1 && ti.n_streams > 1) {
+		int i;
+		for (i = 0; i < ti.n_streams; i++) {
+			printf("\n[INFO]: Stream %d (sent)\n", ti.streams[i].id);
+			calc_throughput(ti.streams[i].sent, start, ti.streams[i].end);
+			}
+		printf("\n[INFO]: Aggregate of %d streams (received)\n", ti.n_streams);
+		}
 
+	calc_throughput(rcvd_data, start, end);
+	show_durations(sent_data, send_time, rcvd_data, rcvd_time);
+	ti.result = rcvd_time > 0 ? rcvd_data * 8000.0 / rcvd_time : 0;
+
+	/* For UDP the packet rate is what counts at small sizes. All our datagrams are of
+	the same size, so the server's byte count tells us how many it received */
+	if (ti.t_prot == 0)
+		calc_packet_rate(ti.sent_packets, rcvd_data / ti.msg_size, send_time, rcvd_time);
+
+	if (ti.t_prot == 0) {
+		ti.tx_pps = send_time > 0 ? ti.sent_packets * 1e9 / send_time : 0;
+		ti.rx_pps = rcvd_time > 0 ? rcvd_data / ti.msg_size * 1e9 / rcvd_time : 0;
+		ti.loss = ti.sent_packets > 0 ? 100.0 * (ti.sent_packets - ti.us.unique) / ti.sent_packets : 0;
+		}
 
-	/* Now receive info about how much data was actually received */
+	if (ti.t_prot == 0)
+		show_udp_stats(ti.sent_packets, &ti.us);
 
-	bzero(buff, BUFF_SIZE);
-	stat = read(ti.ctrlsock, buff, BUFF_SIZE-1); 
-	if (stat < 0)
-		raise_error("[ERROR]: Receiving the info about transmitted data failed");
-	
-	rcvd_data = atol(buff);
-	printf("Actual tranmitted data: %ld, Received data: %ld\n",sent_data, rcvd_data);
+	if (ti.t_prot == 0 && ti.rate > 0)
+		show_pacing(sent_data);
 
+	if (ti.t_prot == 0 && ti.gso_segs > 0)
+		printf("\n[INFO]: GSO segment size %d bytes, up to %d segments per send, %ld super-datagrams sent\n",
+			ti.msg_size, ti.gso_segs, ti.gso_sends);
 
-	/* Now calculate the throughput */
-	calc_throughput(rcvd_data, start, end);
+	/* What the transmit path cost us */
+	if (ti.t_prot == 1) {
+		printf("\n[INFO]: TCP transmit path: %s\n", tx_mode_name[ti.tx_mode]);
+		if (ti.tx_mode == TX_ZEROCOPY)
+			printf("[INFO]: Zerocopy sends: %u, copied by the kernel anyway: %u\n", ti.zc_sent, ti.zc_copied);
+		}
+
+	if (ti.uring_ops > 0)
+		printf("\n[INFO]: io_uring: %ld writes in %ld system calls (%.1f per call)\n",
+			ti.uring_ops, ti.uring_enters, ti.uring_enters > 0 ? (double) ti.uring_ops / ti.uring_enters : 0);
+
+	if (ti.direction == DIR_BOTH)
+		show_reverse(&m);
+
+	if (ti.verify)
+		show_verify(&m);
+
+	calc_cpu_cost(&ru_start, &ru_end, sent_data + ti.rx_bytes, ti.sent_packets + ti.rx_packets, &m);
+	save_result(sent_data, rcvd_data, send_time, rcvd_time);
 
 	return;
 	}
@@ -281,6 +1159,49 @@ void perf_test () {
 
 
 
+/* time_up: This function tells the send loops of a timed test (-t) whether the
+	time is up. Without -t it never is. A vDSO call, next to nothing compared to
+	the sending */
+
+int time_up () {
+
+	struct timespec now;
+
+	if (ti.duration == 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > ti.deadline.tv_sec || (now.tv_sec == ti.deadline.tv_sec && now.tv_nsec >= ti.deadline.tv_nsec);
+	}
+
+
+
+
+/* end_test: This function tells the server that a timed test is over. Over TCP the
+	data comes on the control connection, so we close our side of it (we only read
+	from it from here on) and the server sees EOF. Parallel streams are closed
+	already. For UDP there is nothing to close, so we say it on the control
+	connection, with how many datagrams we sent */
+
+void end_test () {
+
+	struct ctrl_msg m;
+
+	if (ti.t_prot == 1 && ti.n_streams == 1) {
+		if (shutdown(ti.ctrlsock, SHUT_WR) < 0)
+			raise_error("[ERROR]: Could not end the test");
+		}
+	else if (ti.t_prot == 0) {
+		ctrl_init(&m, MSG_END);
+		ctrl_put(&m, P_SENT_PKTS, ti.sent_packets);
+		if (ctrl_send(ti.ctrlsock, &m) < 0)
+			raise_error("[ERROR]: Could not end the test");
+		}
+	}
+
+
+
+
 
 /* run_tcp_test: This function runs the test assuming TCP socket.
 	It keeps on transmitting the data until we have sent enough data.
@@ -288,22 +1209,29 @@ void perf_test () {
 
 long int run_tcp_test () {
 
-	char buff[BUFF_SIZE];
+	struct tx_state tx;
 	int stat = 0;
 	long int sent = 0;
 
-	printf("[INFO]: Starting the perf test with TCP\n");
+	/* The io_uring engine has a loop of its own. If the kernel won't give us a
+	ring, we carry on with plain writes */
+	if (ti.engine == ENGINE_URING && (sent = run_tcp_uring()) >= 0)
+		return sent;
+	sent = 0;
 
-	while (sent < ti.data_info) {
+	printf("[INFO]: Starting the perf test with TCP\n");
 
-		stat = write(ti.testsock, buff, BUFF_SIZE-1);
+	tx_init(&tx, ti.testsock);
 
-		if (stat < BUFF_SIZE-1)
-			raise_error("[ERROR]: Write on the socket failed");
+	while (sent < ti.data_info && !time_up()) {
 
+		stat = tx_send(&tx, ti.testsock, ti.data_info - sent);
 		sent += stat;
+		__atomic_store_n(&ti.live->bytes, sent, __ATOMIC_RELAXED);
 		}
 
+	tx_finish(&tx, ti.testsock);
+
 	return sent;
 	}
 
@@ -314,31 +1242,84 @@ long int run_tcp_test () {
 
 
 
-/* run_udp_test: This function runs the test assuming UDP socket.
-	It keeps on transmitting the data until we have sent enough data packets.
-	It then returns how much data we sent */
+/* run_tcp_uring: This function is run_tcp_test() with io_uring. Up to URING_DEPTH
+	writes of ti.msg_size bytes are in flight at a time, and one io_uring_enter()
+	hands over all the new ones and waits for at least one to finish. The payload pool
+	and the socket are registered with the ring, so the kernel does not have to look
+	them up (and pin the pages) for every write again.
 
+	The writes take chunk after chunk of the pool, and the kernel may finish them in
+	any order, which is fine as long as nobody looks at the data. A short write just
+	means the rest is sent by a later one. It returns how much we sent, or -1 if
+	io_uring could not be set up */
 
-long int run_udp_test() {
+long int run_tcp_uring () {
 
-	char buff[BUFF_SIZE];
-	int stat = 0;
-	int sent = 0;			/* This is packet counter */
-	long int sent_data = 0;	/* This is actual data bytes */
-	
-	printf("[INFO]: Starting the perf test with UDP\n");
+	struct uring r;
+	struct io_uring_sqe * sqe;
+	struct io_uring_cqe * cqe;
+	struct iovec iov;
+	size_t cur = 0;
+	int len, inflight = 0;
+	long int queued = 0, sent = 0, limit = ti.data_info;
+
+	if (uring_init(&r, URING_DEPTH) < 0) {
+		perror("[WARNING]: Could not set up io_uring, sending with write() instead");
+		return -1;
+		}
+
+	iov.iov_base = ti.pool;
+	iov.iov_len = POOL_SIZE;
+	if (uring_register(&r, IORING_REGISTER_BUFFERS, &iov, 1) < 0 ||
+		uring_register(&r, IORING_REGISTER_FILES, &ti.testsock, 1) < 0) {
+		perror("[WARNING]: Could not register with io_uring, sending with write() instead");
+		uring_free(&r);
+		return -1;
+		}
 
-	while (sent < ti.data_info) {
+	printf("[INFO]: Starting the perf test with TCP over io_uring (%d writes in flight)\n", URING_DEPTH);
 
-		stat = sendto(ti.testsock, buff, BUFF_SIZE-1, 0, ti.test_ptr->ai_addr, ti.test_ptr->ai_addrlen);
-		if (stat < BUFF_SIZE-1)
-			raise_error("[ERROR]: Write on the socket failed");
+	while (sent < limit) {
+
+		/* Out of time. What is in flight still has to finish, but nothing more goes in */
+		if (time_up() && (limit = queued) <= sent)
+			break;
+
+		/* Top the queue up. Never ask for more than is left to send */
+		while (inflight < URING_DEPTH && queued < limit && (sqe = uring_sqe(&r)) != NULL) {
+			len = limit - queued < ti.msg_size ? limit - queued : ti.msg_size;
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->flags = IOSQE_FIXED_FILE;
+			sqe->fd = 0;					/* Index into the registered files */
+			sqe->addr = (uintptr_t) pool_next(&cur, len);
+			sqe->len = len;
+			sqe->buf_index = 0;
+			sqe->user_data = len;
+			queued += len;
+			inflight++;
+			}
+
+		if (uring_enter(&r, 1) < 0)
+			raise_error("[ERROR]: io_uring_enter failed");
+
+		while ((cqe = uring_cqe(&r)) != NULL) {
+			if (cqe->res <= 0) {
+				errno = cqe->res < 0 ? -cqe->res : EPIPE;
+				raise_error("[ERROR]: Write on the socket failed");
+				}
+			sent += cqe->res;
+			queued -= (long int) cqe->user_data - cqe->res;
+			inflight--;
+			ti.uring_ops++;
+			uring_seen(&r);
+			}
 
-		sent++;
-		sent_data += stat;
+		__atomic_store_n(&ti.live->bytes, sent, __ATOMIC_RELAXED);
 		}
-	
-	return sent_data;
+
+	ti.uring_enters = r.enters;
+	uring_free(&r);
+	return sent;
 	}
 
 
@@ -348,34 +1329,28 @@ long int run_udp_test() {
 
 
 
+/* run_parallel_tcp_test: This function runs the TCP test over ti.n_streams test
+	connections at once. Each connection is driven by its own thread which writes
+	its share of the data and then closes its side, so that the server sees EOF.
+	It returns how much data all the streams sent together */
 
+long int run_parallel_tcp_test () {
 
-/* calc_throughput: This function receives the datasize and the start and end timestamps.
-	It then calculates the throughput and displays on stdout */
+	int i;
+	long int sent = 0;
 
-void calc_throughput (long int data, struct timespec s, struct timespec e) {
+	printf("[INFO]: Starting the perf test with TCP over %d streams\n", ti.n_streams);
 
-	long double start = s.tv_sec * 1000000000 + s.tv_nsec;
-	long double end = e.tv_sec * 1000000000 + e.tv_nsec;
-	long double diff = end - start;
+	for (i = 0; i < ti.n_streams; i++)
+		if (pthread_create(&ti.streams[i].thread, NULL, run_tcp_stream, &ti.streams[i]) != 0)
+			raise_error("[ERROR]: Could not start the stream thread");
 
-	if (diff <= 0) {
-		fprintf(stderr,"[ERROR]: Clocks on server and client seem to be out of sync.\nRun ntpd on both and try again\n");
-		exit(1);
+	for (i = 0; i < ti.n_streams; i++) {
+		pthread_join(ti.streams[i].thread, NULL);
+		sent += ti.streams[i].sent;
 		}
 
-	data *= 8;
-	diff /= 1000000;
-	long double throughput = 0;
-	throughput = (data * 1000) / (1024 * diff);
-
-	/* Sadly this fomatting is giving trouble, no matter what format specifier I use */
-	printf("\n\
-	+-----------------+-------------------+---------------------+\n\
-	| Datasize (bits) |   Time Taken (ms) |   Throughput (Kbps) |\n\
-	+-----------------+-------------------+---------------------+\n\
-	|    %10ld   |     %-5.6Lf  |   %8.8Lf   |\n\
-	+-----------------+-------------------+---------------------+\n", data, diff, throughput);
+	return sent;
 	}
 
 
@@ -384,134 +1359,4350 @@ void calc_throughput (long int data, struct timespec s, struct timespec e) {
 
 
 
-/* shake_hands: This function is to do initial handshake with the client and tell us how
-	much data are we expecting.
-	This should include the following:
-		1. Send indication that client is ready for handshake
-		2. Send information about the transport layer protocol
-		3. Send information about the data size (bytes/packets)
-		4*. Send confirmation that clock is synced on client (Not implemented)
-		5. Receive server ready indicator */
 
-void shake_hands () {
+/* run_tcp_stream: This is the thread body for one parallel stream. It is the
+	same loop as run_tcp_test(), except that the counter lives in the (cache line
+	padded) stream structure and we note down when we are done */
 
-	int bsize = 256;
-	char buff[256];
+void * run_tcp_stream (void * arg) {
 
-	int read_ele, wrote_ele;
+	struct stream_info * st = (struct stream_info *) arg;
+	struct tx_state tx;
+	long int sent = 0;
+	int i;
 
-	printf("[INFO]: Starting handshake with server\n");
+	pin_thread(st->id);
+	tx_init(&tx, st->sock);
 
+	while (sent < st->target && !time_up()) {
+		sent += tx_send(&tx, st->sock, st->target - sent);
+		__atomic_store_n(&st->sent, sent, __ATOMIC_RELAXED);
+		}
 
+	tx_finish(&tx, st->sock);
 
-	/* send "ready" to server */
-	bzero(buff,bsize);
-	strcpy(buff,"ready");
+	clock_gettime(CLOCK_REALTIME, &st->end);
 
-	wrote_ele = write(ti.ctrlsock, buff, 5);
-	if (wrote_ele < 0)
-		raise_error("[ERROR]: Write failed during handshake.");
-	printf("[INFO]: Client ready for handshake\n");
-	
+	/* The TCP_INFO sampler may still be looking at it */
+	i = st->sock;
+	__atomic_store_n(&st->sock, -1, __ATOMIC_RELAXED);
+	close(i);
 
+	return NULL;
+	}
 
 
-	/* Now we need to tell the server about the transport layer protocol */
-	bzero(buff,bsize);
 
-	if (ti.t_prot == 1) {
-		printf("[INFO]: Informing server this is TCP test\n");
-		strcpy(buff,"TCP");
-		}
-	else if (ti.t_prot == 0) {
-		printf("[INFO]: Informing server this is UDP test\n");
-		strcpy(buff,"UDP");
-		}
-	else
-		raise_error("[ERROR]: Invalid transport layer protocol");
 
 
-	wrote_ele = write(ti.ctrlsock, buff, 3);
-	if (wrote_ele < 0)
-		raise_error("[ERROR]: Write failed during handshake.");
 
 
 
+/* tx_init: This function gets a thread ready to send on a TCP socket with the
+	transmit path picked with -Z. The data comes out of the pool, which nobody
+	writes to once it is set up; MSG_ZEROCOPY can pin its pages as long as it
+	likes. Only the pattern of a payload check (-V) is made per chunk, in a buffer
+	of our own */
 
+void tx_init (struct tx_state * tx, int sock) {
 
+	int one = 1;
 
-	/* send datasize string to server. This should not be more than
-	10 characters (we are not expecting GBs of data or for UDP, send
-	number of datagrams we are going to transmit. */
-	bzero(buff,bsize);
+	memset(tx, 0, sizeof(*tx));
 
-	itoa(ti.data_info, buff);
+	if (ti.tx_mode == TX_SENDFILE)
+		return;
 
-	wrote_ele = write(ti.ctrlsock, buff, 10);
-	if (wrote_ele < 0)
-		raise_error("[ERROR]: Write failed during handshake.");
-	printf("[INFO]: Sent data size information (%ld)\n",ti.data_info);
-	
+	/* Every connection has a pattern of its own. The server tells them apart by
+	our port */
+	if (ti.verify) {
+		if (posix_memalign((void **) &tx->buff, 4096, ti.msg_size) != 0)
+			raise_error("[ERROR]: Could not allocate the send buffer");
+		tx->seed = pat_seed(ti.seed, local_port(sock));
+		}
 
-	/* Now depending on transport layer protocol to be used, we need to set
-	the test socket descriptor */
+	if (ti.tx_mode == TX_ZEROCOPY && setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+		raise_error("[ERROR]: Could not enable SO_ZEROCOPY on the test socket");
+	}
 
-	/* In case of TCP, we already have a connection */
-	if (ti.t_prot == 1) {
-		ti.testsock = ti.ctrlsock;
-		ti.test_port = ti.ctrl_port;
-		}
-	
-	/* For UDP, we need to create a UDP socket */
-	else if (ti.t_prot == 0) {
 
-		/* Now here, server should ideally be waiting for us to connect on a port. So attempt
-		to connect. Keep in mind that server has to create a socket, bind, listen etc. So
-		sleep a little before proceeding */
 
-		sleep(1);
-		int ret;
 
-		ret = getaddrinfo(ti.serv_name, ti.test_port_str, &ti.test_serv, &ti.test_ptr);
-		if (ret != 0)
-			raise_error("[ERROR]: No such host for test");
-	
-		struct addrinfo * s;
-	
-		for (s = ti.test_ptr; s != NULL; s = s->ai_next) {
+/* tx_send: This function sends one chunk (ti.msg_size bytes, like the plain write()
+	loop always did, but never more than is left to send) with the
+	selected transmit path and returns how much went out. Exactly the datasize:
+	the single stream test runs on the control connection, and if the server
+	closes it with our extra bytes unread, the kernel resets it and takes the
+	results with it. Any failure is fatal, just like a short write() used to be */
 
-			/* First create a socket */
-			ti.testsock = socket(s->ai_family, s->ai_socktype, s->ai_protocol);
-			if (ti.testsock != -1) {
-				ti.test_ptr = s;
-				break;
-				}
+int tx_send (struct tx_state * tx, int sock, long int left) {
 
-			close(ti.testsock);
-			}
+	ssize_t stat = 0;
+	char * buff;
+	int len = left < ti.msg_size ? left : ti.msg_size;
 
-		if (s == NULL)
+	switch (ti.tx_mode) {
+
+		case TX_COPY:
+			if (ti.verify)
+				pat_fill(tx->buff, len, tx->seed, tx->pos);
+			stat = write(sock, ti.verify ? tx->buff : pool_next(&tx->cur, len), len);
+			if (stat < len)
+				raise_error("[ERROR]: Write on the socket failed");
+			tx->pos += stat;
+			break;
+
+		case TX_ZEROCOPY:
+
+			/* The kernel keeps one notification per send (or range of sends) on the
+			error queue. If we never read them, it eventually refuses with ENOBUFS */
+			buff = pool_next(&tx->cur, len);
+			while ((stat = send(sock, buff, len, MSG_ZEROCOPY)) < 0 && errno == ENOBUFS)
+				tx_reap_zerocopy(tx, sock);
+
+			if (stat <= 0)
+				raise_error("[ERROR]: Zerocopy send on the socket failed");
+
+			if (++tx->zc_sent % ZC_REAP_EVERY == 0)
+				tx_reap_zerocopy(tx, sock);
+			break;
+
+		case TX_SENDFILE:
+
+			/* sendfile() can send less than asked. That is fine, the caller counts
+			whatever went out */
+			if (tx->off + len > PAYLOAD_SIZE)
+				tx->off = 0;
+			stat = sendfile(sock, ti.memfd, &tx->off, len);
+			if (stat <= 0)
+				raise_error("[ERROR]: sendfile on the socket failed");
+			break;
+		}
+
+	return stat;
+	}
+
+
+
+
+/* tx_finish: This function waits for the kernel to release every MSG_ZEROCOPY
+	buffer we handed over (the pool must not change before) and adds up the counts */
+
+void tx_finish (struct tx_state * tx, int sock) {
+
+	struct pollfd pfd;
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+	if (ti.tx_mode == TX_ZEROCOPY) {
+
+		pfd.fd = sock;
+		pfd.events = 0;			/* POLLERR is always reported */
+
+		while (tx->zc_done < tx->zc_sent) {
+			if (poll(&pfd, 1, 1000) <= 0) {
+				fprintf(stderr,"[WARNING]: %u zerocopy completions never arrived\n", tx->zc_sent - tx->zc_done);
+				break;
+				}
+			tx_reap_zerocopy(tx, sock);
+			}
+
+		pthread_mutex_lock(&lock);
+		ti.zc_sent += tx->zc_sent;
+		ti.zc_copied += tx->zc_copied;
+		pthread_mutex_unlock(&lock);
+		}
+
+	free(tx->buff);
+	}
+
+
+
+
+/* tx_reap_zerocopy: This function reads all the MSG_ZEROCOPY notifications sitting
+	on the error queue of the socket. Each one covers a range of sends [ee_info, ee_data].
+	If the kernel had to copy the data after all (loopback does this, for example), the
+	notification says so and we count it */
+
+void tx_reap_zerocopy (struct tx_state * tx, int sock) {
+
+	struct msghdr msg;
+	struct cmsghdr * cm;
+	struct sock_extended_err * serr;
+	char control[128];
+	unsigned int n;
+
+	for (;;) {
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return;
+			raise_error("[ERROR]: Reading the zerocopy completions failed");
+			}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+
+			if ( !(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+				 !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) )
+				continue;
+
+			serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			n = serr->ee_data - serr->ee_info + 1;
+			tx->zc_done += n;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				tx->zc_copied += n;
+			}
+		}
+	}
+
+
+
+
+
+
+
+
+/* setup_payload: This function creates the memfd the sendfile transmit path sends
+	from, with the start of the pool in it. We write it out once so that every page
+	is really there in the page cache and sendfile() only has to hand the pages to
+	the socket */
+
+void setup_payload () {
+
+	ti.memfd = memfd_create("c_perf_payload", 0);
+	if (ti.memfd < 0)
+		raise_error("[ERROR]: Could not create the payload memfd");
+
+	if (write(ti.memfd, ti.pool, PAYLOAD_SIZE) != PAYLOAD_SIZE)
+		raise_error("[ERROR]: Could not fill the payload memfd");
+	}
+
+
+
+
+/* pool_init: This function sets up the payload pool, once for all the tests we run:
+	POOL_SIZE bytes, aligned to a huge page, with what -p asks for in it. Every
+	sender walks through it chunk after chunk, so random data doesn't repeat within
+	any compression window, and the same pages (and TLB entries) serve every run.
+
+	With -H we try the huge page pool (vm.nr_hugepages) first, then transparent huge
+	pages, and lock the pool in memory. Anything that doesn't work is only a warning,
+	pool_desc says what we got. Filling it faults every page in before the first test */
+
+void pool_init () {
+
+	uint64_t x, w;
+	struct timespec now;
+	size_t i;
+
+	ti.pool = MAP_FAILED;
+	ti.pool_node = -1;
+	if (ti.huge) {
+		ti.pool = mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ti.pool == MAP_FAILED)
+			perror("[WARNING]: No huge pages for the payload pool, trying transparent ones");
+		else
+			snprintf(ti.pool_desc, sizeof(ti.pool_desc), "huge pages");
+		}
+
+	if (ti.pool == MAP_FAILED) {
+		if (posix_memalign((void **) &ti.pool, HUGE_PAGE, POOL_SIZE) != 0)
+			raise_error("[ERROR]: Could not allocate the payload pool");
+		if (!ti.huge)
+			snprintf(ti.pool_desc, sizeof(ti.pool_desc), "pages");
+		else if (madvise(ti.pool, POOL_SIZE, MADV_HUGEPAGE) < 0)
+			perror("[WARNING]: No transparent huge pages for the payload pool");
+		else
+			snprintf(ti.pool_desc, sizeof(ti.pool_desc), "transparent huge pages");
+		}
+
+	if (ti.huge && mlock(ti.pool, POOL_SIZE) < 0)
+		perror("[WARNING]: Could not lock the payload pool in memory");
+	else if (ti.huge)
+		strncat(ti.pool_desc, ", locked", sizeof(ti.pool_desc) - strlen(ti.pool_desc) - 1);
+
+	switch (ti.payload) {
+
+		case PAYLOAD_ZEROS:
+			memset(ti.pool, 0, POOL_SIZE);
+			break;
+
+		case PAYLOAD_REPEAT:
+			for (i = 0; i < POOL_SIZE; i++)
+				ti.pool[i] = i;
+			break;
+
+		/* splitmix64, a word per step */
+		case PAYLOAD_RANDOM:
+			clock_gettime(CLOCK_REALTIME, &now);
+			x = now.tv_sec ^ now.tv_nsec ^ ((uint64_t) getpid() << 32);
+			for (i = 0; i < POOL_SIZE; i += 8) {
+				w = (x += 0x9e3779b97f4a7c15ULL);
+				w = (w ^ (w >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				w = (w ^ (w >> 27)) * 0x94d049bb133111ebULL;
+				w ^= w >> 31;
+				memcpy(ti.pool + i, &w, 8);
+				}
+			break;
+		}
+
+	printf("[INFO]: Payload: %d MB of %s in %s\n", POOL_SIZE >> 20, payload_name[ti.payload], ti.pool_desc);
+	}
+
+
+
+
+/* pool_next: This function hands a sender the next len bytes of the pool, from
+	where its cursor (*cur) is. A chunk that doesn't fit before the end starts over
+	at the beginning, so every chunk is in one piece */
+
+char * pool_next (size_t * cur, size_t len) {
+
+	char * p;
+
+	if (*cur + len > POOL_SIZE)
+		*cur = 0;
+	p = ti.pool + *cur;
+	*cur += len;
+	return p;
+	}
+
+
+
+
+/* pat_word: This function is the payload pattern of a verified test (-V). Every 8
+	bytes of a stream, counted from its start, are one word of a sequence seeded for
+	that stream: seed + w * PAT_STEP, scrambled with a shift. No two words of a
+	stream are the same, so a byte that is changed, lost, duplicated or moved shows.
+	The loops step from one word to the next with an add, a shift and an xor, which
+	the CPU does for several words at once. It has to stay the same as in s_perf.c */
+
+uint64_t pat_word (uint64_t seed, uint64_t w) {
+
+	uint64_t x = seed + w * PAT_STEP;
+
+	return x ^ (x >> 29);
+	}
+
+
+
+
+/* pat_byte: This function is byte off of the pattern, the words are little endian.
+	It has to stay the same as in s_perf.c */
+
+unsigned char pat_byte (uint64_t seed, uint64_t off) {
+
+	return pat_word(seed, off / 8) >> (off % 8 * 8);
+	}
+
+
+
+
+/* pat_seed: This function gives the pattern of one stream of the test: a TCP
+	connection by our port, the UDP test by port 0. It has to stay the same as in
+	s_perf.c */
+
+uint64_t pat_seed (uint64_t seed, int port) {
+
+	return pat_word(seed, (uint64_t) port << 32);
+	}
+
+
+
+
+/* pat_fill: This function puts the pattern of a stream at offset off of it into
+	len bytes at buf. The words are little endian, so a chunk may start and end
+	anywhere in one */
+
+void pat_fill (char * buf, size_t len, uint64_t seed, uint64_t off) {
+
+	uint64_t w[PAT_LANES], x[PAT_LANES];
+	size_t i = 0;
+	int k;
+
+	for (; i < len && (off + i) % 8 != 0; i++)
+		buf[i] = pat_byte(seed, off + i);
+
+	/* PAT_LANES words at a time, every lane steps on by as many. They don't wait
+	for each other, so the CPU works on all of them at once */
+	for (k = 0; k < PAT_LANES; k++)
+		x[k] = seed + ((off + i) / 8 + k) * PAT_STEP;
+
+	for (; i + sizeof(w) <= len; i += sizeof(w)) {
+		for (k = 0; k < PAT_LANES; k++) {
+			w[k] = htole64(x[k] ^ (x[k] >> 29));
+			x[k] += PAT_LANES * PAT_STEP;
+			}
+		memcpy(buf + i, w, sizeof(w));
+		}
+
+	for (; i < len; i++)
+		buf[i] = pat_byte(seed, off + i);
+	}
+
+
+
+
+/* local_port: This function returns our port of a connection, 0 if we can't tell */
+
+int local_port (int sock) {
+
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+
+	if (getsockname(sock, (struct sockaddr *) &local, &len) < 0)
+		return 0;
+	if (local.ss_family == AF_INET)
+		return ntohs(((struct sockaddr_in *) &local)->sin_port);
+	return ntohs(((struct sockaddr_in6 *) &local)->sin6_port);
+	}
+
+
+
+
+/* show_verify: This function shows what the server found when it checked our
+	payload. Every test is over one family, compare() adds them up per family */
+
+void show_verify (struct ctrl_msg * m) {
+
+	ti.checked = ctrl_get(m, P_CHECKED, 0);
+	ti.corrupt_bytes = ctrl_get(m, P_CORRUPT_BYTES, 0);
+	ti.corrupt_chunks = ctrl_get(m, P_CORRUPT_CHUNKS, 0);
+
+	if (ti.corrupt_bytes == 0)
+		printf("\n[INFO]: Payload check (ipv%d): all %ld bytes as sent\n", ti.n_prot, ti.checked);
+	else
+		printf("\n[WARNING]: Payload check (ipv%d): %ld of %ld bytes corrupted, in %ld %s\n",
+			ti.n_prot, ti.corrupt_bytes, ti.checked, ti.corrupt_chunks, ti.t_prot == 1 ? "reads" : "datagrams");
+	}
+
+
+
+
+
+
+
+
+/* uring_init: This function sets up an io_uring with room for entries submissions
+	and maps its rings. The submission array never changes, entry i always points
+	at submission i, so it is filled in once here. Returns -1 (with errno) if the
+	kernel won't give us a ring, because it is too old or io_uring is switched off */
+
+int uring_init (struct uring * r, unsigned int entries) {
+
+	struct io_uring_params p;
+	unsigned int i;
+	char * sq, * cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Newer kernels have both rings in one mapping */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = 0;
+		}
+
+	r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_ring = r->cq_len == 0 ? r->sq_ring :
+		mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+	if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+		uring_free(r);
+		return -1;
+		}
+
+	sq = r->sq_ring;
+	cq = r->cq_ring;
+	r->sq_khead = (unsigned int *) (sq + p.sq_off.head);
+	r->sq_ktail = (unsigned int *) (sq + p.sq_off.tail);
+	r->sq_array = (unsigned int *) (sq + p.sq_off.array);
+	r->sq_mask = *(unsigned int *) (sq + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sq_tail = r->sq_submitted = *r->sq_ktail;
+	r->cq_khead = (unsigned int *) (cq + p.cq_off.head);
+	r->cq_ktail = (unsigned int *) (cq + p.cq_off.tail);
+	r->cq_mask = *(unsigned int *) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	for (i = 0; i < r->sq_entries; i++)
+		r->sq_array[i] = i;
+
+	return 0;
+	}
+
+
+
+
+/* uring_sqe: This function hands out the next free submission entry, cleared, or
+	NULL if all of them are still waiting for the kernel to take them */
+
+struct io_uring_sqe * uring_sqe (struct uring * r) {
+
+	struct io_uring_sqe * sqe;
+
+	if (r->sq_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE) >= r->sq_entries)
+		return NULL;
+
+	sqe = &r->sqes[r->sq_tail & r->sq_mask];
+	r->sq_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+	}
+
+
+
+
+/* uring_enter: This function publishes the submissions filled since the last call,
+	hands them to the kernel and waits till at least wait of them have completed,
+	all in one system call. Returns -1 (with errno) if that fails */
+
+int uring_enter (struct uring * r, unsigned int wait) {
+
+	int ret;
+
+	/* The entries have to be visible before the tail that says they are there */
+	__atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+
+	while ((ret = syscall(__NR_io_uring_enter, r->fd, r->sq_tail - r->sq_submitted, wait,
+						  wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0 && errno == EINTR)
+		;
+
+	r->enters++;
+	if (ret < 0)
+		return -1;
+
+	r->sq_submitted += ret;
+	return 0;
+	}
+
+
+
+
+/* uring_cqe: This function returns the oldest completion we have not looked at
+	yet, or NULL if there is none. uring_seen() gives its slot back to the kernel */
+
+struct io_uring_cqe * uring_cqe (struct uring * r) {
+
+	unsigned int head = *r->cq_khead;
+
+	if (head == __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & r->cq_mask];
+	}
+
+void uring_seen (struct uring * r) {
+
+	__atomic_store_n(r->cq_khead, *r->cq_khead + 1, __ATOMIC_RELEASE);
+	}
+
+
+
+
+/* uring_register: This function registers buffers or files (n of them at arg) with
+	the ring. Returns -1 (with errno) if the kernel refuses */
+
+int uring_register (struct uring * r, unsigned int opcode, void * arg, unsigned int n) {
+
+	return syscall(__NR_io_uring_register, r->fd, opcode, arg, n) < 0 ? -1 : 0;
+	}
+
+
+
+
+/* uring_free: This function unmaps the rings and closes the ring. Whatever is still
+	in flight is cancelled by the kernel */
+
+void uring_free (struct uring * r) {
+
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_len > 0 && r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+		munmap(r->cq_ring, r->cq_len);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_len);
+	close(r->fd);
+	}
+
+
+
+
+
+
+
+
+/* sampler_start: This function starts the interval reporter, if we were asked for
+	one (-i). The reporter only ever reads the live counters, so the send loops don't
+	know or care whether it runs */
+
+void sampler_start () {
+
+	pthread_condattr_t attr;
+
+	if (ti.interval <= 0)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ti.smp.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&ti.smp.lock, NULL);
+	ti.smp.stop = 0;
+
+	if (pthread_create(&ti.smp.thread, NULL, run_sampler, NULL) != 0) {
+		perror("[WARNING]: Could not start the interval reporter");
+		return;
+		}
+	ti.smp.running = 1;
+	}
+
+
+
+
+/* sampler_stop: This function wakes the interval reporter up, tells it to stop and
+	waits for it. Safe to call when there is none */
+
+void sampler_stop () {
+
+	if (!ti.smp.running)
+		return;
+
+	pthread_mutex_lock(&ti.smp.lock);
+	ti.smp.stop = 1;
+	pthread_cond_signal(&ti.smp.cond);
+	pthread_mutex_unlock(&ti.smp.lock);
+
+	pthread_join(ti.smp.thread, NULL);
+	pthread_cond_destroy(&ti.smp.cond);
+	pthread_mutex_destroy(&ti.smp.lock);
+	ti.smp.running = 0;
+	}
+
+
+
+
+/* run_sampler: This is the thread body of the interval reporter. Every ti.interval
+	ms it reads the counters and prints what changed since the last time. The
+	deadlines are absolute, so printing doesn't make the intervals drift. How much
+	of it got lost only the server knows */
+
+void * run_sampler (void * arg) {
+
+	struct timespec start, due;
+	long int bytes, packets, last_bytes = 0, last_packets = 0;
+	long int rx, last_rx = 0;
+	double from = 0, to, secs;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&ti.smp.lock);
+
+	for (n = 1; !ti.smp.stop; n++) {
+
+		due.tv_sec = start.tv_sec + ((long int) n * ti.interval) / 1000;
+		due.tv_nsec = start.tv_nsec + (((long int) n * ti.interval) % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+			}
+
+		while (!ti.smp.stop && pthread_cond_timedwait(&ti.smp.cond, &ti.smp.lock, &due) != ETIMEDOUT);
+		if (ti.smp.stop)
+			break;
+
+		bytes = __atomic_load_n(&ti.live->bytes, __ATOMIC_RELAXED);
+		if (ti.t_prot == 1 && ti.n_streams > 1)
+			for (i = 0, bytes = 0; i < ti.n_streams; i++)
+				bytes += __atomic_load_n(&ti.streams[i].sent, __ATOMIC_RELAXED);
+
+		to = (double) n * ti.interval / 1000;
+		secs = to - from;
+
+		if (ti.t_prot == 0) {
+			packets = __atomic_load_n(&ti.live->packets, __ATOMIC_RELAXED);
+			printf("[INFO]: %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s %9ld pkts %10.0f pkt/s (sent)\n",
+				from, to, bytes - last_bytes, (bytes - last_bytes) * 8 / secs / 1e6,
+				packets - last_packets, (packets - last_packets) / secs);
+			last_packets = packets;
+			}
+		else if (ti.crr_size >= 0) {
+			packets = __atomic_load_n(&ti.live->packets, __ATOMIC_RELAXED);
+			printf("[INFO]: %7.2f-%-7.2f s %9ld conns %10.0f conn/s\n",
+				from, to, packets - last_packets, (packets - last_packets) / secs);
+			last_packets = packets;
+			}
+		else if (ti.direction != DIR_REVERSE)
+			printf("[INFO]: %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s (sent)\n",
+				from, to, bytes - last_bytes, (bytes - last_bytes) * 8 / secs / 1e6);
+
+		if (ti.direction != DIR_FORWARD) {
+			rx = __atomic_load_n(&ti.live->rx_bytes, __ATOMIC_RELAXED);
+			printf("[INFO]: %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s (received)\n",
+				from, to, rx - last_rx, (rx - last_rx) * 8 / secs / 1e6);
+			last_rx = rx;
+			}
+
+		last_bytes = bytes;
+		from = to;
+		}
+
+	pthread_mutex_unlock(&ti.smp.lock);
+	return NULL;
+	}
+
+
+
+
+
+
+
+
+/* tcpi_begin: This function starts sampling TCP_INFO of the test connections, if we
+	were asked to (-I). It is a thread of its own like the interval reporter, so the
+	send loops don't know about it */
+
+void tcpi_begin () {
+
+	pthread_condattr_t attr;
+
+	ti.tcpi.n = 0;
+	if (ti.tcpi_interval <= 0 || ti.t_prot != 1 || ti.crr_size >= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ti.tcpi_t0);
+	ti.tcpi_start = time(NULL);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ti.tcpi_smp.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&ti.tcpi_smp.lock, NULL);
+	ti.tcpi_smp.stop = 0;
+
+	if (pthread_create(&ti.tcpi_smp.thread, NULL, run_tcpi, NULL) != 0) {
+		perror("[WARNING]: Could not start the TCP_INFO sampler");
+		return;
+		}
+	ti.tcpi_smp.running = 1;
+	}
+
+
+
+
+/* tcpi_end: This function stops the TCP_INFO sampler, which takes one last sample
+	on its way out. Safe to call when there is none */
+
+void tcpi_end () {
+
+	if (!ti.tcpi_smp.running)
+		return;
+
+	pthread_mutex_lock(&ti.tcpi_smp.lock);
+	ti.tcpi_smp.stop = 1;
+	pthread_cond_signal(&ti.tcpi_smp.cond);
+	pthread_mutex_unlock(&ti.tcpi_smp.lock);
+
+	pthread_join(ti.tcpi_smp.thread, NULL);
+	pthread_cond_destroy(&ti.tcpi_smp.cond);
+	pthread_mutex_destroy(&ti.tcpi_smp.lock);
+	ti.tcpi_smp.running = 0;
+	}
+
+
+
+
+/* run_tcpi: This is the thread body of the TCP_INFO sampler. Every ti.tcpi_interval
+	ms, on absolute deadlines, it samples every test connection. A stream that is
+	done has closed its socket and set it to -1, then there is nothing to sample */
+
+void * run_tcpi (void * arg) {
+
+	struct timespec due, now;
+	long int t;
+	int i, n;
+
+	pthread_mutex_lock(&ti.tcpi_smp.lock);
+
+	for (n = 1; ; n++) {
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		t = (now.tv_sec - ti.tcpi_t0.tv_sec) * 1000000L + (now.tv_nsec - ti.tcpi_t0.tv_nsec) / 1000;
+
+		if (ti.n_streams > 1)
+			for (i = 0; i < ti.n_streams; i++)
+				tcpi_add(&ti.tcpi, __atomic_load_n(&ti.streams[i].sock, __ATOMIC_RELAXED), i, t);
+		else
+			tcpi_add(&ti.tcpi, ti.testsock, 0, t);
+
+		if (ti.tcpi_smp.stop)
+			break;
+
+		due.tv_sec = ti.tcpi_t0.tv_sec + ((long int) n * ti.tcpi_interval) / 1000;
+		due.tv_nsec = ti.tcpi_t0.tv_nsec + (((long int) n * ti.tcpi_interval) % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+			}
+
+		while (!ti.tcpi_smp.stop && pthread_cond_timedwait(&ti.tcpi_smp.cond, &ti.tcpi_smp.lock, &due) != ETIMEDOUT);
+		}
+
+	pthread_mutex_unlock(&ti.tcpi_smp.lock);
+	return NULL;
+	}
+
+
+
+
+/* tcpi_add: This function takes a TCP_INFO sample of sock, connection stream of the
+	test, t us into it. An older kernel fills less of struct tcp_info, the rest of
+	the fields stay 0. Beyond MAX_TCPI samples we stop */
+
+void tcpi_add (struct tcpi_series * ts, int sock, int stream, long int t) {
+
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	struct tcpi_sample * s;
+
+	memset(&info, 0, sizeof(info));
+	if (sock < 0 || ts->n >= MAX_TCPI || getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return;
+
+	if (ts->n == ts->size) {
+		s = realloc(ts->s, (ts->size > 0 ? 2 * ts->size : 256) * sizeof(struct tcpi_sample));
+		if (s == NULL)
+			return;
+		ts->s = s;
+		ts->size = ts->size > 0 ? 2 * ts->size : 256;
+		}
+
+	s = &ts->s[ts->n++];
+	s->t = t;
+	s->stream = stream;
+	s->cwnd = info.tcpi_snd_cwnd;
+	s->srtt = info.tcpi_rtt;
+	s->rttvar = info.tcpi_rttvar;
+	s->retrans = info.tcpi_total_retrans;
+	s->pacing_rate = info.tcpi_pacing_rate;
+	s->delivery_rate = info.tcpi_delivery_rate;
+	s->busy = info.tcpi_busy_time;
+	s->rwnd_limited = info.tcpi_rwnd_limited;
+	s->sndbuf_limited = info.tcpi_sndbuf_limited;
+	}
+
+
+
+
+/* tcpi_take: This function adds the server's samples in m to ti.peer_tcpi */
+
+void tcpi_take (struct ctrl_msg * m) {
+
+	struct tcpi_series * ts = &ti.peer_tcpi;
+	const uint64_t * v;
+	uint64_t * s;
+	int len, i, k, n;
+
+	if ((v = (const uint64_t *) ctrl_find(m, P_SAMPLES, &len)) == NULL)
+		return;
+
+	n = len / sizeof(struct tcpi_sample);
+	if (ts->n + n > ts->size) {
+		s = realloc(ts->s, (ts->n + n + 256) * sizeof(struct tcpi_sample));
+		if (s == NULL)
+			return;
+		ts->s = (struct tcpi_sample *) s;
+		ts->size = ts->n + n + 256;
+		}
+
+	for (i = 0; i < n; i++) {
+		s = (uint64_t *) &ts->s[ts->n++];
+		for (k = 0; k < (int) TCPI_FIELDS; k++)
+			s[k] = be64toh(v[i * TCPI_FIELDS + k]);
+		}
+	}
+
+
+
+
+/* show_tcpi: This function puts the TCP_INFO samples of the last test, ours and the
+	server's, where -I says: into a CSV file with a line per sample, or on the screen.
+	In the file the wall clock of the test start and the family tell the tests apart */
+
+void show_tcpi () {
+
+	FILE * f;
+
+	if (ti.tcpi.n == 0 && ti.peer_tcpi.n == 0)
+		return;
+
+	if (ti.tcpi_name == NULL) {
+		printf("\n[INFO]: TCP_INFO every %d ms, %d samples here and %d on the server\n\n", ti.tcpi_interval, ti.tcpi.n, ti.peer_tcpi.n);
+		printf("\tSide    Stream   Time (s)     cwnd  srtt (us)  rttvar (us)  Retrans  Pacing (Mbit/s)  Delivery (Mbit/s)  Busy (ms)  Rwnd limited (ms)  Sndbuf limited (ms)\n");
+		show_tcpi_series(stdout, "client", &ti.tcpi);
+		show_tcpi_series(stdout, "server", &ti.peer_tcpi);
+		return;
+		}
+
+	f = strcmp(ti.tcpi_name, "-") == 0 ? stdout : fopen(ti.tcpi_name, "a");
+	if (f == NULL) {
+		perror("[WARNING]: Could not open the TCP_INFO file");
+		return;
+		}
+
+	/* Whole lines, so that the two processes of -C don't mix theirs */
+	setvbuf(f, NULL, _IOLBF, 0);
+	if (ftell(f) == 0)
+		fprintf(f, "start,family,side,stream,time_s,cwnd,srtt_us,rttvar_us,retrans,pacing_mbps,delivery_mbps,"
+			"busy_ms,rwnd_limited_ms,sndbuf_limited_ms\n");
+	show_tcpi_series(f, "client", &ti.tcpi);
+	show_tcpi_series(f, "server", &ti.peer_tcpi);
+
+	if (f != stdout) {
+		fclose(f);
+		printf("\n[INFO]: %d TCP_INFO samples (%d of the server) added to %s\n", ti.tcpi.n + ti.peer_tcpi.n, ti.peer_tcpi.n, ti.tcpi_name);
+		}
+	}
+
+
+
+
+/* show_tcpi_series: This function prints the samples of one side, as CSV lines unless
+	f is the screen */
+
+void show_tcpi_series (FILE * f, const char * side, struct tcpi_series * ts) {
+
+	struct tcpi_sample * s;
+	int i;
+
+	for (i = 0; i < ts->n; i++) {
+		s = &ts->s[i];
+		if (f == stdout && ti.tcpi_name == NULL)
+			fprintf(f, "\t%-6s %7lu %10.3f %8lu %10lu %12lu %8lu %16.2f %18.2f %10.1f %18.1f %20.1f\n",
+				side, (unsigned long) s->stream, s->t / 1e6, (unsigned long) s->cwnd, (unsigned long) s->srtt,
+				(unsigned long) s->rttvar, (unsigned long) s->retrans, s->pacing_rate * 8 / 1e6,
+				s->delivery_rate * 8 / 1e6, s->busy / 1e3, s->rwnd_limited / 1e3, s->sndbuf_limited / 1e3);
+		else
+			fprintf(f, "%ld,%d,%s,%lu,%.6f,%lu,%lu,%lu,%lu,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+				(long int) ti.tcpi_start, ti.n_prot, side, (unsigned long) s->stream, s->t / 1e6,
+				(unsigned long) s->cwnd, (unsigned long) s->srtt, (unsigned long) s->rttvar, (unsigned long) s->retrans,
+				s->pacing_rate * 8 / 1e6, s->delivery_rate * 8 / 1e6, s->busy / 1e3, s->rwnd_limited / 1e3,
+				s->sndbuf_limited / 1e3);
+		}
+	}
+
+
+
+
+
+
+
+
+/* calc_cpu_cost: This function shows how much CPU time went into sending the
+	data and what that is per byte. That is what tells the transmit paths apart,
+	the throughput alone often doesn't. Then the same for the server, from what it
+	sent along with the result (m).
+
+	bytes is what we moved, both ways, and dgrams the UDP datagrams of that. Per
+	packet means per datagram for UDP and per MSS sized segment for TCP, a fair
+	guess at what the stack handles even though offloads merge them. A request/
+	response test counts per transaction, the connection rate test per connection */
+
+void calc_cpu_cost (struct rusage * s, struct rusage * e, long int bytes, long int dgrams, struct ctrl_msg * m) {
+
+	struct cpu_cost * p = &ti.peer_cpu;
+	int mss;
+
+	ti.cpu.user = (e->ru_utime.tv_sec - s->ru_utime.tv_sec) * 1000000L + (e->ru_utime.tv_usec - s->ru_utime.tv_usec);
+	ti.cpu.sys = (e->ru_stime.tv_sec - s->ru_stime.tv_sec) * 1000000L + (e->ru_stime.tv_usec - s->ru_stime.tv_usec);
+	ti.cpu.vcsw = e->ru_nvcsw - s->ru_nvcsw;
+	ti.cpu.ivcsw = e->ru_nivcsw - s->ru_nivcsw;
+	ti.cpu.bytes = bytes;
+	ti.cpu.packets = dgrams;
+
+	if (ti.crr_size >= 0 || ti.req_size > 0)
+		ti.cpu.packets = ti.rr_done;
+	else if (ti.t_prot == 1 && (mss = tcp_mss(ti.ctrlsock)) > 0)
+		ti.cpu.packets = bytes / mss;
+
+	/* An older server doesn't send any of this */
+	p->user = ctrl_get(m, P_CPU_USER, -1);
+	p->sys = ctrl_get(m, P_CPU_SYS, 0);
+	p->vcsw = ctrl_get(m, P_VCSW, 0);
+	p->ivcsw = ctrl_get(m, P_IVCSW, 0);
+	p->hw[HW_CYCLES] = ctrl_get(m, P_CYCLES, -1);
+	p->hw[HW_INSTRUCTIONS] = ctrl_get(m, P_INSTRUCTIONS, -1);
+	p->hw[HW_CACHE_MISSES] = ctrl_get(m, P_CACHE_MISSES, -1);
+	p->user_only = ctrl_get(m, P_HW_USER_ONLY, 0);
+	p->hw_error = ctrl_get(m, P_HW_ERROR, 0);
+	p->bytes = ctrl_get(m, P_CPU_BYTES, 0);
+	p->packets = ctrl_get(m, P_CPU_PACKETS, 0);
+
+	if (bytes <= 0)
+		return;
+
+	printf("\n");
+	show_cpu_cost("client", &ti.cpu);
+	if (p->user >= 0 && p->bytes > 0)
+		show_cpu_cost("server", p);
+	}
+
+
+
+
+/* show_cpu_cost: This function prints what a test cost one side (who). Cycles per
+	byte and per packet are the numbers to compare, across families, transports
+	and machines; CPU time per byte depends on the clock as well */
+
+void show_cpu_cost (const char * who, struct cpu_cost * c) {
+
+	long int cyc = c->hw[HW_CYCLES];
+	long int ins = c->hw[HW_INSTRUCTIONS];
+	long int miss = c->hw[HW_CACHE_MISSES];
+
+	printf("[INFO]: CPU time (%s): user %.3f s, sys %.3f s, %.3f ns per byte\n",
+		who, c->user / 1e6, c->sys / 1e6, c->bytes > 0 ? (c->user + c->sys) * 1000.0 / c->bytes : 0);
+	printf("[INFO]: Context switches (%s): %ld voluntary, %ld involuntary\n", who, c->vcsw, c->ivcsw);
+
+	if (cyc < 0) {
+		printf("[INFO]: Hardware counters (%s): not available (%s)\n", who,
+			c->hw_error != 0 ? strerror(c->hw_error) : "not counted");
+		return;
+		}
+
+	printf("[INFO]: Cycles (%s): %.2f per byte, %.0f per %s, %ld in all%s\n", who,
+		c->bytes > 0 ? (double) cyc / c->bytes : 0, c->packets > 0 ? (double) cyc / c->packets : 0,
+		cost_unit(), cyc, c->user_only ? " (user space only)" : "");
+
+	if (ins >= 0 && cyc > 0)
+		printf("[INFO]: Instructions (%s): %ld, %.2f per cycle\n", who, ins, (double) ins / cyc);
+	if (miss >= 0)
+		printf("[INFO]: Cache misses (%s): %ld, %.3f per KB\n", who, miss, c->bytes > 0 ? miss * 1024.0 / c->bytes : 0);
+	}
+
+
+
+
+/* cost_unit: This function returns what the per packet cost is per */
+
+const char * cost_unit () {
+
+	if (ti.crr_size >= 0)
+		return "connection";
+	if (ti.req_size > 0)
+		return "transaction";
+	return ti.t_prot == 1 ? "segment" : "datagram";
+	}
+
+
+
+
+/* cyc_per: This function returns the cycles of c per n (bytes or packets), -1 if
+	there are no cycles to go by */
+
+double cyc_per (struct cpu_cost * c, long int n) {
+
+	if (c->hw[HW_CYCLES] < 0 || n <= 0)
+		return -1;
+	return (double) c->hw[HW_CYCLES] / n;
+	}
+
+
+
+
+/* tcp_mss: This function returns the MSS of a TCP connection, 0 if we can't tell.
+	The control connection goes the same path as the test, so its MSS will do */
+
+int tcp_mss (int sock) {
+
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return 0;
+	return info.tcpi_rcv_mss > info.tcpi_snd_mss ? info.tcpi_rcv_mss : info.tcpi_snd_mss;
+	}
+
+
+
+
+/* hw_open: This function starts the hardware counters for this thread and all the
+	threads it starts from now on (inherit). The counters are opened one by one
+	rather than as a group, inherited groups can't be read at once. If there are
+	more than the PMU has room for, the kernel takes turns and hw_read() scales.
+
+	With perf_event_paranoid at 2 we may not count the kernel, which is where most
+	of the network stack runs. We settle for user space then and say so. A virtual
+	machine often has no PMU at all; the counters stay at -1 and the rest of the
+	test goes on as always */
+
+void hw_open (struct cpu_cost * c, int * fd) {
+
+	static const uint64_t config[N_HW] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+	struct perf_event_attr pa;
+	int i;
+
+	c->user_only = 0;
+	c->hw_error = 0;
+
+	for (i = 0; i < N_HW; i++) {
+
+		memset(&pa, 0, sizeof(pa));
+		pa.type = PERF_TYPE_HARDWARE;
+		pa.size = sizeof(pa);
+		pa.config = config[i];
+		pa.inherit = 1;
+		pa.exclude_hv = 1;
+		pa.exclude_kernel = c->user_only;
+		pa.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		fd[i] = syscall(__NR_perf_event_open, &pa, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+
+		if (fd[i] < 0 && i == 0 && !c->user_only && (errno == EACCES || errno == EPERM)) {
+			c->user_only = 1;
+			i--;
+			continue;
+			}
+
+		if (fd[i] < 0 && i == 0)
+			c->hw_error = errno;
+		}
+	}
+
+
+
+
+/* hw_read: This function stops the counters of hw_open() and puts what they counted
+	in c. A counter that only ran part of the time is scaled up to all of it */
+
+void hw_read (struct cpu_cost * c, int * fd) {
+
+	uint64_t v[3];		/* value, time enabled, time running */
+	int i;
+
+	for (i = 0; i < N_HW; i++) {
+
+		c->hw[i] = -1;
+		if (fd[i] < 0)
+			continue;
+
+		if (read(fd[i], v, sizeof(v)) == sizeof(v) && v[2] > 0)
+			c->hw[i] = v[2] < v[1] ? (long int) ((double) v[0] * v[1] / v[2]) : (long int) v[0];
+		close(fd[i]);
+		}
+	}
+
+
+
+
+
+
+
+
+/* place_test: This function puts the test where -A and -M say. The memory of the
+	calling thread (and the threads it starts) comes from the NUMA node, and the
+	thread itself goes on the first CPU; the other threads of the test pin themselves
+	as they start. With -A auto the choice is made again for every test, the NIC
+	may be a different one. What we chose is printed and goes in the result file */
+
+void place_test () {
+
+	struct placement * p = &ti.place;
+	char list[192];
+	int len;
+
+	p->node = p->node_opt;
+	if (p->automatic)
+		place_auto(p, ti.ctrlsock);
+
+	if ((p->automatic || p->node_opt >= 0) && bind_node(p->node) < 0) {
+		perror("[WARNING]: Could not bind the memory to the NUMA node");
+		p->node = -1;
+		}
+	else if (p->node >= 0 && pool_move(p->node) < 0)
+		perror("[WARNING]: Could not move the payload pool to the NUMA node");
+	pin_thread(0);
+
+	show_cpus(list, sizeof(list), p->cpus, p->n_cpus);
+	len = snprintf(p->desc, sizeof(p->desc), p->n_cpus > 0 ? "threads on CPUs %s" : "threads anywhere", list);
+	len += snprintf(p->desc + len, sizeof(p->desc) - len, p->node >= 0 ? ", memory on node %d" : ", memory anywhere", p->node);
+	if (p->automatic)
+		snprintf(p->desc + len, sizeof(p->desc) - len, " (%s)", p->why);
+
+	if (p->automatic || p->n_cpus > 0 || p->node_opt >= 0)
+		printf("[INFO]: Placement: %s\n", p->desc);
+	}
+
+
+
+
+/* pin_thread: This function pins the calling thread, thread k of the test, to its
+	CPU. With -A auto and nothing to go by it may run anywhere again */
+
+void pin_thread (int k) {
+
+	struct placement * p = &ti.place;
+	cpu_set_t set = p->allowed;
+	int e;
+
+	if (!p->automatic && p->n_cpus == 0)
+		return;
+
+	if (p->n_cpus > 0) {
+		CPU_ZERO(&set);
+		CPU_SET(p->cpus[(p->base + k) % p->n_cpus], &set);
+		}
+
+	if ((e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+		fprintf(stderr,"[WARNING]: Could not pin test thread %d: %s\n", k, strerror(e));
+	}
+
+
+
+
+/* parse_cpus: This function reads a CPU list like sysfs writes them ("0-3,8,10-11")
+	into cpus, at most max of them. It returns how many there are, -1 if the list
+	is not one */
+
+int parse_cpus (const char * s, int * cpus, int max) {
+
+	int n = 0, a, b;
+	char * end;
+
+	while (*s != '\0' && *s != '\n') {
+
+		a = b = strtol(s, &end, 10);
+		if (end == s || a < 0)
+			return -1;
+		s = end;
+
+		if (*s == '-') {
+			b = strtol(s + 1, &end, 10);
+			if (end == s + 1 || b < a)
+				return -1;
+			s = end;
+			}
+
+		for (; a <= b && n < max; a++)
+			cpus[n++] = a;
+
+		if (*s == ',')
+			s++;
+		else if (*s != '\0' && *s != '\n')
+			return -1;
+		}
+
+	return n;
+	}
+
+
+
+
+/* show_cpus: This function writes cpus (n of them) into buf as a CPU list, with
+	runs of CPUs as ranges */
+
+void show_cpus (char * buf, int size, int * cpus, int n) {
+
+	int i, j, len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < n && len < size; i = j + 1) {
+		for (j = i; j + 1 < n && cpus[j + 1] == cpus[j] + 1; j++)
+			;
+		if (j > i)
+			len += snprintf(buf + len, size - len, "%s%d-%d", i > 0 ? "," : "", cpus[i], cpus[j]);
+		else
+			len += snprintf(buf + len, size - len, "%s%d", i > 0 ? "," : "", cpus[i]);
+		}
+	}
+
+
+
+
+/* read_line: This function reads the first line of a (sysfs or proc) file into buf.
+	Returns -1 if there is no such file */
+
+int read_line (const char * path, char * buf, int size) {
+
+	FILE * f = fopen(path, "r");
+
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, size, f) == NULL)
+		buf[0] = '\0';
+	fclose(f);
+	return 0;
+	}
+
+
+
+
+/* place_auto: This function works out where the test should run from the NIC the
+	connection sock goes through: the interface with its local address, the NUMA node
+	of the device and the CPUs its interrupts are sent to (its MSI vectors). The
+	threads go on the CPUs of that node, but not on the ones taking the interrupts,
+	so that the softirq processing and the test don't fight over a core. If that
+	leaves nothing, the interrupt CPUs will do. Loopback and virtual interfaces have
+	no device, then we leave it to the scheduler and say why */
+
+void place_auto (struct placement * p, int sock) {
+
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	struct ifaddrs * ifs, * i;
+	char ifname[64] = "", path[320], buf[4096], list[128];
+	int cpus[MAX_PIN], n, k, irqs = 0;
+	cpu_set_t irq;
+	DIR * d;
+	struct dirent * de;
+
+	p->n_cpus = 0;
+	CPU_ZERO(&irq);
+
+	if (getsockname(sock, (struct sockaddr *) &local, &len) < 0 || getifaddrs(&ifs) < 0) {
+		snprintf(p->why, sizeof(p->why), "auto: no local address");
+		return;
+		}
+
+	for (i = ifs; i != NULL && ifname[0] == '\0'; i = i->ifa_next) {
+		if (i->ifa_addr == NULL || i->ifa_addr->sa_family != local.ss_family)
+			continue;
+		if (local.ss_family == AF_INET && ((struct sockaddr_in *) i->ifa_addr)->sin_addr.s_addr ==
+				((struct sockaddr_in *) &local)->sin_addr.s_addr)
+			snprintf(ifname, sizeof(ifname), "%s", i->ifa_name);
+		if (local.ss_family == AF_INET6 && memcmp(&((struct sockaddr_in6 *) i->ifa_addr)->sin6_addr,
+				&((struct sockaddr_in6 *) &local)->sin6_addr, sizeof(struct in6_addr)) == 0)
+			snprintf(ifname, sizeof(ifname), "%s", i->ifa_name);
+		}
+	freeifaddrs(ifs);
+
+	if (ifname[0] == '\0') {
+		snprintf(p->why, sizeof(p->why), "auto: no interface with our address");
+		return;
+		}
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+	if (read_line(path, buf, sizeof(buf)) < 0) {
+		snprintf(p->why, sizeof(p->why), "auto: %s has no device, left to the scheduler", ifname);
+		return;
+		}
+	if (p->node_opt < 0)
+		p->node = atoi(buf);
+
+	/* The interrupts of the device and where they go */
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname);
+	if ((d = opendir(path)) != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9')
+				continue;
+			snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", de->d_name);
+			if (read_line(path, buf, sizeof(buf)) < 0 || (n = parse_cpus(buf, cpus, MAX_PIN)) < 0)
+				continue;
+			for (k = 0; k < n; k++)
+				if (cpus[k] < CPU_SETSIZE)
+					CPU_SET(cpus[k], &irq);
+			irqs++;
+			}
+		closedir(d);
+		}
+
+	/* The CPUs of the node, or all of ours if the device doesn't say */
+	n = -1;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", p->node);
+	if (p->node >= 0 && read_line(path, buf, sizeof(buf)) == 0)
+		n = parse_cpus(buf, cpus, MAX_PIN);
+	if (n < 0)
+		for (n = 0, k = 0; k < CPU_SETSIZE && n < MAX_PIN; k++)
+			if (CPU_ISSET(k, &p->allowed))
+				cpus[n++] = k;
+
+	for (k = 0; k < n; k++)
+		if (cpus[k] < CPU_SETSIZE && CPU_ISSET(cpus[k], &p->allowed) && !CPU_ISSET(cpus[k], &irq))
+			p->cpus[p->n_cpus++] = cpus[k];
+	if (p->n_cpus == 0)
+		for (k = 0; k < n; k++)
+			if (cpus[k] < CPU_SETSIZE && CPU_ISSET(cpus[k], &p->allowed))
+				p->cpus[p->n_cpus++] = cpus[k];
+
+	for (n = 0, k = 0; k < CPU_SETSIZE && n < MAX_PIN; k++)
+		if (CPU_ISSET(k, &irq))
+			cpus[n++] = k;
+	show_cpus(list, sizeof(list), cpus, n);
+	snprintf(p->why, sizeof(p->why), "auto: %s on node %d, %d IRQs on CPUs %s", ifname, p->node, irqs, n > 0 ? list : "unknown");
+	}
+
+
+
+
+/* bind_node: This function makes the memory the calling thread (and the threads it
+	starts) allocates from now on come from NUMA node node, or from anywhere again
+	for -1. We use the system call, libnuma would be one dependency more for it */
+
+int bind_node (int node) {
+
+	unsigned long mask[16];
+
+	if (node < 0)
+		return syscall(__NR_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+	if (node >= (int) (8 * sizeof(mask))) {
+		errno = EINVAL;
+		return -1;
+		}
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	return syscall(__NR_set_mempolicy, MPOL_BIND, mask, 8 * sizeof(mask) + 1);
+	}
+
+
+
+
+/* pool_move: This function moves the payload pool to NUMA node node. The pool is
+	filled (and so faulted in) before the first test, long before we know where
+	the test runs, so binding the memory of the thread doesn't take it along.
+	mbind() with MPOL_MF_MOVE migrates the pages that are there already */
+
+int pool_move (int node) {
+
+	unsigned long mask[16];
+
+	if (node == ti.pool_node)
+		return 0;
+	if (node < 0 || node >= (int) (8 * sizeof(mask))) {
+		errno = EINVAL;
+		return -1;
+		}
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	if (syscall(__NR_mbind, ti.pool, POOL_SIZE, MPOL_BIND, mask, 8 * sizeof(mask) + 1, MPOL_MF_MOVE) < 0)
+		return -1;
+
+	ti.pool_node = node;
+	return 0;
+	}
+
+
+
+
+
+
+
+
+/* run_udp_test: This function runs the test assuming UDP socket.
+	It keeps on transmitting the data until we have sent enough data packets.
+	It then returns how much data we sent.
+
+	The test socket is connected, so we don't pass the address (and the kernel
+	doesn't look up the route) for every datagram. The datagrams are handed over
+	ti.batch at a time with sendmmsg().
+
+	Every datagram is a header (sequence number and send time) followed by the
+	payload. The headers are separate buffers, the payloads point to chunk after
+	chunk of the pool (or, with -V, to buffers of their own with the pattern in them).
+	The send time is taken once per sendmmsg(), all those datagrams go out in the
+	same call anyway.
+
+	With GSO, every message of the batch is a super-datagram of up to ti.gso_segs
+	datagrams. UDP_SEGMENT on the socket tells the stack to cut it into datagrams of
+	ti.msg_size bytes, so the server sees exactly what it would without GSO. The
+	iovecs are laid out so that every one of those datagrams starts with its header */
+
+
+long int run_udp_test() {
+
+	char * buff;
+	int stat = 0;
+	int i, j, n, per_msg = 1;
+	int seg = ti.msg_size;
+	long int k, queued;
+	size_t cur = 0;
+	long int sent = 0;		/* This is packet counter */
+	long int sent_data = 0;	/* This is actual data bytes */
+	uint64_t seq = 0;
+	struct mmsghdr * msgs;
+	struct iovec * iov;
+	struct dgram_hdr * hdr;
+	struct timespec now, pace_start;
+
+	if (ti.engine == ENGINE_URING && (sent_data = run_udp_uring()) >= 0)
+		return sent_data;
+	sent_data = 0;
+
+	/* GSO cuts a super-datagram into datagrams, not into fragments, and the kernel
+	refuses segments that don't fit the path MTU. Only the sweep gets here with
+	those, and sends them as they are */
+	if ((ti.offload & OFFLOAD_GSO) && ti.mtu > 0 && frag_count(ti.mtu, ti.domain, seg) > 1)
+		printf("[INFO]: %d byte datagrams don't fit the path MTU %d, sending them without GSO\n", seg, ti.mtu);
+	else if (ti.offload & OFFLOAD_GSO) {
+		per_msg = GSO_MAX_SIZE / seg;
+		if (per_msg > GSO_MAX_SEGS)
+			per_msg = GSO_MAX_SEGS;
+		if (per_msg < 1)
+			per_msg = 1;
+		ti.gso_segs = per_msg;
+
+		if (setsockopt(ti.testsock, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) < 0)
+			raise_error("[ERROR]: Could not enable UDP_SEGMENT on the test socket");
+		}
+
+	/* With a target rate, let the kernel's pacing (fq qdisc) smooth out the bursts
+	of a batch too. Without fq this does nothing, and that is fine */
+	if (ti.rate > 0) {
+		unsigned int bytes_per_sec = ti.rate / 8 > 4000000000.0 ? 4000000000U : (unsigned int) (ti.rate / 8);
+		setsockopt(ti.testsock, SOL_SOCKET, SO_MAX_PACING_RATE, &bytes_per_sec, sizeof(bytes_per_sec));
+		printf("[INFO]: Pacing at %.0f bits/s\n", ti.rate);
+		}
+
+	printf("[INFO]: Starting the perf test with UDP (batch of %d, %d datagrams per message)\n", ti.batch, per_msg);
+
+	/* Two iovecs (header, payload) per datagram, per_msg datagrams per message.
+	The payloads come from the pool, unless they carry the pattern (-V) */
+	buff = calloc(ti.verify ? (size_t) ti.batch * per_msg : 1, seg);
+	msgs = calloc(ti.batch, sizeof(struct mmsghdr));
+	iov = calloc((size_t) ti.batch * per_msg * 2, sizeof(struct iovec));
+	hdr = calloc((size_t) ti.batch * per_msg, sizeof(struct dgram_hdr));
+	if (buff == NULL || msgs == NULL || iov == NULL || hdr == NULL)
+		raise_error("[ERROR]: Could not allocate the message vector");
+
+	for (i = 0; i < ti.batch * per_msg; i++) {
+		iov[2*i].iov_base = &hdr[i];
+		iov[2*i].iov_len = sizeof(struct dgram_hdr);
+		iov[2*i+1].iov_base = ti.verify ? buff + (size_t) i * seg : buff;
+		iov[2*i+1].iov_len = seg - sizeof(struct dgram_hdr);
+		}
+
+	for (i = 0; i < ti.batch; i++)
+		msgs[i].msg_hdr.msg_iov = &iov[2 * per_msg * i];
+
+	clock_gettime(CLOCK_MONOTONIC, &pace_start);
+
+	while (sent < ti.data_info && !time_up()) {
+
+		/* Hold back till what we have sent so far is due */
+		if (ti.rate > 0)
+			pace_wait(&pace_start, sent_data);
+
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* Fill up the batch. Don't overshoot in the last one. The sequence numbers
+		go on from what has actually been sent so far */
+		for (n = 0, queued = 0; n < ti.batch && sent + queued < ti.data_info; n++) {
+			k = ti.data_info - sent - queued;
+			if (k > per_msg)
+				k = per_msg;
+			msgs[n].msg_hdr.msg_iovlen = 2 * k;
+
+			for (j = 0; j < k; j++) {
+				hdr[n * per_msg + j].seq = htobe64(seq + queued + j);
+				hdr[n * per_msg + j].sec = htobe64(now.tv_sec);
+				hdr[n * per_msg + j].nsec = htonl(now.tv_nsec);
+
+				/* Datagram seq is bytes seq * seg on of the stream, header included */
+				if (ti.verify)
+					pat_fill(iov[2 * (n * per_msg + j) + 1].iov_base, seg - sizeof(struct dgram_hdr), pat_seed(ti.seed, 0),
+						(seq + queued + j) * seg + sizeof(struct dgram_hdr));
+				else
+					iov[2 * (n * per_msg + j) + 1].iov_base = pool_next(&cur, seg - sizeof(struct dgram_hdr));
+				}
+			queued += k;
+			}
+
+		stat = sendmmsg(ti.testsock, msgs, n, 0);
+		if (stat <= 0 && errno == EMSGSIZE)
+			raise_error("[ERROR]: The datagrams are bigger than the path MTU and must not be fragmented (-f do)");
+		if (stat <= 0)
+			raise_error("[ERROR]: Write on the socket failed");
+
+		for (i = 0; i < stat; i++) {
+			if (msgs[i].msg_len < (unsigned int) msgs[i].msg_hdr.msg_iovlen / 2 * seg)
+				raise_error("[ERROR]: Write on the socket failed");
+			sent_data += msgs[i].msg_len;
+			sent += msgs[i].msg_len / seg;
+			}
+
+		seq = sent;
+		ti.gso_sends += stat;
+
+		__atomic_store_n(&ti.live->bytes, sent_data, __ATOMIC_RELAXED);
+		__atomic_store_n(&ti.live->packets, sent, __ATOMIC_RELAXED);
+		}
+
+	if (ti.rate > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ti.pace_time = (now.tv_sec - pace_start.tv_sec) + (now.tv_nsec - pace_start.tv_nsec) / 1e9;
+		}
+	
+	free(hdr);
+	free(iov);
+	free(msgs);
+	free(buff);
+	ti.sent_packets = sent;
+	return sent_data;
+	}
+
+
+
+
+
+
+
+
+/* run_udp_uring: This function is run_udp_test() with io_uring. Every datagram has
+	a header of its own, so every write in flight needs its own buffer: URING_DEPTH
+	slots of ti.msg_size bytes, in one registered region, their payloads copied from
+	the pool once.
+
+	The writes of a burst are linked (IOSQE_IO_LINK): the kernel only starts one once
+	the one before it is done, so they go out in the order of their sequence numbers
+	even when a full socket buffer makes it retry them. The next burst is only queued
+	once the whole of this one has completed, in the same io_uring_enter(). Otherwise
+	the server would see (and report) reordering that we made ourselves.
+
+	Paced, we wait till what we have sent is due and queue one datagram at a time;
+	whole queues would go out as bursts the receiver can't keep up with. It returns
+	how many bytes we sent, or -1 if io_uring could not be set up */
+
+long int run_udp_uring () {
+
+	struct uring r;
+	struct io_uring_sqe * sqe, * last = NULL;
+	struct io_uring_cqe * cqe;
+	struct iovec iov;
+	struct dgram_hdr * hdr;
+	struct timespec now, pace_start;
+	char * region;
+	int slot;
+	int burst = ti.rate > 0 ? 1 : URING_DEPTH;
+	int queued;
+	size_t cur = 0;
+	long int sent = 0, sent_data = 0, limit = ti.data_info;
+	uint64_t seq = 0;
+
+	if (uring_init(&r, URING_DEPTH) < 0) {
+		perror("[WARNING]: Could not set up io_uring, sending with sendmmsg() instead");
+		return -1;
+		}
+
+	if (posix_memalign((void **) &region, 4096, (size_t) URING_DEPTH * ti.msg_size) != 0)
+		raise_error("[ERROR]: Could not allocate the send buffers");
+	memset(region, 0, (size_t) URING_DEPTH * ti.msg_size);
+	for (slot = 0; slot < URING_DEPTH; slot++)
+		memcpy(region + (size_t) slot * ti.msg_size + sizeof(struct dgram_hdr),
+			pool_next(&cur, ti.msg_size - sizeof(struct dgram_hdr)), ti.msg_size - sizeof(struct dgram_hdr));
+
+	iov.iov_base = region;
+	iov.iov_len = (size_t) URING_DEPTH * ti.msg_size;
+	if (uring_register(&r, IORING_REGISTER_BUFFERS, &iov, 1) < 0 ||
+		uring_register(&r, IORING_REGISTER_FILES, &ti.testsock, 1) < 0) {
+		perror("[WARNING]: Could not register with io_uring, sending with sendmmsg() instead");
+		uring_free(&r);
+		free(region);
+		return -1;
+		}
+
+	if (ti.rate > 0) {
+		unsigned int bytes_per_sec = ti.rate / 8 > 4000000000.0 ? 4000000000U : (unsigned int) (ti.rate / 8);
+		setsockopt(ti.testsock, SOL_SOCKET, SO_MAX_PACING_RATE, &bytes_per_sec, sizeof(bytes_per_sec));
+		printf("[INFO]: Pacing at %.0f bits/s\n", ti.rate);
+		}
+
+	printf("[INFO]: Starting the perf test with UDP over io_uring (%d datagrams in flight)\n", URING_DEPTH);
+
+	clock_gettime(CLOCK_MONOTONIC, &pace_start);
+
+	while (sent < limit) {
+
+		/* Out of time. Let the datagrams in flight go, but queue no more */
+		if (time_up() && (limit = seq) <= sent)
+			break;
+
+		if (ti.rate > 0)
+			pace_wait(&pace_start, sent_data);
+
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* A burst, slot after slot, every write linked to the next but the last */
+		for (queued = 0; queued < burst && seq < (uint64_t) limit && (sqe = uring_sqe(&r)) != NULL; queued++) {
+			slot = queued;
+			hdr = (struct dgram_hdr *) (region + (size_t) slot * ti.msg_size);
+			hdr->seq = htobe64(seq++);
+			hdr->sec = htobe64(now.tv_sec);
+			hdr->nsec = htonl(now.tv_nsec);
+
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+			sqe->fd = 0;
+			sqe->addr = (uintptr_t) hdr;
+			sqe->len = ti.msg_size;
+			sqe->buf_index = 0;
+			sqe->user_data = slot;
+			last = sqe;
+			}
+		if (queued > 0)
+			last->flags &= ~IOSQE_IO_LINK;
+
+		/* ... and all of it done before the next */
+		if (uring_enter(&r, queued) < 0)
+			raise_error("[ERROR]: io_uring_enter failed");
+
+		while ((cqe = uring_cqe(&r)) != NULL) {
+			if (cqe->res == -EMSGSIZE) {
+				errno = EMSGSIZE;
+				raise_error("[ERROR]: The datagrams are bigger than the path MTU and must not be fragmented (-f do)");
+				}
+			if (cqe->res < ti.msg_size) {
+				errno = cqe->res < 0 ? -cqe->res : EIO;
+				raise_error("[ERROR]: Write on the socket failed");
+				}
+			sent_data += cqe->res;
+			sent++;
+			ti.uring_ops++;
+			uring_seen(&r);
+			}
+
+		__atomic_store_n(&ti.live->bytes, sent_data, __ATOMIC_RELAXED);
+		__atomic_store_n(&ti.live->packets, sent, __ATOMIC_RELAXED);
+		}
+
+	if (ti.rate > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ti.pace_time = (now.tv_sec - pace_start.tv_sec) + (now.tv_nsec - pace_start.tv_nsec) / 1e9;
+		}
+
+	ti.uring_enters = r.enters;
+	uring_free(&r);
+	free(region);
+	ti.sent_packets = sent;
+	return sent_data;
+	}
+
+
+
+
+
+
+
+
+
+
+/* run_tcp_rr: This function runs the request/response test over the TCP connection.
+	A request of ti.req_size bytes goes out and we wait for the whole response of
+	ti.resp_size bytes before sending the next one, so there is only ever one
+	transaction in flight and every round trip is timed on its own. Nagle would hold
+	a small request back till the last one is acked, so it is off.
+	It returns how many bytes of requests we sent */
+
+long int run_tcp_rr () {
+
+	char * buff;
+	int one = 1;
+	long int i, n, stat, sent = 0;
+	struct timespec t0, t1;
+
+	printf("[INFO]: Starting the request/response test with TCP\n");
+
+	if (setsockopt(ti.testsock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+		raise_error("[ERROR]: Could not set TCP_NODELAY on the test socket");
+
+	buff = calloc(1, ti.req_size > ti.resp_size ? ti.req_size : ti.resp_size);
+	if (buff == NULL)
+		raise_error("[ERROR]: Could not allocate the buffer");
+
+	for (i = 0; i < ti.data_info; i++) {
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+
+		for (n = 0; n < ti.req_size; n += stat) {
+			stat = write(ti.testsock, buff + n, ti.req_size - n);
+			if (stat <= 0)
+				raise_error("[ERROR]: Write on the socket failed");
+			}
+
+		if (recv(ti.testsock, buff, ti.resp_size, MSG_WAITALL) != ti.resp_size)
+			raise_error("[ERROR]: The server did not answer the request");
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		hist_record(ti.hist, (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+
+		sent += ti.req_size;
+		__atomic_store_n(&ti.live->bytes, sent, __ATOMIC_RELAXED);
+		__atomic_store_n(&ti.live->packets, i + 1, __ATOMIC_RELAXED);
+		}
+
+	ti.rr_done = i;
+	ti.sent_packets = i;
+	free(buff);
+	return sent;
+	}
+
+
+
+
+
+
+
+
+/* run_udp_rr: This function is run_tcp_rr() over the UDP test socket, one datagram
+	each way. A datagram can get lost, so we only wait RR_TIMEOUT_MS for the answer
+	and then count the transaction as lost and go on with the next one.
+
+	If the request and the response are big enough, the request starts with its
+	number and the server sends that back at the start of the response. That way an
+	answer that comes in after we gave up on it is not taken for the answer to the
+	request after it. Too small and we have to trust the order */
+
+long int run_udp_rr () {
+
+	char * req, * resp;
+	int match = ti.req_size >= (int) sizeof(uint64_t) && ti.resp_size >= (int) sizeof(uint64_t);
+	long int i, n, sent = 0;
+	uint64_t seq;
+	struct timeval tv;
+	struct timespec t0, t1;
+
+	printf("[INFO]: Starting the request/response test with UDP\n");
+
+	tv.tv_sec = RR_TIMEOUT_MS / 1000;
+	tv.tv_usec = (RR_TIMEOUT_MS % 1000) * 1000;
+	if (setsockopt(ti.testsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		raise_error("[ERROR]: Could not set timeout on the test socket");
+
+	req = calloc(1, ti.req_size);
+	resp = calloc(1, ti.resp_size);
+	if (req == NULL || resp == NULL)
+		raise_error("[ERROR]: Could not allocate the buffers");
+
+	for (i = 0; i < ti.data_info; i++) {
+
+		if (match) {
+			seq = htobe64(i);
+			memcpy(req, &seq, sizeof(seq));
+			}
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+
+		if (send(ti.testsock, req, ti.req_size, 0) != ti.req_size)
+			raise_error("[ERROR]: Write on the socket failed");
+		sent += ti.req_size;
+
+		for (;;) {
+			n = recv(ti.testsock, resp, ti.resp_size, 0);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				ti.rr_lost++;
+				break;
+				}
+			if (n < 0)
+				raise_error("[ERROR]: Read on the socket failed");
+
+			/* The answer to a request we have already given up on */
+			if (match && (n < (long int) sizeof(seq) || memcmp(resp, req, sizeof(seq)) != 0))
+				continue;
+
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			hist_record(ti.hist, (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+			ti.rr_done++;
+			break;
+			}
+
+		__atomic_store_n(&ti.live->bytes, sent, __ATOMIC_RELAXED);
+		__atomic_store_n(&ti.live->packets, i + 1, __ATOMIC_RELAXED);
+		}
+
+	ti.sent_packets = i;
+	free(req);
+	free(resp);
+	return sent;
+	}
+
+
+
+
+
+
+
+
+/* hist_record: This function puts one round trip time (ns) into the histogram. Below
+	HIST_SUB the value is its own bucket. Above, the highest bit picks the power of
+	two and the HIST_SUB_BITS bits under it the bucket within it */
+
+void hist_record (struct histogram * h, long int v) {
+
+	int k, idx;
+
+	if (v < 0)
+		v = 0;
+
+	if (v < HIST_SUB)
+		idx = v;
+	else {
+		k = 63 - __builtin_clzl(v);
+		idx = (k - HIST_SUB_BITS + 1) * HIST_SUB + (int) ((v >> (k - HIST_SUB_BITS)) - HIST_SUB);
+		}
+
+	h->count[idx]++;
+	if (h->n == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->sum += v;
+	h->n++;
+	}
+
+
+
+
+
+
+
+
+/* hist_percentile: This function returns the value at or below which p percent of
+	the recorded values are. That is the highest value of the bucket it falls in,
+	so we never report a latency lower than the one measured (by up to 1/HIST_SUB) */
+
+long int hist_percentile (struct histogram * h, double p) {
+
+	long int want = (long int) ceil(p / 100 * h->n);
+	long int seen = 0, top;
+	int idx, b;
+
+	if (want < 1)
+		want = 1;
+
+	for (idx = 0; idx < HIST_BUCKETS; idx++) {
+		seen += h->count[idx];
+		if (seen < want)
+			continue;
+
+		if (idx < HIST_SUB)
+			return idx;
+		b = idx / HIST_SUB;
+		top = ((long int) (HIST_SUB + idx % HIST_SUB + 1) << (b - 1)) - 1;
+		return top < h->max ? top : h->max;
+		}
+
+	return h->max;
+	}
+
+
+
+
+
+
+
+
+/* show_latency: This function shows the transaction rate of the request/response
+	test, by our clock, and the round trip times. send_time is in ns */
+
+void show_latency (long int send_time) {
+
+	struct histogram * h = ti.hist;
+
+	printf("\n[INFO]: Request/response over ipv%d with %s, %d byte requests, %d byte responses\n",
+		ti.n_prot, ti.t_prot == 1 ? "TCP" : "UDP", ti.req_size, ti.resp_size);
+
+	if (h->n == 0) {
+		fprintf(stderr,"[WARNING]: Not a single request was answered\n");
+		return;
+		}
+
+	printf("\n\
+	+-----------------+-------------------+\n\
+	| Transactions    |      %10ld   |\n\
+	| Lost            |      %10ld   |\n\
+	| Per second      |  %14.2f   |\n",
+		ti.rr_done, ti.rr_lost, send_time > 0 ? ti.rr_done * 1000000000.0 / send_time : 0.0);
+	show_hist(h);
+	}
+
+
+
+
+
+
+
+
+/* show_hist: This function finishes the table above it with the percentiles of the
+	histogram, in microseconds */
+
+void show_hist (struct histogram * h) {
+
+	printf("\
+	+-----------------+-------------------+\n\
+	| Min (us)        |  %14.3f   |\n\
+	| Mean (us)       |  %14.3f   |\n\
+	| p50 (us)        |  %14.3f   |\n\
+	| p99 (us)        |  %14.3f   |\n\
+	| p99.9 (us)      |  %14.3f   |\n\
+	| p99.99 (us)     |  %14.3f   |\n\
+	| Max (us)        |  %14.3f   |\n\
+	+-----------------+-------------------+\n",
+		h->min / 1e3, h->sum / h->n / 1e3, hist_percentile(h, 50) / 1e3, hist_percentile(h, 99) / 1e3,
+		hist_percentile(h, 99.9) / 1e3, hist_percentile(h, 99.99) / 1e3, h->max / 1e3);
+	}
+
+
+
+
+
+
+
+
+/* hist_merge: This function adds the values of histogram src to dst. The buckets are
+	the same for every histogram, so that is just adding up the counts */
+
+void hist_merge (struct histogram * dst, struct histogram * src) {
+
+	int idx;
+
+	if (src->n == 0)
+		return;
+
+	for (idx = 0; idx < HIST_BUCKETS; idx++)
+		dst->count[idx] += src->count[idx];
+	if (dst->n == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->sum += src->sum;
+	dst->n += src->n;
+	}
+
+
+
+
+
+
+
+
+/* show_hist_compare: This function shows the latencies of both families side by
+	side, over all the trials of each, in microseconds, and how much longer (or
+	shorter) ipv6 took at every percentile. The tail is where the two usually differ,
+	and a mean of per trial percentiles would hide it */
+
+void show_hist_compare (struct histogram * h4, struct histogram * h6) {
+
+	static const char * name[] = { "Min", "Mean", "p50", "p99", "p99.9", "p99.99", "Max" };
+	static const double pct[] = { 0, 0, 50, 99, 99.9, 99.99, 0 };
+	struct histogram * h[2] = { h4, h6 };
+	double v[2];
+	int f, i;
+
+	printf("\n[INFO]: %s per family, %ld (ipv4) and %ld (ipv6) over all the trials\n",
+		ti.crr_size >= 0 ? "Setup latency" : "Round trips", h4->n, h6->n);
+	printf("\n\
+	+-------------+-----------------+-----------------+-----------------+\n\
+	|             |       ipv4 (us) |       ipv6 (us) |  ipv6 vs ipv4   |\n\
+	+-------------+-----------------+-----------------+-----------------+\n");
+
+	for (i = 0; i < 7; i++) {
+		for (f = 0; f < 2; f++) {
+			if (h[f]->n == 0)
+				v[f] = 0;
+			else if (i == 0)
+				v[f] = h[f]->min / 1e3;
+			else if (i == 1)
+				v[f] = h[f]->sum / h[f]->n / 1e3;
+			else if (i == 6)
+				v[f] = h[f]->max / 1e3;
+			else
+				v[f] = hist_percentile(h[f], pct[i]) / 1e3;
+			}
+
+		if (v[0] > 0 && h[1]->n > 0)
+			printf("\
+	| %-11s | %15.3f | %15.3f | %+13.2f %% |\n", name[i], v[0], v[1], 100.0 * (v[1] - v[0]) / v[0]);
+		else
+			printf("\
+	| %-11s | %15.3f | %15.3f |             n/a |\n", name[i], v[0], v[1]);
+		}
+	printf("\
+	+-------------+-----------------+-----------------+-----------------+\n");
+	}
+
+
+
+
+
+
+
+
+/* run_crr: This function runs the connection rate test. Every round is a connection
+	of its own to the port the server told us about: socket(), connect(), send the
+	message and read it back (if there is one), read till the server closes and close.
+	The server closes first, so the TIME_WAIT is on its side and we don't run out of
+	ports.
+
+	The setup latency is from socket() till the connection is established: connect()
+	returns once the SYN-ACK is in. With TCP Fast Open (TCP_FASTOPEN_CONNECT) the
+	connect() returns straight away and the SYN goes out with the first write(),
+	which (on a blocking socket) returns once the SYN-ACK is in. Once the first
+	connection has got us a cookie, the message rides in the SYN, which is what the
+	whole connection time, from socket() till the answer (or the FIN if there is no
+	message) is in, shows. It goes into a histogram of its own.
+	It returns how many bytes of messages we sent */
+
+long int run_crr () {
+
+	char * buff;
+	int sock, one = 1;
+	long int i, n, stat, sent = 0;
+	struct sockaddr_storage addr;
+	struct timespec t0, t1, up;
+
+	printf("[INFO]: Starting the connection rate test%s\n", ti.fastopen ? " with TCP Fast Open" : "");
+
+	memcpy(&addr, ti.ctrl_ai->ai_addr, ti.ctrl_ai->ai_addrlen);
+	if (addr.ss_family == AF_INET)
+		((struct sockaddr_in *) &addr)->sin_port = htons(ti.test_port);
+	else
+		((struct sockaddr_in6 *) &addr)->sin6_port = htons(ti.test_port);
+
+	buff = calloc(1, ti.crr_size > 0 ? ti.crr_size : 1);
+	if (buff == NULL)
+		raise_error("[ERROR]: Could not allocate the buffer");
+
+	for (i = 0; i < ti.data_info; i++) {
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+
+		sock = socket(ti.ctrl_ai->ai_family, ti.ctrl_ai->ai_socktype, ti.ctrl_ai->ai_protocol);
+		if (sock < 0)
+			raise_error("[ERROR]: Could not create socket for the connection");
+
+		if (ti.fastopen && setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) < 0)
+			raise_error("[ERROR]: Could not enable TCP_FASTOPEN_CONNECT");
+
+		if (connect(sock, (struct sockaddr *) &addr, ti.ctrl_ai->ai_addrlen) != 0)
+			raise_error("[ERROR]: Could not connect to the server");
+		clock_gettime(CLOCK_MONOTONIC, &up);
+
+		if (ti.crr_size > 0) {
+			for (n = 0; n < ti.crr_size; n += stat) {
+				stat = write(sock, buff + n, ti.crr_size - n);
+				if (stat <= 0)
+					raise_error("[ERROR]: Write on the socket failed");
+				if (n == 0 && ti.fastopen)
+					clock_gettime(CLOCK_MONOTONIC, &up);
+				}
+			if (recv(sock, buff, ti.crr_size, MSG_WAITALL) != ti.crr_size)
+				raise_error("[ERROR]: The server did not answer on the connection");
+			}
+		else if (recv(sock, buff, 1, 0) != 0)
+			raise_error("[ERROR]: The server did not close the connection");
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		hist_record(ti.hist, (up.tv_sec - t0.tv_sec) * 1000000000L + (up.tv_nsec - t0.tv_nsec));
+		hist_record(ti.conn_hist, (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+
+		/* Wait for its FIN, so that it is the server that closes first */
+		if (ti.crr_size > 0 && recv(sock, buff, 1, 0) != 0)
+			raise_error("[ERROR]: The server did not close the connection");
+		close(sock);
+
+		sent += ti.crr_size;
+		__atomic_store_n(&ti.live->bytes, sent, __ATOMIC_RELAXED);
+		__atomic_store_n(&ti.live->packets, i + 1, __ATOMIC_RELAXED);
+		}
+
+	ti.rr_done = i;
+	free(buff);
+	return sent;
+	}
+
+
+
+
+
+
+
+
+/* show_crr: This function shows the connection rate, by our clock, the setup
+	latencies and the times of the whole connections. The server tells us how many
+	connections it accepted, and how many of them came with data in the SYN.
+	send_time is in ns */
+
+void show_crr (long int send_time, long int conns, long int tfo_conns) {
+
+	printf("\n[INFO]: Connection rate over ipv%d, %d bytes each way%s\n",
+		ti.n_prot, ti.crr_size, ti.fastopen ? ", TCP Fast Open" : "");
+
+	if (ti.hist->n == 0) {
+		fprintf(stderr,"[WARNING]: Not a single connection was made\n");
+		return;
+		}
+
+	printf("\n\
+	+-----------------+-------------------+\n\
+	| Connections     |      %10ld   |\n\
+	| Accepted        |      %10ld   |\n\
+	| Fast Open       |      %10ld   |\n\
+	| Per second      |  %14.2f   |\n",
+		ti.rr_done, conns, tfo_conns, send_time > 0 ? ti.rr_done * 1000000000.0 / send_time : 0.0);
+	printf("\
+	+-----------------+-------------------+\n\
+	| Setup latency   |                   |\n");
+	show_hist(ti.hist);
+	printf("\
+	| Whole connection|                   |\n");
+	show_hist(ti.conn_hist);
+
+	/* The first one gets the cookie, all the others should use it */
+	if (ti.fastopen && ti.rr_done > 1 && tfo_conns == 0)
+		printf("[WARNING]: No connection carried data in the SYN. Fast Open has to be enabled on both\n\
+ends (net.ipv4.tcp_fastopen = 1 on the client, 2 on the server, or 3 on both)\n");
+	}
+
+
+
+
+
+
+
+
+/* result_unit: This function returns what ti.result is measured in */
+
+const char * result_unit () {
+
+	if (ti.crr_size >= 0)
+		return "conn/s";
+	if (ti.req_size > 0)
+		return "txn/s";
+	return "Mbit/s";
+	}
+
+
+
+
+
+
+
+
+/* run_receiver: This function receives what the server sends us, in reverse (called
+	straight from perf_test()) and both ways (as a thread of its own) */
+
+void * run_receiver (void * arg) {
+
+	/* Both ways, this is a thread of its own next to the sending */
+	if (ti.direction == DIR_BOTH)
+		pin_thread(1);
+
+	if (ti.t_prot == 1)
+		run_tcp_recv();
+	else
+		run_udp_recv();
+
+	return NULL;
+	}
+
+
+
+
+
+
+
+
+/* run_tcp_recv: This function reads the server's ti.data_info bytes off the TCP
+	connection. Not a byte more, the results come after them on the same connection */
+
+void run_tcp_recv () {
+
+	char * buff;
+	long int n, want;
+
+	printf("[INFO]: Starting to receive over TCP\n");
+
+	buff = malloc(RX_BUFF_SIZE);
+	if (buff == NULL)
+		raise_error("[ERROR]: Could not allocate the receive buffer");
+
+	while (ti.rx_bytes < ti.data_info) {
+
+		want = ti.data_info - ti.rx_bytes < RX_BUFF_SIZE ? ti.data_info - ti.rx_bytes : RX_BUFF_SIZE;
+		n = read(ti.testsock, buff, want);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			raise_error("[ERROR]: Read on the socket failed");
+		if (n == 0)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &ti.rx_last);
+		if (ti.rx_bytes == 0)
+			ti.rx_first = ti.rx_last;
+
+		ti.rx_bytes += n;
+		__atomic_store_n(&ti.live->rx_bytes, ti.rx_bytes, __ATOMIC_RELAXED);
+		}
+
+	free(buff);
+	}
+
+
+
+
+
+
+
+
+/* run_udp_recv: This function receives the server's datagrams, till we have all
+	ti.data_info of them or nothing came for a second. Every one has the same header
+	as ours, so we do what the server does with it: count what came out of order
+	and how far back it was, and keep the RFC 3550 interarrival jitter (the clocks
+	don't need to agree for that). We don't look for duplicates, a duplicate counts
+	as received */
+
+void run_udp_recv () {
+
+	char * buff;
+	int idle = 0;
+	long int n;
+	uint64_t seq, next = 0;
+	int64_t transit, last_transit = 0, d;
+	double jitter = 0;
+	struct dgram_hdr hdr;
+	struct timespec now;
+	struct timeval tv;
+
+	printf("[INFO]: Starting to receive over UDP\n");
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	if (setsockopt(ti.testsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		raise_error("[ERROR]: Could not set timeout on the test socket");
+
+	buff = malloc(MAX_MSG_SIZE);
+	if (buff == NULL)
+		raise_error("[ERROR]: Could not allocate the receive buffer");
+
+	while (ti.rx_packets < ti.data_info) {
+
+		n = recv(ti.testsock, buff, MAX_MSG_SIZE, 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				raise_error("[ERROR]: Read on the socket failed");
+			if (ti.rx_packets > 0 || ++idle >= UDP_START_WAIT)
+				break;
+			continue;
+			}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		clock_gettime(CLOCK_MONOTONIC, &ti.rx_last);
+		if (ti.rx_packets == 0)
+			ti.rx_first = ti.rx_last;
+
+		ti.rx_bytes += n;
+		ti.rx_packets++;
+		__atomic_store_n(&ti.live->rx_bytes, ti.rx_bytes, __ATOMIC_RELAXED);
+
+		if (n < (long int) sizeof(hdr))
+			continue;
+		memcpy(&hdr, buff, sizeof(hdr));
+		seq = be64toh(hdr.seq);
+
+		if (seq < next) {
+			ti.rs.reordered++;
+			if ((long int) (next - seq) > ti.rs.max_reorder)
+				ti.rs.max_reorder = next - seq;
+			}
+		else
+			next = seq + 1;
+
+		transit = ((int64_t) now.tv_sec * 1000000000 + now.tv_nsec) - ((int64_t) be64toh(hdr.sec) * 1000000000 + ntohl(hdr.nsec));
+		if (ti.rs.unique > 0) {
+			d = transit - last_transit;
+			jitter += ((d < 0 ? -d : d) - jitter) / 16;
+			}
+		last_transit = transit;
+		ti.rs.unique++;
+		}
+
+	ti.rs.highest = next;
+	ti.rs.jitter = jitter;
+	free(buff);
+	}
+
+
+
+
+
+
+
+
+/* show_reverse: This function shows how the server to client direction went: the
+	sending by the server's clock, the receiving by ours, and for UDP the packet rates
+	and what we made of the sequence numbers. In reverse this is the result of the
+	test */
+
+void show_reverse (struct ctrl_msg * m) {
+
+	long int sent = ctrl_get(m, P_SENT, 0);
+	long int sent_pkts = ctrl_get(m, P_SENT_PKTS, 0);
+	long int tx_time = ctrl_get(m, P_TX_TIME, 0);
+	long int rx_time = (ti.rx_last.tv_sec - ti.rx_first.tv_sec) * 1000000000L + (ti.rx_last.tv_nsec - ti.rx_first.tv_nsec);
+
+	printf("\n[INFO]: Server to client\n");
+	printf("\n[INFO]: Sender:   %ld bytes in %.3f ms, %.2f Mbit/s (server clock)\n",
+		sent, tx_time / 1e6, tx_time > 0 ? sent * 8000.0 / tx_time : 0.0);
+
+	if (rx_time > 0)
+		printf("[INFO]: Receiver: %ld bytes in %.3f ms, %.2f Mbit/s (client clock, first to last chunk)\n",
+			ti.rx_bytes, rx_time / 1e6, ti.rx_bytes * 8000.0 / rx_time);
+
+	if (ti.t_prot == 0) {
+		calc_packet_rate(sent_pkts, ti.rx_packets, tx_time, rx_time);
+		show_udp_stats(sent_pkts, &ti.rs);
+		}
+
+	if (ti.direction == DIR_REVERSE)
+		ti.result = rx_time > 0 ? ti.rx_bytes * 8000.0 / rx_time : 0;
+	}
+
+
+
+
+
+
+
+
+/* set_df: This function sets what happens to our datagrams that are bigger than the
+	path MTU (-f). ipv4 has DF in every packet, the kernel sets it for path MTU
+	discovery unless told not to. ipv6 routers never fragment, only we can, and
+	IPV6_DONTFRAG says we shouldn't either */
+
+void set_df (int sock, int family) {
+
+	int val;
+
+	if (ti.df == DF_KERNEL)
+		return;
+
+	if (family == AF_INET) {
+		val = ti.df == DF_DO ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+		if (setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0)
+			raise_error("[ERROR]: Could not set IP_MTU_DISCOVER on the test socket");
+		}
+	else {
+		val = ti.df == DF_DO;
+		if (setsockopt(sock, IPPROTO_IPV6, IPV6_DONTFRAG, &val, sizeof(val)) < 0)
+			raise_error("[ERROR]: Could not set IPV6_DONTFRAG on the test socket");
+		}
+	}
+
+
+
+
+
+
+
+
+/* path_mtu: This function asks the kernel for the MTU of the path of a connected
+	socket: the route's, or what path MTU discovery has found out since. 0 if it
+	doesn't know */
+
+int path_mtu (int sock, int family) {
+
+	int mtu = 0;
+	socklen_t len = sizeof(mtu);
+
+	if (family == AF_INET)
+		getsockopt(sock, IPPROTO_IP, IP_MTU, &mtu, &len);
+	else
+		getsockopt(sock, IPPROTO_IPV6, IPV6_MTU, &mtu, &len);
+
+	return mtu;
+	}
+
+
+
+
+
+
+
+
+/* probe_mtu: This function finds out the path MTU to the server before any test has
+	run, with a UDP socket connected to the control port. Connecting a UDP socket
+	sends nothing, so the server never knows */
+
+int probe_mtu () {
+
+	struct addrinfo hints, * res;
+	int sock, mtu = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = ti.domain;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	if (getaddrinfo(ti.serv_name, ti.ctrl_port_str, &hints, &res) != 0)
+		raise_error("[ERROR]: No such host");
+
+	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) == 0)
+		mtu = path_mtu(sock, res->ai_family);
+
+	if (sock >= 0)
+		close(sock);
+	freeaddrinfo(res);
+	return mtu;
+	}
+
+
+
+
+
+
+
+
+/* frag_count: This function works out how many IP packets a datagram of size bytes
+	takes on a path with this MTU. Every fragment but the last carries a multiple of
+	8 bytes. ipv6 fragments also carry an 8 byte fragment header */
+
+int frag_count (int mtu, int family, int size) {
+
+	int ip_hdr = family == AF_INET ? 20 : 40;
+	int per_frag;
+
+	if (size + 8 + ip_hdr <= mtu)
+		return 1;
+
+	per_frag = (mtu - ip_hdr - (family == AF_INET ? 0 : 8)) & ~7;
+	if (per_frag <= 0)
+		return 0;
+	return (size + 8 + per_frag - 1) / per_frag;
+	}
+
+
+
+
+
+
+
+
+/* frag_creates: This function reads how many fragments this host has made so far
+	(FragCreates of /proc/net/snmp, Ip6FragCreates of /proc/net/snmp6). It counts
+	for the whole host, so other traffic shows up too. -1 if we can't tell */
+
+long int frag_creates (int family) {
+
+	FILE * fp;
+	char line[2048], vals[2048], * name, * val, * sn, * sv;
+	long int n = -1;
+
+	if (family == AF_INET6) {
+		if ((fp = fopen("/proc/net/snmp6", "r")) == NULL)
+			return -1;
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (sscanf(line, "Ip6FragCreates %ld", &n) == 1)
+				break;
+		fclose(fp);
+		return n;
+		}
+
+	/* Two lines per protocol, the names and then the values */
+	if ((fp = fopen("/proc/net/snmp", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL && fgets(vals, sizeof(vals), fp) != NULL) {
+		if (strncmp(line, "Ip:", 3) != 0)
+			continue;
+		name = strtok_r(line, " \n", &sn);
+		val = strtok_r(vals, " \n", &sv);
+		while (name != NULL && val != NULL) {
+			if (strcmp(name, "FragCreates") == 0) {
+				n = atol(val);
+				break;
+				}
+			name = strtok_r(NULL, " \n", &sn);
+			val = strtok_r(NULL, " \n", &sv);
+			}
+		break;
+		}
+	fclose(fp);
+	return n;
+	}
+
+
+
+
+
+
+
+
+/* sweep: This function runs the UDP test once for every size from small datagrams up
+	to the largest that fits the path MTU, and then past it: one byte more and a few
+	times as much. Every size is a complete session of its own, like the trials of
+	compare(). With network protocol 46, one sweep per family, each against its own
+	path MTU, since that is where the two fragment differently.
+
+	With -f do the sizes past the MTU can't be sent at all; we show them as such */
+
+void sweep () {
+
+	struct sweep_point * pts;
+	char * hosts[2], * comma;
+	int sizes[MAX_SWEEP];
+	int fam, first, last, mtu, maxp, n, i, size;
+	long int before, after;
+
+	hosts[0] = hosts[1] = ti.serv_name;
+	comma = strchr(ti.serv_name, ',');
+	if (comma != NULL) {
+		*comma = '\0';
+		hosts[1] = comma + 1;
+		}
+
+	pts = calloc(MAX_SWEEP, sizeof(struct sweep_point));
+	if (pts == NULL)
+		raise_error("[ERROR]: Could not allocate the results");
+
+	first = ti.n_prot == 6 ? 1 : 0;
+	last = ti.n_prot == 4 ? 0 : 1;
+
+	for (fam = first; fam <= last; fam++) {
+
+		ti.serv_name = hosts[fam];
+		ti.n_prot = fam ? 6 : 4;
+		ti.domain = fam ? AF_INET6 : AF_INET;
+
+		mtu = probe_mtu();
+		if (mtu <= 0) {
+			fprintf(stderr,"[WARNING]: Could not find out the path MTU over ipv%d, assuming 1500\n", ti.n_prot);
+			mtu = 1500;
+			}
+		maxp = mtu - (fam ? 40 : 20) - 8;
+
+		/* Powers of two below the largest unfragmented size, that size, and past it */
+		n = 0;
+		for (size = 64; size < maxp && size <= MAX_MSG_SIZE && n < MAX_SWEEP - 4; size *= 2)
+			sizes[n++] = size;
+		for (i = 0; i < 4; i++) {
+			size = i == 0 ? maxp : i == 1 ? maxp + 1 : maxp * (i == 2 ? 2 : 4);
+			if (size > MAX_MSG_SIZE)
+				size = MAX_MSG_SIZE;
+			if (n == 0 || size > sizes[n - 1])
+				sizes[n++] = size;
+			}
+
+		printf("\n[INFO]: Sweeping %d sizes over ipv%d, path MTU %d\n", n, ti.n_prot, mtu);
+
+		for (i = 0; i < n; i++) {
+
+			memset(&pts[i], 0, sizeof(pts[i]));
+			pts[i].size = ti.msg_size = sizes[i];
+			pts[i].frags = frag_count(mtu, ti.domain, sizes[i]);
+
+			if (ti.df == DF_DO && pts[i].frags > 1) {
+				pts[i].skipped = 1;
+				continue;
+				}
+
+			printf("\n[INFO]: %d byte datagrams over ipv%d\n", sizes[i], ti.n_prot);
+
+			before = frag_creates(ti.domain);
+			connect_ctrl();
+			perf_test();
+			end_trial();
+			after = frag_creates(ti.domain);
+
+			pts[i].mbps = ti.result;
+			pts[i].tx_pps = ti.tx_pps;
+			pts[i].rx_pps = ti.rx_pps;
+			pts[i].loss = ti.loss;
+			pts[i].frag_made = before >= 0 && after >= 0 ? after - before : -1;
+			}
+
+		show_sweep(pts, n, mtu);
+		}
+
+	free(pts);
+	}
+
+
+
+
+
+
+
+
+/* show_sweep: This function shows the sweep of one family. Fragments is what the
+	path MTU says a datagram of that size takes, made is what the host counted while
+	the test ran */
+
+void show_sweep (struct sweep_point * pts, int n, int mtu) {
+
+	int i;
+
+	printf("\n[INFO]: Size sweep over ipv%d, path MTU %d, DF %s\n", ti.n_prot, mtu, df_name[ti.df]);
+	printf("\n\
+	+--------+-----------+-----------------+-----------------+-----------------+----------+--------------+\n\
+	|  Bytes | Fragments |  Mbit/s (recv)  |   Sent pkts/s   |   Rcvd pkts/s   |   Lost %% |  Frags made  |\n\
+	+--------+-----------+-----------------+-----------------+-----------------+----------+--------------+\n");
+
+	for (i = 0; i < n; i++) {
+		if (pts[i].skipped) {
+			printf("\
+	| %6d | %5d (!) |         too big to send with DF set                                             |\n",
+				pts[i].size, pts[i].frags);
+			continue;
+			}
+		printf("\
+	| %6d | %5d%s | %15.2f | %15.0f | %15.0f | %8.2f | %12ld |\n",
+			pts[i].size, pts[i].frags, pts[i].frags > 1 ? " (!)" : "    ", pts[i].mbps,
+			pts[i].tx_pps, pts[i].rx_pps, pts[i].loss, pts[i].frag_made);
+		}
+
+	printf("\
+	+--------+-----------+-----------------+-----------------+-----------------+----------+--------------+\n\
+	(!) fragments on the way\n");
+	}
+
+
+
+
+
+
+
+
+/* pace_wait: This function is the token bucket of the paced UDP sender. Rather than
+	topping up tokens, we work out when the bytes sent so far should have been done at
+	ti.rate (a virtual clock, same thing) and wait till then. One batch is the burst.
+
+	Sleeping is only good to some tens of microseconds, so we sleep till shortly
+	before the datagrams are due and spin on CLOCK_MONOTONIC for the rest. How late we
+	still are is the pacing error */
+
+void pace_wait (struct timespec * start, long int sent_bytes) {
+
+	struct timespec now, wake;
+	double due_ns = sent_bytes * 8 / ti.rate * 1e9;
+	double now_ns, late;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+
+	if (due_ns - now_ns > PACING_SPIN_NS) {
+		long long at = (long long) start->tv_sec * 1000000000LL + start->tv_nsec + (long long) (due_ns - PACING_SPIN_NS);
+		wake.tv_sec = at / 1000000000LL;
+		wake.tv_nsec = at % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+		}
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ns = (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+		} while (now_ns < due_ns);
+
+	late = now_ns - due_ns;
+	ti.pace_err_sum += late;
+	if (late > ti.pace_err_max)
+		ti.pace_err_max = late;
+	ti.pace_sends++;
+	}
+
+
+
+
+/* show_pacing: This function shows how well we kept to the target rate */
+
+void show_pacing (long int sent_bytes) {
+
+	double achieved;
+
+	if (ti.pace_time <= 0)
+		return;
+
+	achieved = sent_bytes * 8 / ti.pace_time;
+
+	printf("\n[INFO]: Pacing: target %.0f bits/s, achieved %.0f bits/s (%+.3f %%)\n",
+		ti.rate, achieved, 100.0 * (achieved - ti.rate) / ti.rate);
+	printf("[INFO]: Pacing: sends were late by %.3f us on average, %.3f us at most\n",
+		ti.pace_sends > 0 ? ti.pace_err_sum / ti.pace_sends / 1000.0 : 0.0, ti.pace_err_max / 1000.0);
+	}
+
+
+
+
+/* parse_rate: This function turns something like 500M or 2.5G into bits/s. Returns
+	0 if it makes no sense */
+
+double parse_rate (const char * str) {
+
+	char * end;
+	double r = strtod(str, &end);
+
+	switch (*end) {
+		case 'k': case 'K': r *= 1e3; end++; break;
+		case 'm': case 'M': r *= 1e6; end++; break;
+		case 'g': case 'G': r *= 1e9; end++; break;
+		}
+
+	if (*end != '\0' || r <= 0)
+		return 0;
+	return r;
+	}
+
+
+
+
+
+
+
+
+/* connect_ctrl: This function looks up ti.serv_name for the family in ti.domain and
+	connects the control connection to it */
+
+void connect_ctrl () {
+
+	struct addrinfo * s;
+	int ret;
+
+	/* Now lookup the server and populate the hostent structure
+
+	Apparently, gethostbyname() function is now obsolete. So I will have to try and use getaddrinfo()
+	which is new one.
+	server = gethostbyname(serv_name); 
+	
+	
+	getaddrinfo simplifies the matter a lot. I could remove all the ipv4/ipv6 specific things from the
+	previous case statement and now getaddrinfo will take care of it
+	*/
+
+	/* Setting all the fields of addrinfo structure. Doing it for control as well as test connection.
+	This is because of the difference in the type of the socket.
+	If test is TCP test, the test addrinfo structure will be ignored */
+
+	memset(&ti.ctrl_serv, 0, sizeof(ti.ctrl_serv));
+	memset(&ti.test_serv, 0, sizeof(ti.test_serv));
+
+	ti.ctrl_serv.ai_family = ti.domain;			/* AF_INET or AF_INET6 */
+	ti.test_serv.ai_family = ti.domain;
+
+	ti.ctrl_serv.ai_socktype = SOCK_STREAM;		/* Stream of datagram */
+	ti.test_serv.ai_socktype = SOCK_DGRAM;
+
+	ti.ctrl_serv.ai_protocol = 0;				/* TCP or UDP - let OS chose */
+	ti.test_serv.ai_protocol = 0;
+
+	ti.ctrl_serv.ai_flags = AI_CANONNAME|AI_ADDRCONFIG;				/* Flags */
+	ti.test_serv.ai_flags = AI_CANONNAME|AI_ADDRCONFIG;
+
+	/* Get address information for control connection. If needed, we will get the addr info
+	for test connection later (server won't know it has to setup UDP socket before handshake */
+
+	ret = getaddrinfo(ti.serv_name, ti.ctrl_port_str, &ti.ctrl_serv, &ti.ctrl_ptr);
+	if (ret != 0)
+		raise_error("[ERROR]: No such host");
+	
+
+	/* We have got a linked list of addresses. Parse through it, create the socket and try to connet
+	till we succeed */
+
+	for (s = ti.ctrl_ptr; s != NULL; s = s->ai_next) {
+
+		/* First create a socket */
+		ti.ctrlsock = socket(s->ai_family, s->ai_socktype, s->ai_protocol);
+		if (ti.ctrlsock == -1)
+			continue;
+		if (connect(ti.ctrlsock, s->ai_addr, s->ai_addrlen) == 0)
+			break;
+		close(ti.ctrlsock);
+		}
+	
+	if (s == NULL)
+		raise_error("[ERROR]: Could not connect to the server");
+	ti.ctrl_ai = s;				/* Parallel streams connect to the same address */
+	}
+
+
+
+
+/* end_trial: This function closes the connections of a test and forgets whatever
+	the test left behind, so that the next one starts from scratch */
+
+void end_trial () {
+
+	if (ti.t_prot == 0)
+		close(ti.testsock);
+	close(ti.ctrlsock);
+
+	freeaddrinfo(ti.ctrl_ptr);
+	if (ti.test_ptr != NULL)
+		freeaddrinfo(ti.test_ptr);
+	ti.ctrl_ptr = ti.test_ptr = NULL;
+
+	free(ti.streams);
+	ti.streams = NULL;
+
+	ti.sent_packets = 0;
+	ti.gso_segs = 0;
+	ti.gso_sends = 0;
+	ti.pace_time = ti.pace_err_sum = ti.pace_err_max = 0;
+	ti.pace_sends = 0;
+	ti.zc_sent = ti.zc_copied = 0;
+	memset(&ti.us, 0, sizeof(ti.us));
+	memset(ti.live, 0, sizeof(*ti.live));
+	memset(ti.hist, 0, sizeof(*ti.hist));
+	memset(ti.conn_hist, 0, sizeof(*ti.conn_hist));
+	ti.rr_done = ti.rr_lost = 0;
+	ti.udp_port = 0;
+	ti.rx_bytes = ti.rx_packets = 0;
+	memset(&ti.rs, 0, sizeof(ti.rs));
+	}
+
+
+
+
+
+
+
+
+
+/* compare: This function runs the head to head test: ti.trials trials per family
+	against the same server, in pairs. The pairs go ABAB (ipv4 first every time) or,
+	with -O random, in a random order within every pair, so that neither family is
+	always the one running on a warm (or cold) path. Whatever drifts in the background
+	over the minutes of the test hits both families alike, which separate runs can't
+	promise.
+
+	Every trial is a complete session of its own. What we compare is the receiver
+	throughput, by the server's clock (by ours in reverse), or the transactions
+	(connections) per second of a request/response (connection rate) test. For those,
+	the round trips of all the trials of a family also go into one histogram, and the
+	two distributions are compared percentile by percentile */
+
+void compare () {
+
+	char * hosts[2], * comma;
+	double * res[2];
+	struct cpu_cost * cost[2];
+	struct histogram * lat[2];
+	long int checked[2] = { 0, 0 }, corrupt[2] = { 0, 0 }, chunks[2] = { 0, 0 };
+	int n[2] = { 0, 0 };
+	int i, k, fam, first;
+
+	/* One name with both kinds of addresses, or an ipv4 and an ipv6 one */
+	hosts[0] = hosts[1] = ti.serv_name;
+	comma = strchr(ti.serv_name, ',');
+	if (comma != NULL) {
+		*comma = '\0';
+		hosts[1] = comma + 1;
+		}
+
+	res[0] = calloc(ti.trials, sizeof(double));
+	res[1] = calloc(ti.trials, sizeof(double));
+	cost[0] = calloc(2 * ti.trials, sizeof(struct cpu_cost));
+	cost[1] = calloc(2 * ti.trials, sizeof(struct cpu_cost));
+	lat[0] = calloc(1, sizeof(struct histogram));
+	lat[1] = calloc(1, sizeof(struct histogram));
+	if (res[0] == NULL || res[1] == NULL || cost[0] == NULL || cost[1] == NULL || lat[0] == NULL || lat[1] == NULL)
+		raise_error("[ERROR]: Could not allocate the results");
+
+	srand(time(NULL) ^ getpid());
+
+	for (i = 0; i < ti.trials; i++) {
+
+		first = ti.order_random ? rand() % 2 : 0;
+
+		for (k = 0; k < 2; k++) {
+
+			fam = first ^ k;
+			ti.serv_name = hosts[fam];
+			ti.n_prot = fam ? 6 : 4;
+			ti.domain = fam ? AF_INET6 : AF_INET;
+
+			printf("\n[INFO]: Trial %d of %d over ipv%d\n", i + 1, ti.trials, ti.n_prot);
+
+			connect_ctrl();
+			perf_test();
+			hist_merge(lat[fam], ti.hist);		/* end_trial() clears it */
+			end_trial();
+
+			cost[fam][2 * n[fam]] = ti.cpu;
+			cost[fam][2 * n[fam] + 1] = ti.peer_cpu;
+			res[fam][n[fam]++] = ti.result;
+			checked[fam] += ti.checked;
+			corrupt[fam] += ti.corrupt_bytes;
+			chunks[fam] += ti.corrupt_chunks;
+			printf("[INFO]: Trial %d over ipv%d: %.2f %s\n", i + 1, ti.n_prot, ti.result, result_unit());
+			}
+		}
+
+	show_compare(res[0], res[1], ti.trials);
+	if (lat[0]->n > 0 || lat[1]->n > 0)
+		show_hist_compare(lat[0], lat[1]);
+	show_cost_compare(cost[0], cost[1], ti.trials);
+
+	if (ti.verify)
+		for (fam = 0; fam < 2; fam++)
+			printf("[%s]: Payload check over ipv%d: %ld of %ld bytes corrupted, in %ld %s\n",
+				corrupt[fam] > 0 ? "WARNING" : "INFO", fam ? 6 : 4, corrupt[fam], checked[fam], chunks[fam],
+				ti.t_prot == 1 ? "reads" : "datagrams");
+
+	free(res[0]);
+	free(res[1]);
+	free(cost[0]);
+	free(cost[1]);
+	free(lat[0]);
+	free(lat[1]);
+	}
+
+
+
+
+/* contend: This function runs an ipv4 and an ipv6 test at the same time, against the
+	same server, and shows how the two share the path. Every test is run by a process
+	of its own (a fork of us, so it has a ti of its own and everything else works as
+	always). Their live counters are in memory shared with us, which we sample every
+	ti.interval ms (a second if -i wasn't given).
+
+	The fairness of an interval is Jain's index over the two throughputs,
+	(x4 + x6)^2 / (2 * (x4^2 + x6^2)): 1 when they get the same, 0.5 when one gets
+	everything. Only intervals in which both were still sending count. What we sample
+	is what was sent; for TCP that is what the path lets through, for UDP (which sends
+	whatever it is told to) look at the index of the receiver throughputs at the end.
+
+	Both tests only run at the same time if the server serves sessions side by side,
+	which takes -D. Otherwise the second one waits for the first, so at the end we
+	check how long they really overlapped */
+
+void contend () {
+
+	struct contention * c;
+	struct timespec start, due;
+	char * hosts[2], * comma;
+	long int bytes[2], last[2] = { 0, 0 };
+	double x[2], to, from = 0, j, j_sum = 0, j_min = 1;
+	double begin[2], end[2], both, longest;
+	pid_t pid[2];
+	int interval = ti.interval > 0 ? ti.interval : 1000;
+	int fam, n, sending, counted = 0;
+
+	hosts[0] = hosts[1] = ti.serv_name;
+	comma = strchr(ti.serv_name, ',');
+	if (comma != NULL) {
+		*comma = '\0';
+		hosts[1] = comma + 1;
+		}
+
+	c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (c == MAP_FAILED)
+		raise_error("[ERROR]: Could not map the shared counters");
+	memset(c, 0, sizeof(*c));
+
+	printf("[INFO]: Running ipv4 and ipv6 at the same time\n");
+	fflush(stdout);			/* or the children print it again */
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (fam = 0; fam < 2; fam++) {
+
+		pid[fam] = fork();
+		if (pid[fam] < 0)
+			raise_error("[ERROR]: Could not start the test process");
+
+		if (pid[fam] == 0) {
+			ti.serv_name = hosts[fam];
+			ti.n_prot = fam ? 6 : 4;
+			ti.domain = fam ? AF_INET6 : AF_INET;
+			ti.live = &c->live[fam];
+			ti.interval = 0;		/* We do the reporting */
+			ti.place.base = fam;	/* Not both on the same CPU */
+
+			connect_ctrl();
+			perf_test();
+			c->result[fam] = ti.result;
+			if (ti.n_records > 0) {
+				c->rec[fam] = ti.records[ti.n_records - 1];
+				c->have_rec[fam] = 1;
+				}
+			exit(0);
+			}
+		}
+
+	/* Sample till both are done sending. An interval only counts if both still
+	were at its end */
+	for (n = 1, sending = 2; sending > 0; n++) {
+
+		due.tv_sec = start.tv_sec + ((long int) n * interval) / 1000;
+		due.tv_nsec = start.tv_nsec + (((long int) n * interval) % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+			}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+
+		/* A test that failed (to start) never gets done */
+		for (fam = 0; fam < 2; fam++)
+			if (pid[fam] > 0 && waitpid(pid[fam], NULL, WNOHANG) == pid[fam])
+				pid[fam] = 0;
+
+		to = (double) n * interval / 1000;
+		for (fam = 0, sending = 0; fam < 2; fam++) {
+			bytes[fam] = __atomic_load_n(&c->live[fam].bytes, __ATOMIC_RELAXED);
+			x[fam] = (bytes[fam] - last[fam]) * 8 / (to - from) / 1e6;
+			last[fam] = bytes[fam];
+			if (pid[fam] > 0 && !__atomic_load_n(&c->live[fam].done, __ATOMIC_RELAXED))
+				sending++;
+			}
+
+		if (sending == 2 && x[0] + x[1] > 0) {
+			j = jain(x, 2);
+			j_sum += j;
+			if (j < j_min)
+				j_min = j;
+			counted++;
+			printf("[INFO]: %7.2f-%-7.2f s  ipv4 %10.2f Mbit/s  ipv6 %10.2f Mbit/s  fairness %.3f\n", from, to, x[0], x[1], j);
+			}
+		else
+			printf("[INFO]: %7.2f-%-7.2f s  ipv4 %10.2f Mbit/s  ipv6 %10.2f Mbit/s\n", from, to, x[0], x[1]);
+		fflush(stdout);
+
+		from = to;
+		}
+
+	/* And now for their results */
+	for (fam = 0; fam < 2; fam++) {
+		if (pid[fam] > 0)
+			waitpid(pid[fam], NULL, 0);
+		if (c->have_rec[fam])
+			add_record(&c->rec[fam]);
+		}
+
+	printf("\n[INFO]: Receiver throughput: ipv4 %.2f Mbit/s, ipv6 %.2f Mbit/s, fairness %.3f\n",
+		c->result[0], c->result[1], c->result[0] + c->result[1] > 0 ? jain(c->result, 2) : 0.0);
+
+	if (counted > 0)
+		printf("[INFO]: Fairness over %d intervals with both sending: mean %.3f, worst %.3f\n",
+			counted, j_sum / counted, j_min);
+	else
+		printf("[WARNING]: No interval with both sending, make the test longer or -i shorter\n");
+
+	/* From the later start to the earlier end */
+	if (c->live[0].done && c->live[1].done) {
+		for (fam = 0; fam < 2; fam++) {
+			begin[fam] = c->live[fam].begin.tv_sec + c->live[fam].begin.tv_nsec / 1e9;
+			end[fam] = c->live[fam].end.tv_sec + c->live[fam].end.tv_nsec / 1e9;
+			}
+		both = fmin(end[0], end[1]) - fmax(begin[0], begin[1]);
+		longest = fmax(end[0] - begin[0], end[1] - begin[1]);
+
+		if (both <= 0)
+			printf("[WARNING]: The ipv4 and ipv6 tests ran one after the other, not at the same time. Is the server "
+				"running with -D?\n");
+		else if (both < longest / 2)
+			printf("[WARNING]: The ipv4 and ipv6 tests only ran at the same time for %.2f of %.2f s. Is the server "
+				"running with -D?\n", both, longest);
+		}
+	else
+		for (fam = 0; fam < 2; fam++)
+			if (!c->live[fam].done)
+				printf("[WARNING]: The ipv%d test didn't get to the end. Is the server running with -D?\n", fam ? 6 : 4);
+
+	munmap(c, sizeof(*c));
+	}
+
+
+
+
+/* jain: This function is Jain's fairness index of n throughputs, (sum x)^2 / (n * sum x^2) */
+
+double jain (double * x, int n) {
+
+	double sum = 0, sq = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sum += x[i];
+		sq += x[i] * x[i];
+		}
+
+	return sq > 0 ? sum * sum / (n * sq) : 0;
+	}
+
+
+
+
+
+
+
+
+/* show_compare: This function shows the mean and its 95% confidence interval of both
+	families, how far apart they are and whether that is more than chance. The test is
+	Welch's t-test, which doesn't assume that both families are equally noisy */
+
+void show_compare (double * r4, double * r6, int n) {
+
+	double mean[2] = { 0, 0 }, var[2] = { 0, 0 }, half[2];
+	double * r[2] = { r4, r6 };
+	double se, t, df, p;
+	const char * unit = result_unit();
+	char mean_h[32], sd_h[32];
+	int f, i;
+
+	for (f = 0; f < 2; f++) {
+		for (i = 0; i < n; i++)
+			mean[f] += r[f][i];
+		mean[f] /= n;
+
+		for (i = 0; i < n; i++)
+			var[f] += (r[f][i] - mean[f]) * (r[f][i] - mean[f]);
+		var[f] = n > 1 ? var[f] / (n - 1) : 0;
+
+		half[f] = n > 1 ? t_critical(n - 1) * sqrt(var[f] / n) : 0;
+		}
+
+	snprintf(mean_h, sizeof(mean_h), "Mean (%s)", unit);
+	snprintf(sd_h, sizeof(sd_h), "Std dev (%s)", unit);
+
+	printf("\n\
+	+--------+--------+-----------------+-----------------+-----------------------------+\n\
+	| Family | Trials | %15s | %16s|     95%% confidence interval |\n\
+	+--------+--------+-----------------+-----------------+-----------------------------+\n", mean_h, sd_h);
+	for (f = 0; f < 2; f++)
+		printf("\
+	| ipv%d   |   %4d | %15.2f | %15.2f | %12.2f - %-12.2f |\n",
+			f ? 6 : 4, n, mean[f], sqrt(var[f]), mean[f] - half[f], mean[f] + half[f]);
+	printf("\
+	+--------+--------+-----------------+-----------------+-----------------------------+\n");
+
+	if (mean[0] > 0)
+		printf("\n[INFO]: ipv6 vs ipv4: %+.2f %s (%+.2f %%)\n", mean[1] - mean[0], unit, 100.0 * (mean[1] - mean[0]) / mean[0]);
+
+	se = var[0] / n + var[1] / n;
+	if (n < 2 || se <= 0) {
+		printf("[WARNING]: Not enough spread in the trials for a significance test\n");
+		return;
+		}
+
+	/* Welch-Satterthwaite degrees of freedom */
+	t = (mean[1] - mean[0]) / sqrt(se);
+	df = se * se / ((var[0] / n) * (var[0] / n) / (n - 1) + (var[1] / n) * (var[1] / n) / (n - 1));
+	p = incbeta(df / 2, 0.5, df / (df + t * t));
+
+	printf("[INFO]: Welch's t-test: t = %.3f, df = %.1f, p = %.4f. The difference is %s at the 5%% level\n",
+		t, df, p, p < 0.05 ? "significant" : "not significant");
+	}
+
+
+
+
+/* show_cost_compare: This function shows what the trials of compare() cost per
+	family: the means over the trials of CPU time and cycles per byte and per packet,
+	for us and for the server. Every trial has two entries in c4 and c6, ours and
+	then the server's. Whatever a side did not count is left out */
+
+void show_cost_compare (struct cpu_cost * c4, struct cpu_cost * c6, int n) {
+
+	struct cpu_cost * c[2] = { c4, c6 };
+	double ns, cb, cp;
+	int f, side, i, n_ns, n_cyc;
+	char ns_s[16], cb_s[16], cp_s[16];
+
+	printf("\n[INFO]: CPU cost over %s, per byte and per %s, means of %d trials per family\n",
+		ti.t_prot == 1 ? "TCP" : "UDP", cost_unit(), n);
+	printf("\n\
+	+--------+--------+-----------------+-----------------+-----------------+\n\
+	| Family | Side   |     ns per byte | cycles per byte | cycles per unit |\n\
+	+--------+--------+-----------------+-----------------+-----------------+\n");
+
+	for (f = 0; f < 2; f++)
+		for (side = 0; side < 2; side++) {
+
+			ns = cb = cp = 0;
+			n_ns = n_cyc = 0;
+
+			for (i = 0; i < n; i++) {
+				struct cpu_cost * x = &c[f][2 * i + side];
+
+				if (x->user < 0 || x->bytes <= 0)
+					continue;
+				ns += (x->user + x->sys) * 1000.0 / x->bytes;
+				n_ns++;
+
+				if (cyc_per(x, x->bytes) < 0)
+					continue;
+				cb += cyc_per(x, x->bytes);
+				cp += cyc_per(x, x->packets) > 0 ? cyc_per(x, x->packets) : 0;
+				n_cyc++;
+				}
+
+			snprintf(ns_s, sizeof(ns_s), n_ns > 0 ? "%.3f" : "n/a", ns / (n_ns > 0 ? n_ns : 1));
+			snprintf(cb_s, sizeof(cb_s), n_cyc > 0 ? "%.2f" : "n/a", cb / (n_cyc > 0 ? n_cyc : 1));
+			snprintf(cp_s, sizeof(cp_s), n_cyc > 0 ? "%.0f" : "n/a", cp / (n_cyc > 0 ? n_cyc : 1));
+
+			printf("\
+	| ipv%d   | %-6s | %15s | %15s | %15s |\n", f ? 6 : 4, side ? "server" : "client", ns_s, cb_s, cp_s);
+			}
+	printf("\
+	+--------+--------+-----------------+-----------------+-----------------+\n");
+	}
+
+
+
+
+/* t_critical: This function returns the two sided 95% critical value of Student's t
+	distribution with df degrees of freedom. A table is plenty for confidence intervals */
+
+double t_critical (int df) {
+
+	static const double t975[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+		2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+	if (df <= 30)
+		return t975[df < 1 ? 1 : df];
+	if (df <= 40)
+		return 2.021;
+	if (df <= 60)
+		return 2.000;
+	if (df <= 120)
+		return 1.980;
+	return 1.960;
+	}
+
+
+
+
+/* incbeta: This function is the regularized incomplete beta function I_x(a, b). The
+	two sided p-value of Student's t with df degrees of freedom is I_(df/(df+t^2))(df/2, 1/2).
+	It is the continued fraction worked out with Lentz's algorithm, which converges
+	quickly below the mean of the distribution; above it we use I_x(a, b) = 1 - I_(1-x)(b, a) */
+
+double incbeta (double a, double b, double x) {
+
+	double front, f = 1, c = 1, d = 0, num;
+	int i, m;
+
+	if (x <= 0)
+		return 0;
+	if (x >= 1)
+		return 1;
+	if (x > (a + 1) / (a + b + 2))
+		return 1 - incbeta(b, a, 1 - x);
+
+	front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x)) / a;
+
+	for (i = 0; i <= 400; i++) {
+
+		m = i / 2;
+		if (i == 0)
+			num = 1;
+		else if (i % 2 == 0)
+			num = (m * (b - m) * x) / ((a + 2 * m - 1) * (a + 2 * m));
+		else
+			num = -((a + m) * (a + b + m) * x) / ((a + 2 * m) * (a + 2 * m + 1));
+
+		d = 1 + num * d;
+		if (fabs(d) < 1e-30)
+			d = 1e-30;
+		d = 1 / d;
+
+		c = 1 + num / c;
+		if (fabs(c) < 1e-30)
+			c = 1e-30;
+
+		f *= c * d;
+		if (fabs(1 - c * d) < 1e-10)
+			break;
+		}
+
+	return front * (f - 1);
+	}
+
+
+
+
+
+
+
+
+/* calc_throughput: This function receives the datasize and the start and end timestamps.
+	It then calculates the throughput and displays on stdout */
+
+void calc_throughput (long int data, struct timespec s, struct timespec e) {
+
+	long double start = s.tv_sec * 1000000000 + s.tv_nsec;
+	long double end = e.tv_sec * 1000000000 + e.tv_nsec;
+	long double diff = end - start;
+
+	/* Not worth giving up the whole test for, the sender and receiver durations
+	are still good */
+	if (diff <= 0) {
+		fprintf(stderr,"[WARNING]: Clocks on server and client seem to be out of sync, no end to end throughput.\n\
+Run ntpd on both, or go by the sender and receiver numbers\n");
+		return;
+		}
+
+	data *= 8;
+	diff /= 1000000;
+	long double throughput = 0;
+	throughput = (data * 1000) / (1024 * diff);
+
+	/* Every number right aligned in a field as wide as its column */
+	printf("\n\
+	+-----------------+-------------------+---------------------+\n\
+	| Datasize (bits) |   Time Taken (ms) |   Throughput (Kbps) |\n\
+	+-----------------+-------------------+---------------------+\n\
+	| %15ld | %17.3Lf | %19.3Lf |\n\
+	+-----------------+-------------------+---------------------+\n", data, diff, throughput);
+	}
+
+
+
+
+
+
+
+/* calc_packet_rate: This function shows the packets per second next to the throughput
+	table. The send rate is what we managed to push out (timed by our own clock till
+	the last sendmmsg), the receive rate is what the server got from its first to its
+	last packet, timed by its clock. Both durations are in ns */
+
+void calc_packet_rate (long int sent, long int rcvd, long int send_time, long int rcvd_time) {
+
+	if (send_time <= 0 || rcvd_time <= 0)
+		return;
+
+	printf("\n\
+	+-----------------+-------------------+---------------------+\n\
+	|                 |           Packets |     Packets per sec |\n\
+	+-----------------+-------------------+---------------------+\n\
+	| Sent            |      %10ld   |     %14.2Lf  |\n\
+	| Received        |      %10ld   |     %14.2Lf  |\n\
+	+-----------------+-------------------+---------------------+\n",
+		sent, sent * 1000000000.0L / send_time, rcvd, rcvd * 1000000000.0L / rcvd_time);
+	}
+
+
+
+
+/* show_durations: This function shows the throughput as each side saw it by its own
+	(monotonic) clock: ours from just before the first send till the last one returned,
+	the server's from the first to the last chunk it received. Neither needs the clocks
+	to be in sync, so they are good even where the end to end number above is not.
+	Durations are in ns */
+
+void show_durations (long int sent, long int send_time, long int rcvd, long int rcvd_time) {
+
+	printf("\n[INFO]: Sender:   %ld bytes in %.3f ms, %.2f Mbit/s (client clock)\n",
+		sent, send_time / 1e6, send_time > 0 ? sent * 8000.0 / send_time : 0.0);
+
+	if (rcvd_time > 0)
+		printf("[INFO]: Receiver: %ld bytes in %.3f ms, %.2f Mbit/s (server clock, first to last chunk)\n",
+			rcvd, rcvd_time / 1e6, rcvd * 8000.0 / rcvd_time);
+	}
+
+
+
+
+
+
+
+/* show_udp_stats: This function shows what the server made of the sequence numbers.
+	Loss is what we sent minus what arrived at least once */
+
+void show_udp_stats (long int sent, struct udp_stats * us) {
+
+	long int lost = sent - us->unique;
+
+	printf("\n\
+	+-----------------+-------------------+---------------------+\n\
+	| Lost            |      %10ld   |     %13.4f %%  |\n\
+	| Duplicates      |      %10ld   |                     |\n\
+	| Reordered       |      %10ld   |   max depth %7ld |\n\
+	| Jitter (us)     |      %10.3f   |                     |\n\
+	+-----------------+-------------------+---------------------+\n",
+		lost, sent > 0 ? 100.0 * lost / sent : 0.0, us->duplicates, us->reordered, us->max_reorder,
+		us->jitter / 1000.0);
+	}
+
+
+
+
+
+
+
+/* save_result: This function keeps what the baseline comparison needs of the test
+	that just ended and, with -o, appends all of it to the result file, as one line.
+	The arguments are what perf_test() has: bytes sent and received, and how long
+	each took (ns) */
+
+void save_result (long int sent, long int rcvd, long int send_time, long int rcvd_time) {
+
+	struct result r;
+	struct field f[64];
+	int n, i;
+
+	memset(&r, 0, sizeof(r));
+	r.family = ti.n_prot;
+	result_config(r.config, sizeof(r.config));
+	r.value = ti.result;
+	snprintf(r.unit, sizeof(r.unit), "%s", result_unit());
+	if (strcmp(test_name(), "transfer") != 0 && ti.hist->n > 0)
+		r.p99 = hist_percentile(ti.hist, 99) / 1e3;
+	add_record(&r);
+
+	if (ti.out == NULL)
+		return;
+
+	n = result_fields(f, sent, rcvd, send_time, rcvd_time);
+
+	if (ti.out_csv) {
+		for (i = 0; i < n; i++)
+			fprintf(ti.out, "%s%s", i > 0 ? "," : "", f[i].value);
+		}
+	else {
+		fprintf(ti.out, "{");
+		for (i = 0; i < n; i++)
+			fprintf(ti.out, f[i].quoted ? "%s\"%s\":\"%s\"" : "%s\"%s\":%s", i > 0 ? "," : "", f[i].name, f[i].value);
+		fprintf(ti.out, "}");
+		}
+
+	/* One line at a time, so that the two processes of -C don't mix theirs */
+	fprintf(ti.out, "\n");
+	fflush(ti.out);
+	}
+
+
+
+
+/* result_fields: This function lays out a line of the result file: every parameter of
+	the test and every number we have of it, in f. It returns how many there are. The
+	CSV header is this with nothing run, so the order is the same for every line */
+
+int result_fields (struct field * f, long int sent, long int rcvd, long int send_time, long int rcvd_time) {
+
+	struct histogram * h = ti.hist;
+	long int rx_time = (ti.rx_last.tv_sec - ti.rx_first.tv_sec) * 1000000000L + (ti.rx_last.tv_nsec - ti.rx_first.tv_nsec);
+	int lat = h != NULL && h->n > 0;
+	int n = 0, i;
+	char * c;
+
+	if (ti.rx_bytes == 0)
+		rx_time = 0;
+
+	add_field(f, &n, 0, "time", "%ld", (long int) time(NULL));
+	add_field(f, &n, 0, "family", "%d", ti.n_prot);
+	add_field(f, &n, 1, "proto", "%s", ti.t_prot == 1 ? "TCP" : "UDP");
+	add_field(f, &n, 1, "test", "%s", test_name());
+	add_field(f, &n, 1, "direction", "%s", direction_name[ti.direction]);
+	add_field(f, &n, 0, "size", "%ld", ti.data_info == LONG_MAX ? 0 : ti.data_info);
+	add_field(f, &n, 0, "duration_ms", "%ld", ti.duration);
+	add_field(f, &n, 0, "msg_size", "%d", ti.msg_size);
+	add_field(f, &n, 0, "streams", "%d", ti.n_streams);
+	add_field(f, &n, 0, "batch", "%d", ti.batch);
+	add_field(f, &n, 1, "tx_mode", "%s", tx_mode_name[ti.tx_mode]);
+	add_field(f, &n, 1, "rx_mode", "%s", ti.rx_mode);
+	add_field(f, &n, 1, "offload", "%s", offload_name[ti.offload]);
+	add_field(f, &n, 1, "engine", "%s", engine_name[ti.engine]);
+	add_field(f, &n, 1, "payload", "%s", payload_name[ti.payload]);
+	add_field(f, &n, 0, "huge", "%d", ti.huge);
+	add_field(f, &n, 0, "rate_bps", "%.0f", ti.rate);
+	add_field(f, &n, 1, "df", "%s", df_name[ti.df]);
+	add_field(f, &n, 0, "req_size", "%d", ti.req_size);
+	add_field(f, &n, 0, "resp_size", "%d", ti.resp_size);
+	add_field(f, &n, 0, "crr_size", "%d", ti.crr_size);
+	add_field(f, &n, 0, "fastopen", "%d", ti.fastopen);
+	add_field(f, &n, 0, "mtu", "%d", ti.mtu);
+
+	add_field(f, &n, 0, "result", "%.3f", ti.result);
+	add_field(f, &n, 1, "unit", "%s", result_unit());
+	add_field(f, &n, 0, "sent_bytes", "%ld", sent);
+	add_field(f, &n, 0, "received_bytes", "%ld", rcvd);
+	add_field(f, &n, 0, "send_time_ns", "%ld", send_time);
+	add_field(f, &n, 0, "receive_time_ns", "%ld", rcvd_time);
+	add_field(f, &n, 0, "sender_mbps", "%.3f", send_time > 0 ? sent * 8000.0 / send_time : 0.0);
+	add_field(f, &n, 0, "receiver_mbps", "%.3f", rcvd_time > 0 ? rcvd * 8000.0 / rcvd_time : 0.0);
+
+	add_field(f, &n, 0, "sent_packets", "%ld", ti.sent_packets);
+	add_field(f, &n, 0, "tx_pps", "%.1f", ti.tx_pps);
+	add_field(f, &n, 0, "rx_pps", "%.1f", ti.rx_pps);
+	add_field(f, &n, 0, "loss_pct", "%.4f", ti.loss);
+	add_field(f, &n, 0, "duplicates", "%ld", ti.us.duplicates);
+	add_field(f, &n, 0, "reordered", "%ld", ti.us.reordered);
+	add_field(f, &n, 0, "max_reorder", "%ld", ti.us.max_reorder);
+	add_field(f, &n, 0, "jitter_us", "%.3f", ti.us.jitter / 1000.0);
+
+	add_field(f, &n, 0, "transactions", "%ld", ti.rr_done);
+	add_field(f, &n, 0, "lost_transactions", "%ld", ti.rr_lost);
+	add_field(f, &n, 0, "lat_min_us", "%.3f", lat ? h->min / 1e3 : 0.0);
+	add_field(f, &n, 0, "lat_mean_us", "%.3f", lat ? h->sum / h->n / 1e3 : 0.0);
+	add_field(f, &n, 0, "lat_p50_us", "%.3f", lat ? hist_percentile(h, 50) / 1e3 : 0.0);
+	add_field(f, &n, 0, "lat_p99_us", "%.3f", lat ? hist_percentile(h, 99) / 1e3 : 0.0);
+	add_field(f, &n, 0, "lat_p999_us", "%.3f", lat ? hist_percentile(h, 99.9) / 1e3 : 0.0);
+	add_field(f, &n, 0, "lat_max_us", "%.3f", lat ? h->max / 1e3 : 0.0);
+	add_field(f, &n, 0, "conn_p50_us", "%.3f", ti.conn_hist->n > 0 ? hist_percentile(ti.conn_hist, 50) / 1e3 : 0.0);
+	add_field(f, &n, 0, "conn_p99_us", "%.3f", ti.conn_hist->n > 0 ? hist_percentile(ti.conn_hist, 99) / 1e3 : 0.0);
+
+	/* What we received ourselves, in reverse and both ways */
+	add_field(f, &n, 0, "rev_received_bytes", "%ld", ti.rx_bytes);
+	add_field(f, &n, 0, "rev_received_packets", "%ld", ti.rx_packets);
+	add_field(f, &n, 0, "rev_receive_time_ns", "%ld", rx_time);
+
+	add_field(f, &n, 0, "cpu_user_s", "%.6f", ti.cpu.user / 1e6);
+	add_field(f, &n, 0, "cpu_sys_s", "%.6f", ti.cpu.sys / 1e6);
+	add_field(f, &n, 0, "cpu_vcsw", "%ld", ti.cpu.vcsw);
+	add_field(f, &n, 0, "cpu_ivcsw", "%ld", ti.cpu.ivcsw);
+	add_field(f, &n, 0, "cycles", "%ld", ti.cpu.hw[HW_CYCLES]);
+	add_field(f, &n, 0, "instructions", "%ld", ti.cpu.hw[HW_INSTRUCTIONS]);
+	add_field(f, &n, 0, "cache_misses", "%ld", ti.cpu.hw[HW_CACHE_MISSES]);
+	add_field(f, &n, 0, "cycles_per_byte", "%.3f", cyc_per(&ti.cpu, ti.cpu.bytes));
+	add_field(f, &n, 0, "cycles_per_packet", "%.1f", cyc_per(&ti.cpu, ti.cpu.packets));
+	add_field(f, &n, 0, "server_cpu_user_s", "%.6f", ti.peer_cpu.user >= 0 ? ti.peer_cpu.user / 1e6 : 0.0);
+	add_field(f, &n, 0, "server_cpu_sys_s", "%.6f", ti.peer_cpu.user >= 0 ? ti.peer_cpu.sys / 1e6 : 0.0);
+	add_field(f, &n, 0, "server_cycles_per_byte", "%.3f", cyc_per(&ti.peer_cpu, ti.peer_cpu.bytes));
+	add_field(f, &n, 0, "server_cycles_per_packet", "%.1f", cyc_per(&ti.peer_cpu, ti.peer_cpu.packets));
+	add_field(f, &n, 0, "verified_bytes", "%ld", ti.verify ? ti.checked : 0);
+	add_field(f, &n, 0, "corrupt_bytes", "%ld", ti.verify ? ti.corrupt_bytes : 0);
+	add_field(f, &n, 0, "corrupt_chunks", "%ld", ti.verify ? ti.corrupt_chunks : 0);
+	add_field(f, &n, 1, "placement", "%s", ti.place.desc);
+	add_field(f, &n, 1, "server_placement", "%s", ti.peer_place);
+	for (i = n - 2; i < n; i++)
+		for (c = f[i].value; *c != '\0'; c++)
+			if (*c == ',')
+				*c = ' ';		/* CPU lists, they would split the CSV */
+	add_field(f, &n, 1, "config", "%s", "");
+	result_config(f[n - 1].value, sizeof(f[n - 1].value));
+
+	return n;
+	}
+
+
+
+
+/* add_field: This function appends a field to f (n of them so far) with the value
+	printed like printf would */
+
+void add_field (struct field * f, int * n, int quoted, const char * name, const char * fmt, ...) {
+
+	va_list ap;
+
+	f[*n].name = name;
+	f[*n].quoted = quoted;
+	va_start(ap, fmt);
+	vsnprintf(f[*n].value, sizeof(f[*n].value), fmt, ap);
+	va_end(ap);
+	(*n)++;
+	}
+
+
+
+
+/* result_config: This function describes the test by everything that changes what
+	it measures, so that it only gets compared to a baseline of the same test. The
+	datasize and the duration are part of it, a short test is not a long one. No
+	commas, it goes into CSV as it is */
+
+void result_config (char * buf, int size) {
+
+	snprintf(buf, size, "%s %s %s size=%ld time=%ld msg=%d streams=%d batch=%d tx=%s rx=%s offload=%s engine=%s "
+		"payload=%s huge=%d rate=%.0f df=%s req=%d resp=%d crr=%d fastopen=%d",
+		ti.t_prot == 1 ? "TCP" : "UDP", test_name(), direction_name[ti.direction],
+		ti.data_info == LONG_MAX ? 0 : ti.data_info, ti.duration, ti.msg_size, ti.n_streams, ti.batch,
+		tx_mode_name[ti.tx_mode], ti.rx_mode, offload_name[ti.offload], engine_name[ti.engine],
+		payload_name[ti.payload], ti.huge, ti.rate, df_name[ti.df], ti.req_size, ti.resp_size,
+		ti.crr_size, ti.fastopen);
+	}
+
+
+
+
+/* test_name: This function returns which kind of test we run, for the result file */
+
+const char * test_name () {
+
+	if (ti.crr_size >= 0)
+		return "crr";
+	if (ti.req_size > 0)
+		return "rr";
+	return "transfer";
+	}
+
+
+
+
+/* add_record: This function keeps a result of this run for check_baseline() */
+
+void add_record (struct result * r) {
+
+	ti.records = realloc(ti.records, (ti.n_records + 1) * sizeof(struct result));
+	if (ti.records == NULL)
+		raise_error("[ERROR]: Could not keep the result");
+	ti.records[ti.n_records++] = *r;
+	}
+
+
+
+
+/* open_output: This function opens the result file (-o) to append to. A CSV file
+	gets the header first, unless there is something in it already */
+
+void open_output () {
+
+	struct field f[64];
+	int n, i;
+
+	if (strcmp(ti.out_name, "-") == 0)
+		ti.out = stdout;
+	else if ((ti.out = fopen(ti.out_name, "a")) == NULL)
+		raise_error("[ERROR]: Could not open the result file");
+
+	fseek(ti.out, 0, SEEK_END);
+	if (ti.out_csv && (ti.out == stdout || ftell(ti.out) == 0)) {
+		n = result_fields(f, 0, 0, 0, 0);
+		for (i = 0; i < n; i++)
+			fprintf(ti.out, "%s%s", i > 0 ? "," : "", f[i].name);
+		fprintf(ti.out, "\n");
+		}
+
+	/* Before -C forks, or both processes write it again */
+	fflush(ti.out);
+	}
+
+
+
+
+/* load_baseline: This function reads the results in the baseline file (-c). It is
+	whatever -o wrote: JSON, one object per line, or CSV with the header on the first
+	line. We only need a few fields, and we know how we wrote them, so this is not a
+	JSON parser, just a search for the keys */
+
+void load_baseline () {
+
+	FILE * f;
+	char line[MAX_LINE], header[MAX_LINE], buf[256];
+	char * names[64], * vals[64], * p, * tok;
+	int cols = 0, n, i, csv = -1;
+	struct result r;
+
+	if ((f = fopen(ti.base_name, "r")) == NULL)
+		raise_error("[ERROR]: Could not open the baseline");
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+
+		/* The first line tells us what it is */
+		if (csv < 0 && (csv = line[0] != '{')) {
+			strcpy(header, line);
+			for (p = header; cols < 64 && (tok = strsep(&p, ",")) != NULL; )
+				names[cols++] = tok;
+			continue;
+			}
+
+		memset(&r, 0, sizeof(r));
+
+		if (csv) {
+			for (p = line, n = 0; n < 64 && (tok = strsep(&p, ",")) != NULL; )
+				vals[n++] = tok;
+			for (i = 0; i < cols && i < n; i++) {
+				if (strcmp(names[i], "family") == 0)
+					r.family = atoi(vals[i]);
+				else if (strcmp(names[i], "config") == 0)
+					snprintf(r.config, sizeof(r.config), "%s", vals[i]);
+				else if (strcmp(names[i], "result") == 0)
+					r.value = atof(vals[i]);
+				else if (strcmp(names[i], "unit") == 0)
+					snprintf(r.unit, sizeof(r.unit), "%s", vals[i]);
+				else if (strcmp(names[i], "lat_p99_us") == 0)
+					r.p99 = atof(vals[i]);
+				}
+			}
+		else {
+			if (json_field(line, "family", buf, sizeof(buf)) == 0)
+				r.family = atoi(buf);
+			json_field(line, "config", r.config, sizeof(r.config));
+			if (json_field(line, "result", buf, sizeof(buf)) == 0)
+				r.value = atof(buf);
+			json_field(line, "unit", r.unit, sizeof(r.unit));
+			if (json_field(line, "lat_p99_us", buf, sizeof(buf)) == 0)
+				r.p99 = atof(buf);
+			}
+
+		if (r.family == 0 || r.config[0] == '\0')
+			continue;
+
+		ti.base = realloc(ti.base, (ti.n_base + 1) * sizeof(struct result));
+		if (ti.base == NULL)
+			raise_error("[ERROR]: Could not keep the baseline");
+		ti.base[ti.n_base++] = r;
+		}
+
+	fclose(f);
+	printf("[INFO]: %d results in the baseline %s\n", ti.n_base, ti.base_name);
+	}
+
+
+
+
+/* json_field: This function finds "key": in a line we wrote and copies its value
+	(without the quotes, if it is a string) to buf. Returns -1 if it isn't there */
+
+int json_field (const char * line, const char * key, char * buf, int size) {
+
+	char pat[64];
+	const char * p, * end;
+	int len;
+
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	if ((p = strstr(line, pat)) == NULL)
+		return -1;
+	p += strlen(pat);
+
+	if (*p == '"')
+		end = strchr(++p, '"');
+	else
+		end = p + strcspn(p, ",}");
+	if (end == NULL)
+		return -1;
+
+	len = end - p < size - 1 ? end - p : size - 1;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	return 0;
+	}
+
+
+
+
+/* check_baseline: This function compares the results of this run with the baseline,
+	test by test and family by family: the mean of all our trials of a test against the
+	mean of all the baseline's. The result is a throughput or a rate, lower is worse;
+	for request/response and connection rate tests the p99 latency is checked too,
+	higher is worse. It returns the number of regressions */
+
+int check_baseline () {
+
+	int i, j, n, nb, np, nbp, bad, regressions = 0;
+	double cur, base, cur_p, base_p, d;
+
+	if (ti.base_name == NULL)
+		return 0;
+
+	printf("\n[INFO]: Against the baseline %s, a regression is worse by more than %.1f %%\n", ti.base_name, ti.threshold);
+
+	for (i = 0; i < ti.n_records; i++) {
+
+		/* Every test once */
+		for (j = 0; j < i; j++)
+			if (ti.records[j].family == ti.records[i].family && strcmp(ti.records[j].config, ti.records[i].config) == 0)
+				break;
+		if (j < i)
+			continue;
+
+		cur = base = cur_p = base_p = 0;
+		n = nb = np = nbp = 0;
+		for (j = 0; j < ti.n_records; j++)
+			if (ti.records[j].family == ti.records[i].family && strcmp(ti.records[j].config, ti.records[i].config) == 0) {
+				cur += ti.records[j].value;
+				n++;
+				if (ti.records[j].p99 > 0) {
+					cur_p += ti.records[j].p99;
+					np++;
+					}
+				}
+		for (j = 0; j < ti.n_base; j++)
+			if (ti.base[j].family == ti.records[i].family && strcmp(ti.base[j].config, ti.records[i].config) == 0) {
+				base += ti.base[j].value;
+				nb++;
+				if (ti.base[j].p99 > 0) {
+					base_p += ti.base[j].p99;
+					nbp++;
+					}
+				}
+
+		printf("\n[INFO]: ipv%d %s\n", ti.records[i].family, ti.records[i].config);
+		if (nb == 0) {
+			printf("[WARNING]: Not in the baseline\n");
+			continue;
+			}
+
+		cur /= n;
+		base /= nb;
+		d = base > 0 ? (cur - base) * 100 / base : 0;
+		bad = d < -ti.threshold;
+		printf("%s %.2f %s against %.2f (%+.2f %%, %d against %d runs)%s\n", bad ? "[WARNING]:" : "[INFO]:",
+			cur, ti.records[i].unit, base, d, n, nb, bad ? "  REGRESSION" : "");
+		regressions += bad;
+
+		if (np > 0 && nbp > 0) {
+			cur_p /= np;
+			base_p /= nbp;
+			d = base_p > 0 ? (cur_p - base_p) * 100 / base_p : 0;
+			bad = d > ti.threshold;
+			printf("%s p99 %.3f us against %.3f (%+.2f %%)%s\n", bad ? "[WARNING]:" : "[INFO]:",
+				cur_p, base_p, d, bad ? "  REGRESSION" : "");
+			regressions += bad;
+			}
+		}
+
+	if (regressions > 0)
+		printf("\n[WARNING]: %d regression(s) against the baseline\n", regressions);
+	else
+		printf("\n[INFO]: No regressions against the baseline\n");
+
+	return regressions;
+	}
+
+
+
+
+
+
+
+
+/* shake_hands: This function is to do initial handshake with the server and tell it how
+	much data are we going to send.
+	This should include the following:
+		1. Send the hello with the test parameters: the transport layer protocol,
+		   the data size (bytes/packets/transactions), the number of parallel
+		   streams, the UDP batch depth and offload, the receive path the server
+		   should use, the request and response sizes, the connection rate
+		   test and which way the data goes
+		2*. Send confirmation that clock is synced on client (Not implemented)
+		3. Receive server ready and the port to run the test on (or why not) */
+
+void shake_hands () {
+
+	struct ctrl_msg m;
+	char why[256];
+
+	printf("[INFO]: Starting handshake with server\n");
+
+	/* If the server is to send us UDP, it needs to know where. So our UDP socket
+	comes first, on a port the kernel picks, in the family of the control connection */
+	if (ti.t_prot == 0 && ti.direction != DIR_FORWARD) {
+
+		struct sockaddr_storage local;
+		socklen_t local_len = sizeof(local);
+
+		memset(&local, 0, sizeof(local));
+		local.ss_family = ti.ctrl_ai->ai_family;
+
+		ti.testsock = socket(ti.ctrl_ai->ai_family, SOCK_DGRAM, 0);
+		if (ti.testsock < 0 || bind(ti.testsock, (struct sockaddr *) &local, ti.ctrl_ai->ai_addrlen) < 0 ||
+			getsockname(ti.testsock, (struct sockaddr *) &local, &local_len) < 0)
+			raise_error("[ERROR]: Could not set up the UDP socket to receive on");
+
+		if (local.ss_family == AF_INET)
+			ti.udp_port = ntohs(((struct sockaddr_in *) &local)->sin_port);
+		else
+			ti.udp_port = ntohs(((struct sockaddr_in6 *) &local)->sin6_port);
+		}
+
+	ctrl_init(&m, MSG_HELLO);
+	ctrl_put(&m, P_PROTO, ti.t_prot);
+	ctrl_put(&m, P_SIZE, ti.data_info == LONG_MAX ? 0 : ti.data_info);
+	if (ti.duration > 0)
+		ctrl_put(&m, P_DURATION, ti.duration);
+	if (ti.verify) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		ti.seed = pat_word(now.tv_sec ^ now.tv_nsec, getpid()) | 1;
+		ctrl_put(&m, P_VERIFY, (long int) ti.seed);
+		}
+	ctrl_put(&m, P_STREAMS, ti.n_streams);
+	ctrl_put(&m, P_BATCH, ti.batch);
+	ctrl_put(&m, P_OFFLOAD, ti.offload);
+	if (ti.rate > 0)
+		ctrl_put(&m, P_RATE, ti.rate);
+	ctrl_put_str(&m, P_RXMODE, ti.rx_mode);
+	if (ti.req_size > 0) {
+		ctrl_put(&m, P_REQ_SIZE, ti.req_size);
+		ctrl_put(&m, P_RESP_SIZE, ti.resp_size);
+		}
+	if (ti.crr_size >= 0) {
+		ctrl_put(&m, P_CRR_SIZE, ti.crr_size);
+		ctrl_put(&m, P_FASTOPEN, ti.fastopen);
+		}
+	ctrl_put(&m, P_MSG_SIZE, ti.msg_size);
+	if (ti.engine != ENGINE_SYS)
+		ctrl_put(&m, P_ENGINE, ti.engine);
+	if (ti.tcpi_interval > 0)
+		ctrl_put(&m, P_TCPI_INTERVAL, ti.tcpi_interval);
+	if (ti.direction != DIR_FORWARD) {
+		ctrl_put(&m, P_DIRECTION, ti.direction);
+		ctrl_put(&m, P_UDP_PORT, ti.udp_port);
+		}
+
+	if (ctrl_send(ti.ctrlsock, &m) < 0)
+		raise_error("[ERROR]: Write failed during handshake.");
+
+	printf("[INFO]: Informing server this is %s test\n", ti.t_prot == 1 ? "TCP" : "UDP");
+	printf("[INFO]: Sent data size information (%ld)\n",ti.data_info == LONG_MAX ? 0 : ti.data_info);
+	if (ti.duration > 0)
+		printf("[INFO]: Timed test of %.3f s\n", ti.duration / 1000.0);
+	printf("[INFO]: Asked server for the %s receive path\n", ti.rx_mode);
+	if (ti.engine != ENGINE_SYS)
+		printf("[INFO]: Asked server to receive with %s\n", engine_name[ti.engine]);
+	if (ti.verify)
+		printf("[INFO]: Asked server to check the payload\n");
+	if (ti.req_size > 0)
+		printf("[INFO]: Asked server to answer %d byte requests with %d bytes\n", ti.req_size, ti.resp_size);
+	if (ti.crr_size >= 0)
+		printf("[INFO]: Asked server for a connection rate test, %d bytes each way%s\n",
+			ti.crr_size, ti.fastopen ? ", TCP Fast Open" : "");
+	if (ti.direction != DIR_FORWARD)
+		printf("[INFO]: Asked server to send %s\n", ti.direction == DIR_BOTH ? "as well" : "instead");
+
+
+	/* Now the server either says it is ready and where, or why it won't run the
+	test. The server can be running many sessions at once, so every UDP test (and
+	every set of parallel streams) gets a port of its own */
+
+	if (ctrl_recv(ti.ctrlsock, &m) < 0)
+		raise_error("[ERROR]: Server not ready. Handshake failed");
+
+	if (m.type == MSG_ERROR) {
+		if (ctrl_get_str(&m, P_TEXT, why, sizeof(why)) < 0)
+			strcpy(why, "no reason given");
+		fprintf(stderr,"[ERROR]: Server refused the test: %s\n", why);
+		exit(1);
+		}
+
+	if (m.type != MSG_READY || ctrl_get(&m, P_TEST_PORT, 0) <= 0)
+		raise_error("[ERROR]: Server did not send the test port. Handshake failed");
+
+	ti.test_port = ctrl_get(&m, P_TEST_PORT, 0);
+	snprintf(ti.test_port_buf, sizeof(ti.test_port_buf), "%d", ti.test_port);
+	ti.test_port_str = ti.test_port_buf;
+	printf("[INFO]: Server ready for test\n");
+
+
+	/* Now depending on transport layer protocol to be used, we need to set
+	the test socket descriptor */
+
+	/* In case of TCP, we already have a connection. Parallel streams connect to
+	the port the server just told us about, and so does every connection of the
+	connection rate test, in run_crr() */
+	if (ti.t_prot == 1) {
+		ti.testsock = ti.ctrlsock;
+		if (ti.n_streams > 1)
+			connect_streams();
+		}
+	
+	/* For UDP, we need to create a UDP socket. The server has it bound already */
+	else if (ti.t_prot == 0) {
+
+		int ret;
+
+		ret = getaddrinfo(ti.serv_name, ti.test_port_str, &ti.test_serv, &ti.test_ptr);
+		if (ret != 0)
+			raise_error("[ERROR]: No such host for test");
+	
+		struct addrinfo * s;
+	
+		for (s = ti.test_ptr; s != NULL; s = s->ai_next) {
+
+			/* Reverse and both have their socket already, bound to the port the
+			server sends to */
+			if (ti.udp_port > 0) {
+				if (s->ai_family == ti.ctrl_ai->ai_family && connect(ti.testsock, s->ai_addr, s->ai_addrlen) == 0)
+					break;
+				continue;
+				}
+
+			/* First create a socket. Connect it, so that the route is looked
+			up once here and not for every datagram we send */
+			ti.testsock = socket(s->ai_family, s->ai_socktype, s->ai_protocol);
+			if (ti.testsock == -1)
+				continue;
+			if (connect(ti.testsock, s->ai_addr, s->ai_addrlen) == 0)
+				break;
+
+			close(ti.testsock);
+			}
+
+		if (s == NULL)
 			raise_error("[ERROR]: Could not establish test connection with server");
 		else
 			printf("[INFO]: Found the UDP test server\n");
 
+		/* The socket is connected, so the kernel can tell us the MTU of the path */
+		set_df(ti.testsock, s->ai_family);
+		ti.mtu = path_mtu(ti.testsock, s->ai_family);
+		if (ti.mtu > 0)
+			printf("[INFO]: Path MTU %d, %d byte datagrams go in %d fragment(s), DF %s\n",
+				ti.mtu, ti.msg_size, frag_count(ti.mtu, s->ai_family, ti.msg_size), df_name[ti.df]);
+
+		/* A GSO segment has to fit in one packet (see run_udp_test()) */
+		if ((ti.offload & OFFLOAD_GSO) && !ti.sweep && ti.mtu > 0 && frag_count(ti.mtu, s->ai_family, ti.msg_size) > 1) {
+			fprintf(stderr,"[ERROR]: GSO (-G gso) needs datagrams that fit the path MTU %d, -s %d or less\n",
+				ti.mtu, ti.mtu - (s->ai_family == AF_INET ? 20 : 40) - 8);
+			exit(1);
+			}
+
 		/* Else wrong t_prot */
 		}
 	else
 		raise_error("[ERROR]: Invalid transport layer protocol\n");
+	
+	return;
+	}
 
 
-	/* We are here means we got the socket 
-	Now receive "ready" from server */
 
-	bzero(buff,bsize);
-	read_ele = read(ti.ctrlsock, buff, 5);
 
-	if (read_ele <=0 || (strcmp(buff,"ready") != 0) )
-		raise_error("[ERROR]: Server not ready. Handshake failed");
-	printf("[INFO]: Server ready for test\n");
-	
-	return;
+
+/* ctrl_init: This function starts an empty control message of the given type */
+
+void ctrl_init (struct ctrl_msg * m, int type) {
+
+	m->type = type;
+	m->len = 0;
+	}
+
+
+
+
+/* ctrl_put_raw: This function appends a parameter with a value of len bytes to the
+	message. Returns -1 if it does not fit */
+
+int ctrl_put_raw (struct ctrl_msg * m, int param, const void * val, int len) {
+
+	uint16_t h[2];
+
+	if (len < 0 || m->len + sizeof(h) + len > CTRL_MAX)
+		return -1;
+
+	h[0] = htons(param);
+	h[1] = htons(len);
+	memcpy(m->body + m->len, h, sizeof(h));
+	memcpy(m->body + m->len + sizeof(h), val, len);
+	m->len += sizeof(h) + len;
+	return 0;
+	}
+
+
+
+
+/* ctrl_put: This function appends a number. Negative numbers go as their two's
+	complement, ctrl_get() brings them back */
+
+int ctrl_put (struct ctrl_msg * m, int param, long int val) {
+
+	uint64_t v = htobe64((uint64_t) val);
+
+	return ctrl_put_raw(m, param, &v, sizeof(v));
+	}
+
+
+
+
+/* ctrl_put_str: This function appends a name (or any other text) */
+
+int ctrl_put_str (struct ctrl_msg * m, int param, const char * str) {
+
+	return ctrl_put_raw(m, param, str, strlen(str));
+	}
+
+
+
+
+/* ctrl_find: This function looks for a parameter in the message. It returns where
+	its value starts and puts its length in *len, or returns NULL if it isn't there.
+	A parameter running past the end of the message ends the search */
+
+const char * ctrl_find (struct ctrl_msg * m, int param, int * len) {
+
+	uint16_t h[2];
+	uint32_t off = 0;
+
+	while (off + sizeof(h) <= m->len) {
+
+		memcpy(h, m->body + off, sizeof(h));
+		if (off + sizeof(h) + ntohs(h[1]) > m->len)
+			return NULL;
+
+		if (ntohs(h[0]) == param) {
+			*len = ntohs(h[1]);
+			return m->body + off + sizeof(h);
+			}
+		off += sizeof(h) + ntohs(h[1]);
+		}
+
+	return NULL;
+	}
+
+
+
+
+/* ctrl_get: This function returns the number in a parameter, or dflt if the message
+	doesn't have it (or it isn't a number) */
+
+long int ctrl_get (struct ctrl_msg * m, int param, long int dflt) {
+
+	const char * p;
+	uint64_t v;
+	int len;
+
+	p = ctrl_find(m, param, &len);
+	if (p == NULL || len != sizeof(v))
+		return dflt;
+
+	memcpy(&v, p, sizeof(v));
+	return (long int) be64toh(v);
+	}
+
+
+
+
+/* ctrl_get_str: This function copies the text of a parameter into str (of size bytes)
+	and terminates it. Returns -1 if it isn't there or doesn't fit */
+
+int ctrl_get_str (struct ctrl_msg * m, int param, char * str, int size) {
+
+	const char * p;
+	int len;
+
+	p = ctrl_find(m, param, &len);
+	if (p == NULL || len >= size)
+		return -1;
+
+	memcpy(str, p, len);
+	str[len] = '\0';
+	return 0;
+	}
+
+
+
+
+/* ctrl_check: This function checks a received header and sets up m for the body
+	that follows it. Returns -1 if it isn't ours, is of another version or claims a
+	body bigger than we take */
+
+int ctrl_check (struct ctrl_hdr * h, struct ctrl_msg * m) {
+
+	if (ntohs(h->magic) != CTRL_MAGIC || h->version != CTRL_VERSION || ntohl(h->len) > CTRL_MAX)
+		return -1;
+
+	m->type = h->type;
+	m->len = ntohl(h->len);
+	return 0;
+	}
+
+
+
+
+/* ctrl_send: This function sends a control message, header and body in one write()
+	as far as the socket lets us. Returns -1 if the connection failed */
+
+int ctrl_send (int sock, struct ctrl_msg * m) {
+
+	char buff[sizeof(struct ctrl_hdr) + CTRL_MAX];
+	struct ctrl_hdr h;
+	size_t total = sizeof(h) + m->len, done;
+	ssize_t n;
+
+	h.magic = htons(CTRL_MAGIC);
+	h.version = CTRL_VERSION;
+	h.type = m->type;
+	h.len = htonl(m->len);
+
+	memcpy(buff, &h, sizeof(h));
+	memcpy(buff + sizeof(h), m->body, m->len);
+
+	for (done = 0; done < total; done += n) {
+		n = write(sock, buff + done, total - done);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return -1;
+		}
+
+	return 0;
+	}
+
+
+
+
+/* ctrl_recv: This function waits for the next control message. Returns -1 if the
+	connection failed or what came isn't a message we understand */
+
+int ctrl_recv (int sock, struct ctrl_msg * m) {
+
+	struct ctrl_hdr h;
+
+	if (recv(sock, &h, sizeof(h), MSG_WAITALL) != sizeof(h) || ctrl_check(&h, m) < 0)
+		return -1;
+
+	if (m->len > 0 && recv(sock, m->body, m->len, MSG_WAITALL) != (ssize_t) m->len)
+		return -1;
+
+	return 0;
+	}
+
+
+
+
+
+
+
+
+/* connect_streams: This function opens ti.n_streams more TCP connections to the
+	address we used for the control connection, but on the test port the server
+	gave us, and splits the datasize between them. These are the test connections
+	for the parallel TCP test */
+
+void connect_streams () {
+
+	int i;
+	struct sockaddr_storage addr;
+
+	memcpy(&addr, ti.ctrl_ai->ai_addr, ti.ctrl_ai->ai_addrlen);
+	if (addr.ss_family == AF_INET)
+		((struct sockaddr_in *) &addr)->sin_port = htons(ti.test_port);
+	else
+		((struct sockaddr_in6 *) &addr)->sin6_port = htons(ti.test_port);
+
+	/* calloc() only promises 16 byte alignment, which would leave every stream
+	straddling two cache lines */
+	if (posix_memalign((void **) &ti.streams, CACHE_LINE, ti.n_streams * sizeof(struct stream_info)) != 0)
+		raise_error("[ERROR]: Could not allocate stream information");
+	memset(ti.streams, 0, ti.n_streams * sizeof(struct stream_info));
+
+	for (i = 0; i < ti.n_streams; i++) {
+
+		ti.streams[i].id = i;
+		ti.streams[i].target = ti.data_info / ti.n_streams;
+		if (i < ti.data_info % ti.n_streams)
+			ti.streams[i].target++;
+
+		ti.streams[i].sock = socket(ti.ctrl_ai->ai_family, ti.ctrl_ai->ai_socktype, ti.ctrl_ai->ai_protocol);
+		if (ti.streams[i].sock < 0)
+			raise_error("[ERROR]: Could not create socket for the stream");
+
+		if (connect(ti.streams[i].sock, (struct sockaddr *) &addr, ti.ctrl_ai->ai_addrlen) != 0)
+			raise_error("[ERROR]: Could not connect the stream to server");
+		}
+
+	printf("[INFO]: Connected %d test streams\n", ti.n_streams);
 	}
 
 
@@ -529,14 +5720,273 @@ void shake_hands () {
 
 void check_input (int c, char * v[]) {
 
+	int opt, i;
+	char * prog = v[0];
+	char * end;
+
+	ti.n_streams = 1;
+	ti.batch = 1;
+	ti.trials = 5;
+	ti.rx_mode = rx_mode_name[0];
+	ti.crr_size = -1;
+	ti.msg_size = BUFF_SIZE-1;
+	ti.threshold = REGRESSION_PCT;
+	ti.place.node_opt = -1;
+
+	/* Options come first. Whatever getopt leaves behind are the positional
+	arguments, so after this v[1] .. v[5] are addressed relative to optind */
+	while ((opt = getopt(c, v, "P:B:Z:R:G:b:i:T:O:CL:N:Frds:f:SE:o:c:A:M:I:t:Vp:H")) != -1) {
+		switch (opt) {
+			case 'P': ti.n_streams = atoi(optarg);
+					  if (ti.n_streams < 1 || ti.n_streams > MAX_STREAMS) {
+						  fprintf(stderr,"Number of streams should be between 1 and %d\n",MAX_STREAMS);
+						  exit(1);
+						  }
+					  break;
+
+			case 'B': ti.batch = atoi(optarg);
+					  if (ti.batch < 1 || ti.batch > MAX_BATCH) {
+						  fprintf(stderr,"UDP batch depth should be between 1 and %d\n",MAX_BATCH);
+						  exit(1);
+						  }
+					  break;
+
+			case 'Z': for (ti.tx_mode = TX_COPY; ti.tx_mode <= TX_SENDFILE; ti.tx_mode++)
+						  if (strcmp(optarg, tx_mode_name[ti.tx_mode]) == 0)
+							  break;
+					  if (ti.tx_mode > TX_SENDFILE) {
+						  fprintf(stderr,"Transmit path should be copy, zerocopy or sendfile\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'R': for (i = 0; rx_mode_name[i] != NULL; i++)
+						  if (strcmp(optarg, rx_mode_name[i]) == 0)
+							  break;
+					  if (rx_mode_name[i] == NULL) {
+						  fprintf(stderr,"Receive path should be copy, big or discard\n");
+						  exit(1);
+						  }
+					  ti.rx_mode = rx_mode_name[i];
+					  break;
+
+			case 'G': for (i = 0; offload_name[i] != NULL; i++)
+						  if (strcmp(optarg, offload_name[i]) == 0)
+							  break;
+					  if (offload_name[i] == NULL) {
+						  fprintf(stderr,"UDP offload should be none, gso, gro or both\n");
+						  exit(1);
+						  }
+					  ti.offload = i;
+					  break;
+
+			case 'b': ti.rate = parse_rate(optarg);
+					  if (ti.rate <= 0) {
+						  fprintf(stderr,"Invalid rate %s\n",optarg);
+						  exit(1);
+						  }
+					  break;
+
+			case 'i': ti.interval = atoi(optarg);
+					  if (ti.interval < MIN_INTERVAL) {
+						  fprintf(stderr,"The interval must be at least %d ms\n",MIN_INTERVAL);
+						  exit(1);
+						  }
+					  break;
+
+			case 'T': ti.trials = atoi(optarg);
+					  if (ti.trials < 1 || ti.trials > MAX_TRIALS) {
+						  fprintf(stderr,"Number of trials should be between 1 and %d\n",MAX_TRIALS);
+						  exit(1);
+						  }
+					  break;
+
+			case 'O': if (strcmp(optarg, "abab") == 0)
+						  ti.order_random = 0;
+					  else if (strcmp(optarg, "random") == 0)
+						  ti.order_random = 1;
+					  else {
+						  fprintf(stderr,"Trial order should be abab or random\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'C': ti.contend = 1;
+					  break;
+
+			case 'L': ti.req_size = atoi(optarg);
+					  ti.resp_size = strchr(optarg, ',') != NULL ? atoi(strchr(optarg, ',') + 1) : ti.req_size;
+					  if (ti.req_size < 1 || ti.req_size > MAX_RR_SIZE || ti.resp_size < 1 || ti.resp_size > MAX_RR_SIZE) {
+						  fprintf(stderr,"Request and response sizes should be between 1 and %d bytes\n",MAX_RR_SIZE);
+						  exit(1);
+						  }
+					  break;
+
+			case 'N': ti.crr_size = atoi(optarg);
+					  if (ti.crr_size < 0 || ti.crr_size > MAX_RR_SIZE) {
+						  fprintf(stderr,"The message of the connection rate test should be between 0 and %d bytes\n",MAX_RR_SIZE);
+						  exit(1);
+						  }
+					  break;
+
+			case 'F': ti.fastopen = 1;
+					  break;
+
+			case 'r': ti.direction = DIR_REVERSE;
+					  break;
+
+			case 'd': ti.direction = DIR_BOTH;
+					  break;
+
+			case 's': ti.msg_size = atoi(optarg);
+					  if (ti.msg_size < MIN_MSG_SIZE || ti.msg_size > MAX_MSG_SIZE) {
+						  fprintf(stderr,"Message size should be between %d and %d bytes\n",MIN_MSG_SIZE,MAX_MSG_SIZE);
+						  exit(1);
+						  }
+					  break;
+
+			case 'f': for (i = 0; df_name[i] != NULL; i++)
+						  if (strcmp(optarg, df_name[i]) == 0)
+							  break;
+					  if (df_name[i] == NULL) {
+						  fprintf(stderr,"Fragmentation mode should be kernel, do or dont\n");
+						  exit(1);
+						  }
+					  ti.df = i;
+					  break;
+
+			case 'S': ti.sweep = 1;
+					  break;
+
+			case 'E': for (i = 0; engine_name[i] != NULL; i++)
+						  if (strcmp(optarg, engine_name[i]) == 0)
+							  break;
+					  if (engine_name[i] == NULL) {
+						  fprintf(stderr,"I/O engine should be sys or uring\n");
+						  exit(1);
+						  }
+					  ti.engine = i;
+					  break;
+
+			case 'o': if (strncmp(optarg, "json:", 5) == 0)
+						  ti.out_name = optarg + 5;
+					  else if (strncmp(optarg, "csv:", 4) == 0) {
+						  ti.out_name = optarg + 4;
+						  ti.out_csv = 1;
+						  }
+					  if (ti.out_name == NULL || ti.out_name[0] == '\0') {
+						  fprintf(stderr,"Result file should be json:file or csv:file (- for stdout)\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'c': ti.base_name = optarg;
+					  if (strchr(optarg, ',') != NULL) {
+						  ti.threshold = atof(strchr(optarg, ',') + 1);
+						  *strchr(optarg, ',') = '\0';
+						  }
+					  if (ti.threshold <= 0 || ti.base_name[0] == '\0') {
+						  fprintf(stderr,"Baseline should be file[,percent] with a percent above 0\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'A': if (strcmp(optarg, "auto") == 0)
+						  ti.place.automatic = 1;
+					  else if ((ti.place.n_cpus = parse_cpus(optarg, ti.place.cpus, MAX_PIN)) <= 0) {
+						  fprintf(stderr,"CPUs should be auto or a list like 0-3,8\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'M': ti.place.node_opt = atoi(optarg);
+					  if (ti.place.node_opt < 0 || optarg[0] < '0' || optarg[0] > '9') {
+						  fprintf(stderr,"NUMA node should be a number\n");
+						  exit(1);
+						  }
+					  break;
+
+			case 'I': ti.tcpi_interval = atoi(optarg);
+					  if (strchr(optarg, ',') != NULL)
+						  ti.tcpi_name = strchr(optarg, ',') + 1;
+					  if (ti.tcpi_interval < MIN_INTERVAL || (ti.tcpi_name != NULL && ti.tcpi_name[0] == '\0')) {
+						  fprintf(stderr,"TCP_INFO sampling should be ms[,file] with at least %d ms\n",MIN_INTERVAL);
+						  exit(1);
+						  }
+					  break;
+
+			case 't': ti.duration = atof(optarg) * 1000;
+					  if (ti.duration < 1 || ti.duration > MAX_DURATION * 1000L) {
+						  fprintf(stderr,"The test should run between 0.001 and %d seconds\n",MAX_DURATION);
+						  exit(1);
+						  }
+					  break;
+
+			case 'V': ti.verify = 1;
+					  break;
+
+			case 'p': for (i = 0; payload_name[i] != NULL; i++)
+						  if (strcmp(optarg, payload_name[i]) == 0)
+							  break;
+					  if (payload_name[i] == NULL) {
+						  fprintf(stderr,"Payload should be zeros, repeat or random\n");
+						  exit(1);
+						  }
+					  ti.payload = i;
+					  break;
+
+			case 'H': ti.huge = 1;
+					  break;
+
+			default:  c = 0;		/* Force the usage message */
+			}
+		}
+
+	c -= optind - 1;
+	v += optind - 1;
+
 	/* Not enough arguments */
 	if (c < 6) {
-		printf("Usage: %s [server] [port] [transport protocol] [network protocol] [datasize]\n\
+		printf("Usage: %s [options] [server] [port] [transport protocol] [network protocol] [datasize]\n\
 		Where\n\
-			network protocol can be 4 (ipv4) or 6 (ipv6)\n\
+			network protocol can be 4 (ipv4), 6 (ipv6) or 46 (compare both)\n\
 			transport protocol can be TCP or UDP (case sensitive)\n\
 			datasize for TCP is number of bytes\n\
-			datasize for UDP is number of messages\n",v[0]);
+			datasize for UDP is number of messages\n\
+			datasize with -L is number of transactions, with -N of connections\n\
+			datasize with -t is as much as is sent at most, 0 for no limit\n\
+		Options\n\
+			-P N	number of parallel TCP test connections (default 1)\n\
+			-B N	UDP datagrams per sendmmsg/recvmmsg (default 1)\n\
+			-Z mode	TCP transmit path: copy, zerocopy or sendfile (default copy)\n\
+			-R mode	server receive path: copy, big or discard (default copy)\n\
+			-G mode	UDP offload: none, gso, gro or both (default none)\n\
+			-b rate	UDP target rate in bits/s, K/M/G suffixes (default unpaced)\n\
+			-i ms	report progress every ms milliseconds\n\
+			-T N	trials per family when comparing (network protocol 46, default 5)\n\
+			-O order	order of the trials when comparing: abab or random (default abab)\n\
+			-C	with network protocol 46, run both at the same time instead\n\
+				(the server has to run with -D)\n\
+			-L req[,resp]	request/response test with req byte requests and resp byte\n\
+				responses (default req), shows latency percentiles\n\
+			-N bytes	TCP connection rate test, bytes each way per connection (can be 0)\n\
+			-F	use TCP Fast Open in the connection rate test\n\
+			-r	reverse, the server sends and we receive\n\
+			-d	both ways at once\n\
+			-s bytes	UDP datagram (TCP write) size (default %d)\n\
+			-f mode	DF on our datagrams: kernel, do or dont (default kernel)\n\
+			-S	UDP size sweep up to and past the path MTU\n\
+			-E engine	how the data is sent and received: sys or uring (default sys)\n\
+			-o fmt:file	append the results to file as json (one object per line) or csv\n\
+			-c file[,pct]	compare with the results in file, exit 2 if worse by pct %% (default %.0f)\n\
+			-A cpus	pin the test threads to these CPUs (like 0-3,8), auto for near the NIC\n\
+			-M node	allocate the buffers on this NUMA node\n\
+			-I ms[,file]	sample TCP_INFO on both sides every ms milliseconds, into a CSV file\n\
+			-t sec	send for sec seconds (or till datasize, if not 0)\n\
+			-V	send a pattern and have the server check every byte of it\n\
+			-p data	what we send: zeros, repeat or random (default zeros)\n\
+			-H	keep what we send in huge pages, locked in memory\n",
+			prog,BUFF_SIZE-1,REGRESSION_PCT);
 		exit(1);
 		}
 	
@@ -552,55 +6002,137 @@ void check_input (int c, char * v[]) {
 		exit(1);
 		}
 	
-	/* Network protocol as to be ipv4 or ipv6 (4/6) */
-	if (atoi(v[4]) != 4 && atoi(v[4]) != 6) {
+	/* Network protocol as to be ipv4 or ipv6 (4/6), or both of them (46) */
+	if (atoi(v[4]) != 4 && atoi(v[4]) != 6 && atoi(v[4]) != 46) {
 		fprintf(stderr,"Invalid network protocol number %d\n",atoi(v[4]));
 		exit(1);
 		}
 	
-	/* This constraint on datasize is maybe not needed */
-	if (atoi(v[5]) <= 0 || atoi(v[5]) > 100000000) {
-		fprintf(stderr,"Datasize should be between 1 byte to 100 Mb\n");
+	/* Any size that fits in 64 bits. A timed test doesn't need one */
+	errno = 0;
+	if (strtol(v[5], &end, 10) < 0 || *end != '\0' || errno != 0 || (atol(v[5]) == 0 && ti.duration == 0)) {
+		fprintf(stderr,"Datasize should be a number from 1 to %ld (0 with -t for no limit)\n",LONG_MAX);
 		exit(1);
 		}
-	}
 
+	/* Parallel streams are separate TCP connections. For UDP, there is no connection
+	to parallelize over (yet) */
+	if (ti.n_streams > 1 && strcmp(v[3],"TCP") != 0) {
+		fprintf(stderr,"Parallel streams (-P) are only supported with TCP\n");
+		exit(1);
+		}
 
+	if (ti.rate > 0 && strcmp(v[3],"UDP") != 0) {
+		fprintf(stderr,"Pacing (-b) is only supported with UDP\n");
+		exit(1);
+		}
 
+	if (ti.offload != 0 && strcmp(v[3],"UDP") != 0) {
+		fprintf(stderr,"UDP offload (-G) only makes sense with UDP\n");
+		exit(1);
+		}
 
-/* raise_error: This function is for printing a message from the program, then
-	printing the message from the system and then exit with non-zero status */
+	/* The parallel streams count in memory of their own process, which we can't
+	sample from the parent */
+	if (ti.contend && (atoi(v[4]) != 46 || ti.n_streams > 1)) {
+		fprintf(stderr,"Contention (-C) needs network protocol 46 and a single stream\n");
+		exit(1);
+		}
 
-void raise_error (const char * msg) {
+	if (ti.tx_mode != TX_COPY && strcmp(v[3],"TCP") != 0) {
+		fprintf(stderr,"The transmit path (-Z) can only be chosen for TCP\n");
+		exit(1);
+		}
 
-	perror(msg);
-	exit(1);
-	}
+	/* One transaction in flight on one connection, plain write() and send() */
+	if (ti.req_size > 0 && (ti.n_streams > 1 || ti.batch > 1 || ti.tx_mode != TX_COPY ||
+							ti.offload != 0 || ti.rate > 0 || ti.contend)) {
+		fprintf(stderr,"The request/response test (-L) can't be combined with -P, -B, -Z, -G, -b or -C\n");
+		exit(1);
+		}
 
+	if (ti.crr_size >= 0 && (strcmp(v[3],"TCP") != 0 || ti.n_streams > 1 || ti.req_size > 0 ||
+							 ti.tx_mode != TX_COPY || ti.contend)) {
+		fprintf(stderr,"The connection rate test (-N) needs TCP and can't be combined with -P, -L, -Z or -C\n");
+		exit(1);
+		}
 
+	/* With nothing to send, there is nothing to put in the SYN */
+	if (ti.fastopen && ti.crr_size < 1) {
+		fprintf(stderr,"TCP Fast Open (-F) needs a connection rate test (-N) with at least one byte\n");
+		exit(1);
+		}
 
-/* itoa: This function converts a given integer into a string. It assumes
-	that the integer will not be a negative number (which is our case).
-	NOTE: In case of 0, it will generate a C-string as "0\0". Returns the
-	length of the C-String (1 for "0\0") */
+	if (ti.direction != DIR_FORWARD && (ti.n_streams > 1 || ti.req_size > 0 || ti.crr_size >= 0 || ti.contend)) {
+		fprintf(stderr,"Reverse (-r) and both ways (-d) can't be combined with -P, -L, -N or -C\n");
+		exit(1);
+		}
 
-int itoa (long int a, char * i) {
-	
-	/* First we need to find out the length of the string to be. This has to
-	be recursive */
-	
-	long int d = 10;
-	int len;
+	/* The server sends the way we would, with -b, -B and GSO. GRO is for the server's
+	receiving, and in reverse it doesn't receive */
+	if (ti.direction == DIR_REVERSE && (ti.offload & OFFLOAD_GRO)) {
+		fprintf(stderr,"GRO (-G gro or both) is for the server's receiving, there is none with -r\n");
+		exit(1);
+		}
+
+	/* The sweep sets the size itself, and it runs every size as a plain UDP test */
+	if (ti.sweep && (strcmp(v[3],"UDP") != 0 || ti.req_size > 0 || ti.contend || ti.direction != DIR_FORWARD)) {
+		fprintf(stderr,"The size sweep (-S) needs UDP and can't be combined with -L, -C, -r or -d\n");
+		exit(1);
+		}
+
+	if (ti.df != DF_KERNEL && strcmp(v[3],"UDP") != 0) {
+		fprintf(stderr,"Fragmentation (-f) only makes sense with UDP\n");
+		exit(1);
+		}
+
+	/* io_uring replaces the plain send loops of one TCP connection and of unbatched,
+	unsegmented UDP. The server receives into buffers it hands the kernel in advance,
+	so there is no discarding and no GRO */
+	if (ti.engine == ENGINE_URING && (ti.n_streams > 1 || ti.batch > 1 || ti.tx_mode != TX_COPY || ti.offload != 0 ||
+									  strcmp(ti.rx_mode, "discard") == 0 || ti.req_size > 0 || ti.crr_size >= 0 ||
+									  ti.direction == DIR_REVERSE)) {
+		fprintf(stderr,"The io_uring engine (-E) can't be combined with -P, -B, -Z, -G, -R discard, -L, -N or -r\n");
+		exit(1);
+		}
+
+	/* The connection rate test has no connection that lives long enough to sample */
+	if (ti.tcpi_interval > 0 && (strcmp(v[3],"TCP") != 0 || ti.crr_size >= 0)) {
+		fprintf(stderr,"TCP_INFO sampling (-I) needs TCP and can't be combined with -N\n");
+		exit(1);
+		}
 
-	for (len = 0; a/d > 0; len++, d *= 10);
+	/* Only our sending is timed. The round trips and connections are counted, and
+	the sweep runs every size for the same number of datagrams */
+	if (ti.duration > 0 && (ti.req_size > 0 || ti.crr_size >= 0 || ti.direction != DIR_FORWARD || ti.sweep)) {
+		fprintf(stderr,"A timed test (-t) can't be combined with -L, -N, -r, -d or -S\n");
+		exit(1);
+		}
 
-	i[len+1] = '\0';
+	/* The pattern goes with the offset in the stream. Only a plain write() of our
+	own buffer sends it in order, and the server needs the data in user space */
+	if (ti.verify && (ti.req_size > 0 || ti.crr_size >= 0 || ti.direction != DIR_FORWARD || ti.tx_mode != TX_COPY ||
+					  ti.engine != ENGINE_SYS || strcmp(ti.rx_mode, "discard") == 0)) {
+		fprintf(stderr,"The payload check (-V) can't be combined with -L, -N, -r, -d, -Z, -E or -R discard\n");
+		exit(1);
+		}
 
-	for (d = len; d >= 0; d--) {
-		i[d] = '0' + (a % 10);
-		a /= 10;
+	/* ... and it is all that is sent then */
+	if (ti.verify && ti.payload != PAYLOAD_ZEROS) {
+		fprintf(stderr,"The payload check (-V) sends a pattern of its own, it can't be combined with -p\n");
+		exit(1);
 		}
+	}
+
+
 
-	return len;
+
+/* raise_error: This function is for printing a message from the program, then
+	printing the message from the system and then exit with non-zero status */
+
+void raise_error (const char * msg) {
+
+	perror(msg);
+	exit(1);
 	}
 
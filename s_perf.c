@@ -2,80 +2,708 @@
 
 	This is the server part of the performance measurement tool
 
-	Server listens on a port using TCP socket and waits for client to connect.
-	The TCP port is according to the network protocol specified. After the client
+	Server listens on a port using TCP socket and waits for clients to connect.
+	The TCP port is according to the network protocol specified. After a client
 	connects, the server and the client program do handshake from which server
 	learns how much data will the client send, what transport layer protocol to use.
-	If transport layer protocol is UDP, server opens a new UDP socket on same port
-	number where he is listening. For TCP, it just uses the same connection. 
-	After this, the test is performed on appropriate connection and then the server
-	sends the information to client which includes when it received the last data
-	chunk and the total data it received.
-
-	Usage: ./s_perf [port] [network protocol] 
-
-		Where 
-			network protocol can be 4 (ipv4) or 6 (ipv6)
-	
-	NOTE: The assumption is that NTP daemon is running on both client and server
-	machine to keep the clocks in sync
+	If transport layer protocol is UDP, server opens a new UDP socket on a port
+	picked by the kernel and tells the client about it. For TCP, it just uses the
+	same connection (or, with parallel streams, a listening socket on a port picked
+	by the kernel). After this, the test is performed on appropriate connection and
+	then the server sends the information to client which includes when it received
+	the last data chunk, the total data it received and how long it took from the
+	first to the last chunk by its own (monotonic) clock.
+
+	The listening socket and all the handshakes are driven by one epoll loop with
+	non-blocking sockets, so a slow client can not hold up the others. Once the
+	handshake of a session is over, its test runs in a thread of its own. In daemon
+	mode (-D) the server keeps doing this forever, otherwise it exits after the first
+	test is done.
+
+	Instead of a transfer, the client can ask for a request/response test. Then we
+	answer every request with a response of the size the client asked for, over the
+	TCP connection or the UDP test socket, and the client times the round trips.
+	Or a connection rate test: the client opens connection after connection to a
+	port of the session, we answer its message on each (if it has one) and close.
+
+	The data can also go the other way (reverse), with us sending and the client
+	receiving, or both ways at once (both), with our sending in a thread of its own
+	next to the receiving. Then the result also says what we sent and how long it
+	took by our clock.
+
+	The client can also ask us to receive with io_uring instead of read() or
+	recvmmsg(): one multishot recv stays armed on the test socket and fills the
+	buffers we hand the kernel, so one system call collects many chunks.
+
+	Every session counts what the test cost us: CPU time and context switches of
+	all its threads and, where the CPU lets us (perf_event_open), cycles,
+	instructions and cache misses. That goes to the client with the result. So
+	do the TCP_INFO samples of the test connections, if the client asks for them.
+
+	With a payload check, the client sends a pattern seeded for every connection
+	(and the UDP test) by the offset in it, and we compare every byte we receive
+	with what it should be. The bytes that were off go back with the result.
+
+	The client may time its test rather than give a size. Then we don't know how
+	much is coming and receive till it tells us it is done: over TCP it closes its
+	side of the connection, for UDP it sends a message on the control connection.
+
+	What we send comes out of one pool of POOL_SIZE bytes, set up before the first
+	session and only read after that: zeros, a repeating pattern or random data
+	(-p), in huge pages if we can get them (-H). Every sender walks through it chunk
+	after chunk.
+
+	Usage: ./s_perf [options] [port] [network protocol]
+
+		Where
+			network protocol can be 4 (ipv4), 6 (ipv6) or 46 (both on
+			the same port, each session runs over the family the client
+			connected with)
+
+		Options
+			-D		daemon mode. Keep serving sessions instead of exiting
+					after the first one
+			-i ms	print throughput (and for UDP, packets and loss) of
+					every session every ms milliseconds while it runs
+			-A cpus	pin the threads of every session to these CPUs (a
+					list like 0-3,8, thread after thread). auto picks the
+					CPUs of the NIC's NUMA node that don't take its
+					interrupts, for every session by the NIC it came in on.
+					Sessions running at the same time (-D) start further
+					down the list, and share CPUs once it runs out
+			-M node	allocate the buffers of the sessions from this NUMA
+					node (with -A auto, the NIC's node unless given)
+			-p data	what we send when the data goes our way: zeros,
+					repeat (0 to 255 over and over) or random (default
+					zeros)
+			-H		keep what we send in huge pages (or transparent ones),
+					locked in memory
+
+	NOTE: The end timestamp only means something to the client if NTP keeps the
+	clocks of both machines in sync. The receive duration does not depend on that
 
 */
 
 
 
+#define _GNU_SOURCE			// sendmmsg(), recvmmsg() and friends
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/tcp.h>		// the struct tcp_info with all the fields, glibc's is older
 #include <netdb.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <dirent.h>
+#include <ifaddrs.h>
 
 
 
 
 #define BUFF_SIZE 3000		// size of the buffer
+#define MAX_STREAMS 128		// upper limit on parallel test connections
+#define MAX_BATCH 1024		// upper limit on UDP batch depth, same as UIO_MAXIOV
+#define UDP_START_WAIT 10	// seconds to wait for the first datagram of a UDP test
+#define PAT_STEP 0x9e3779b97f4a7c15ULL	// payload pattern (-V), odd so it takes 2^64 words to repeat
+#define PAT_LANES 4			// ... made and checked so many words at a time
+#define HUGE_PAGE (2 << 20)	// size of a (transparent) huge page
+#define POOL_SIZE (2 * HUGE_PAGE)	// the payload the senders walk through, bigger than any compression window
+#define CACHE_LINE 64		// keep per-stream counters on separate cache lines
+#define MAX_EVENTS 64		// epoll events handled per wakeup
+#define ACCEPT_TIMEOUT 10	// seconds to wait for the parallel streams to connect
+#define DRAIN_WAIT 2000		// ms to wait for the client to close after the results
+#define BIG_BUFF_SIZE (1 << 18)	// reusable buffer of the "big" receive path
+#define MAX_DGRAM 65536		// largest UDP datagram, per message buffer of the "big" path
+#define TRUNC_LEN 64		// bytes of each datagram the "discard" path still copies
+#define PIPE_SIZE (1 << 20)	// pipe the "discard" path splices TCP data through
+#define SEQ_WINDOW (1 << 16)	// sequence numbers remembered for duplicate detection
+#define GSO_MAX_SEGS 64		// kernel limit on segments per UDP_SEGMENT send (UDP_MAX_SEGMENTS)
+#define GSO_MAX_SIZE 65000	// ... and the payload of one super-datagram has to fit in an IP packet
+#define PACING_SPIN_NS 50000	// below this, we spin instead of sleeping till a datagram is due
+#define NOBUFS_WAIT_NS 100000	// how long we give a full qdisc before sending again
+#define MIN_INTERVAL 10		// shortest reporting interval in ms
+#define MIN_MSG_SIZE 24		// smallest datagram, it has to hold struct dgram_hdr
+#define MAX_RR_SIZE 65507	// largest request or response, what fits in a UDP datagram
+#define RR_IDLE 2			// seconds without a request that end a UDP request/response test
+#define TFO_QLEN 1024		// Fast Open requests that may wait for accept() (connection rate test)
+#define URING_BUFS 64		// receive buffers the io_uring engine keeps handed to the kernel (a power of 2)
+#define URING_RECV 1		// user_data of the multishot recv ...
+#define URING_CANCEL 2		// ... and of the request that cancels it
+#define MAX_PIN 256			// CPUs the test threads are spread over (-A)
+#define MAX_TCPI 100000		// TCP_INFO samples we keep per session (for the client's -I)
 
 
 
+/* Receive paths, picked per test by the client */
 
-struct test_info {
+enum rx_mode {
+	RX_COPY,						/* read() into a BUFF_SIZE buffer, like we always did */
+	RX_BIG,							/* read() into one big reusable buffer, fewer syscalls */
+	RX_DISCARD						/* TCP: splice() to /dev/null, UDP: MSG_TRUNC, no copy at all */
+	};
 
-    /* First is the generic info about port numbers and ctrl and test port
-	addresses etc */
-	int ctrl_port;
-	int test_port;
+static const char * rx_mode_name[] = { "copy", "big", "discard" };
 
-	/* We need two types of address structures. One for ipv4 and other for ipv6 */
-	struct sockaddr_in ctrl4, test4, cli4;
-	struct sockaddr_in6 ctrl6, test6, cli6;
-	struct sockaddr * ctrl_addr;    /* pointer to server ctrl address */
-	struct sockaddr * test_addr;    /* pointer to server test address */
-	struct sockaddr * cli_addr;     /* pointer to client address */
-	int addr_size;                  /* size of the address structure */
+/* UDP segmentation offload the client uses. GRO is for our receiving, GSO for
+	our sending when the data goes the other way */
+
+static const char * offload_name[] = { "none", "gso", "gro", "both", NULL };
+
+#define OFFLOAD_GSO 1
+#define OFFLOAD_GRO 2
+#define OFFLOAD_BOTH 3
+
+/* How the test data is taken from the kernel, picked per test by the client */
+
+enum engine {
+	ENGINE_SYS,						/* One system call per read() or recvmmsg() */
+	ENGINE_URING					/* io_uring, one multishot recv that keeps filling our buffers */
+	};
+
+static const char * engine_name[] = { "sys", "uring" };
+
+
+
+/* Every UDP datagram starts with this header, in network byte order. It has to
+	stay the same as in c_perf.c */
+
+struct dgram_hdr {
+
+	uint64_t seq;					/* 0, 1, 2 ... in the order the client sent them */
+	uint64_t sec;					/* Client's CLOCK_REALTIME when it sent the datagram */
+	uint32_t nsec;
+	uint32_t pad;
+	} __attribute__((packed));
+
+
+
+/* What we make of the sequence numbers of a UDP test. Everything is O(1) per
+	datagram. To tell a duplicate from a late datagram we remember which of the last
+	SEQ_WINDOW sequence numbers we have seen, one bit each in a ring. Anything older
+	than that is counted as reordered; at that point it hardly matters.
+
+	Jitter is the RFC 3550 interarrival jitter. It only needs the difference of the
+	transit times of consecutive datagrams, so the offset between the client's and
+	our clock cancels out */
+
+struct seq_stats {
+
+	uint64_t next;					/* Highest sequence number seen + 1 */
+	uint64_t unique;				/* Distinct datagrams */
+	uint64_t duplicates;			/* Seen that one already */
+	uint64_t reordered;				/* Came after a datagram with a higher number */
+	uint64_t max_reorder;			/* ... and how far back it was, at most */
+	double jitter;					/* In nanoseconds */
+	int64_t last_transit;
+	int have_transit;
+	uint64_t seen[SEQ_WINDOW / 64];	/* Bit (seq % SEQ_WINDOW) for seq in [next - SEQ_WINDOW, next) */
+	};
+
+
+
+/* One TCP_INFO sample of a test connection. They go to the client with every field
+	in network byte order. It has to stay the same as in c_perf.c */
+
+struct tcpi_sample {
+
+	uint64_t t;						/* us since the test started */
+	uint64_t stream;				/* Which connection of the test */
+	uint64_t cwnd;					/* Congestion window (segments) */
+	uint64_t srtt, rttvar;			/* Smoothed round trip time and its variation (us) */
+	uint64_t retrans;				/* Segments retransmitted so far */
+	uint64_t pacing_rate, delivery_rate;	/* Bytes per second */
+	uint64_t busy;					/* Time so far with data in flight (us) ... */
+	uint64_t rwnd_limited;			/* ... held up by the receive window ... */
+	uint64_t sndbuf_limited;		/* ... or by the send buffer */
+	} __attribute__((packed));
+
+#define TCPI_FIELDS (sizeof(struct tcpi_sample) / sizeof(uint64_t))
+
+/* The samples of a session */
+
+struct tcpi_series {
+
+	struct tcpi_sample * s;
+	int n;
+	int size;						/* Room for so many before we realloc() */
+	};
+
+
+
+/* Every thread that reads test data keeps one of these */
+
+struct rx_state {
+
+	enum rx_mode mode;
+	char * buff;					/* Where read() puts the data in copy and big mode */
+	size_t len;						/* How much we ask for per read() */
+	int pipefd[2];					/* splice() goes socket -> pipe -> /dev/null */
+	int devnull;
+	uint64_t seed;					/* Payload pattern of the connection, 0 for no check */
+	long int pos;					/* ... where in it the next read starts */
+	long int bad_bytes, bad_reads;	/* ... and what was off so far */
+	};
+
+
+
+/* What the receive loops have done so far. The loops store their running totals
+	here (relaxed atomic stores, which are plain stores on anything we run on) and
+	the interval reporter reads them whenever it wakes up. Nobody waits on anybody.
+	With parallel streams the bytes are in the stream structures instead */
+
+struct live_counters {
+
+	long int bytes;					/* Bytes received */
+	long int packets;				/* Datagrams received, duplicates included */
+	long int unique;				/* Distinct datagrams */
+	long int expected;				/* Highest sequence number seen + 1 */
+	long int tx_bytes;				/* Bytes sent (reverse and both) */
+	};
+
+
+
+/* The interval reporter of a session. It sleeps on the condition variable so that
+	the session can wake it up (and stop it) as soon as the test is over */
+
+struct sampler {
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;			/* Waits on CLOCK_MONOTONIC */
+	int stop;
+	int running;
+	};
+
+
+
+/* A bare io_uring for the uring engine, driven with the three system calls (no
+	liburing). The rings are shared with the kernel: we fill submission entries and
+	move the tail, the kernel moves the head as it takes them. Completions go the
+	other way round. Next to that is a ring of buffers we provide: the multishot recv
+	picks one for every chunk it completes, and we give it back once we are done
+	with it. With none left, the recv ends with ENOBUFS and has to be armed again */
+
+struct uring {
+
+	int fd;
+	unsigned int * sq_khead, * sq_ktail;	/* Submission ring, shared with the kernel */
+	unsigned int * sq_array;
+	unsigned int sq_mask, sq_entries;
+	unsigned int sq_tail;					/* Entries we have filled ... */
+	unsigned int sq_submitted;				/* ... and handed over */
+	unsigned int * cq_khead, * cq_ktail;	/* Completion ring */
+	unsigned int cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_ring, * cq_ring;				/* The mappings, for uring_free() */
+	size_t sq_len, cq_len, sqes_len;
+
+	struct io_uring_buf_ring * br;			/* Provided buffer ring, URING_BUFS entries */
+	char * bufs;							/* ... of buf_len bytes each */
+	size_t buf_len;
+	unsigned short br_tail;					/* Buffers given back, published by uring_enter() */
+	int armed;								/* The multishot recv is still running */
+	long int enters, rearms;				/* io_uring_enter() calls, recvs armed again */
+	};
+
+
+
+
+/* The hardware counters we read around a test (perf_event_open), in this order */
+
+enum hw_counter { HW_CYCLES, HW_INSTRUCTIONS, HW_CACHE_MISSES, N_HW };
+
+/* What a test cost us. Every thread of the session adds its own CPU time and context
+	switches when it is done (cpu_add()), the counters count them all at once */
+
+struct cpu_cost {
+
+	long int user, sys;				/* CPU time (us) */
+	long int vcsw, ivcsw;			/* Voluntary and involuntary context switches */
+	long int hw[N_HW];				/* -1 for a counter we did not get */
+	int user_only;					/* The counters left the kernel out (perf_event_paranoid) */
+	int hw_error;					/* errno when we got no counters at all */
+	long int bytes;					/* What the CPU time went into: bytes received and sent ... */
+	long int packets;				/* ... in so many datagrams (segments, transactions, connections) */
+	};
+
+
+
+/* Where the test threads of a session run and where their memory comes from (-A,
+	-M). Thread k of a session runs on cpus[(base + k) % n_cpus], where base keeps
+	sessions running at the same time apart */
+
+struct placement {
+
+	int cpus[MAX_PIN];
+	int n_cpus;						/* 0 leaves it to the scheduler */
+	int base;						/* Thread 0 goes on the base'th CPU */
+	int slot;						/* The session's bit in si.slots, -1 for none */
+	int automatic;					/* -A auto, place_auto() picks the CPUs for every session */
+	int node_opt;					/* NUMA node of -M, -1 for none */
+	int node;						/* ... or the NIC's with -A auto */
+	cpu_set_t allowed;				/* What we may run on at all */
+	char why[192];					/* How auto came to its choice */
+	char desc[320];					/* What we chose, for the report */
+	};
+
+
+
+/* One of these for every parallel test connection. Each stream is read by its
+	own thread which keeps bumping the counter, so the structure is aligned (and
+	padded) to a cache line to keep the threads from sharing it */
+
+struct stream_info {
+
+	long int received;				/* Bytes read on this stream so far */
+	struct timespec first, last;	/* CLOCK_MONOTONIC of the first and last read with data */
+	int sock;						/* Socket descriptor of this test connection */
+	int id;							/* Stream number (for reporting) */
+	pthread_t thread;				/* Thread reading this stream */
+	enum rx_mode rx_mode;			/* Receive path of the session */
+	struct cpu_cost * cpu;			/* ... and where its CPU time goes */
+	struct test_info * t;			/* The session, for pin_thread() */
+	} __attribute__((aligned(CACHE_LINE)));
+
+
+
+
+/* The control protocol. Every message on the control connection is a header and
+	then len bytes of parameters. A parameter is a 2 byte type, a 2 byte length and
+	the value: numbers are 8 bytes, names are plain strings without the '\0'. All in
+	network byte order. Parameters nobody knows about are skipped, so either side can
+	learn new ones without breaking the other; anything else bumps CTRL_VERSION.
+	It has to stay the same as in c_perf.c */
+
+#define CTRL_MAGIC 0x6970		// "ip"
+#define CTRL_VERSION 1
+#define CTRL_MAX 4096			// largest message body
+
+enum ctrl_type {
+	MSG_HELLO = 1,					/* Client: this is the test I want to run */
+	MSG_READY,						/* Server: all set up, go (P_TEST_PORT) */
+	MSG_RESULT,						/* Server: what we received */
+	MSG_ERROR,						/* Server: refused, P_TEXT says why */
+	MSG_SAMPLES,					/* Server: TCP_INFO samples (P_SAMPLES), before the result */
+	MSG_END							/* Client: done sending a timed UDP test (P_SENT_PKTS) */
+	};
+
+enum ctrl_param {
+	P_PROTO = 1,					/* Hello: TCP = 1, UDP = 0 */
+	P_SIZE,							/* Hello: bytes (TCP) or datagrams (UDP) */
+	P_STREAMS,						/* Hello: parallel TCP streams */
+	P_BATCH,						/* Hello: UDP batch depth */
+	P_OFFLOAD,						/* Hello: UDP offload, index into offload_name */
+	P_RXMODE,						/* Hello: receive path, by name */
+	P_TEST_PORT,					/* Ready: where the test runs */
+	P_END_SEC,						/* Result: CLOCK_REALTIME of the last chunk */
+	P_END_NSEC,
+	P_RECEIVED,						/* Result: bytes */
+	P_RX_TIME,						/* Result: first to last chunk, ns */
+	P_UNIQUE,						/* Result, UDP: struct seq_stats */
+	P_DUPLICATES,
+	P_REORDERED,
+	P_MAX_REORDER,
+	P_HIGHEST,
+	P_JITTER,						/* Result, UDP: ns */
+	P_TEXT,							/* Error: what went wrong */
+	P_REQ_SIZE,						/* Hello: request/response test, bytes per request */
+	P_RESP_SIZE,					/* Hello: ... and per response */
+	P_CRR_SIZE,						/* Hello: connection rate test, bytes each way per connection */
+	P_FASTOPEN,						/* Hello: ... with TCP Fast Open */
+	P_CONNS,						/* Result, connection rate: connections accepted */
+	P_TFO_CONNS,					/* Result, connection rate: ... with data in the SYN */
+	P_DIRECTION,					/* Hello: enum direction */
+	P_UDP_PORT,						/* Hello: where the client receives UDP (reverse and both) */
+	P_SENT,							/* Result: bytes we sent (reverse and both) */
+	P_SENT_PKTS,					/* Result: ... in so many datagrams */
+	P_TX_TIME,						/* Result: first to last send, ns */
+	P_MSG_SIZE,						/* Hello: bytes per datagram */
+	P_ENGINE,						/* Hello: enum engine */
+	P_CPU_USER,						/* Result: our struct cpu_cost, times in us */
+	P_CPU_SYS,
+	P_VCSW,
+	P_IVCSW,
+	P_CYCLES,
+	P_INSTRUCTIONS,
+	P_CACHE_MISSES,
+	P_HW_USER_ONLY,
+	P_HW_ERROR,
+	P_CPU_BYTES,
+	P_CPU_PACKETS,
+	P_PLACEMENT,					/* Result: where we ran the test */
+	P_TCPI_INTERVAL,				/* Hello: sample TCP_INFO every so many ms */
+	P_SAMPLES,						/* Samples: struct tcpi_sample, as many as fit */
+	P_DURATION,						/* Hello: timed test, ms. The size (0 for none) is only a cap */
+	P_VERIFY,						/* Hello: seed of the payload pattern, to be checked (-V) */
+	P_CHECKED,						/* Result: payload bytes checked ... */
+	P_CORRUPT_BYTES,				/* ... how many of them were not what was sent ... */
+	P_CORRUPT_CHUNKS,				/* ... and in how many reads (datagrams) */
+	P_RATE							/* Hello: UDP target rate (bits/s) of whoever sends */
+	};
+
+/* Which way the data goes */
+
+enum direction {
+	DIR_FORWARD,					/* Client to server, the usual */
+	DIR_REVERSE,					/* Server to client */
+	DIR_BOTH						/* Both at once */
+	};
+
+static const char * direction_name[] = { "forward", "reverse", "both" };
+
+/* What the data we send (reverse, both) is made of (-p) */
+
+enum payload {
+	PAYLOAD_ZEROS,					/* What we always sent */
+	PAYLOAD_REPEAT,					/* 0, 1 ... 255, over and over */
+	PAYLOAD_RANDOM					/* A PRNG's, as good as incompressible */
+	};
+
+static const char * payload_name[] = { "zeros", "repeat", "random", NULL };
+
+struct ctrl_hdr {
+
+	uint16_t magic;
+	uint8_t version;
+	uint8_t type;					/* enum ctrl_type */
+	uint32_t len;					/* Bytes of parameters after the header */
+	} __attribute__((packed));
+
+struct ctrl_msg {
+
+	int type;
+	uint32_t len;
+	char body[CTRL_MAX];
+	};
+
+
+
+
+/* Everything about one client session. There can be many of these at a time,
+	so nothing test specific is kept in globals anymore */
 
-	/* These two are the socket descriptors */
+struct test_info {
+
+	int id;							/* Session number (for reporting) */
+	struct family_info * fam;		/* The family the client came in on */
+	int test_port;					/* Port on which test will be run */
+
+	/* These are the socket descriptors */
 	int testsock;
 	int ctrlsock;
+	int streamsock;					/* Parallel streams (and the connection rate test) connect to this one */
 
 	/* These are test parameters */
-	int n_prot;						/* This is network protocol */
-	int domain;						/* AF_INET or AF_INET6 */
 	int t_prot;						/* Transport protocol (TCP = 1, UDP = 0) */
 	long int data_info;				/* Data to be transfered (bytes/packets) */
-	} ti;
+	long int duration;				/* Timed test: ms, 0 for none. It ends when the client says so */
+	uint64_t seed;					/* Check the payload against the pattern with this seed, 0 for no */
+	long int checked;				/* Payload bytes checked ... */
+	long int corrupt_bytes;			/* ... how many of them were off ... */
+	long int corrupt_chunks;		/* ... in how many reads (datagrams) */
+	int n_streams;					/* Number of parallel TCP test connections */
+	struct stream_info * streams;	/* Per stream state, n_streams of them */
+	int batch;						/* UDP datagrams per recvmmsg() (and sendmmsg() when we send) */
+	enum rx_mode rx_mode;			/* How we receive (and throw away) the data */
+	int offload;					/* UDP offload, index into offload_name */
+	double rate;					/* Pace the UDP datagrams we send at this many bits/s, 0 for no */
+	struct seq_stats * ss;			/* Sequence number statistics of the UDP test */
+	int req_size;					/* Request/response test: bytes per request, 0 for a transfer */
+	int resp_size;					/* ... and per response */
+	int crr_size;					/* Connection rate test: bytes each way, -1 for none */
+	int fastopen;					/* ... with TCP Fast Open on the stream socket */
+	long int conns, tfo_conns;		/* Connections accepted, with data in the SYN */
+	int msg_size;					/* Bytes per datagram (and per write when we send TCP) */
+	enum engine engine;				/* How we receive */
+	enum direction direction;		/* Which way the data goes */
+	int udp_port;					/* Client's UDP port, when we send UDP to it */
+	pthread_t tx_thread;			/* Thread sending to the client (reverse and both) */
+	int tx_running;
+	long int tx_sent, tx_pkts;		/* What it sent ... */
+	long int tx_time;				/* ... and how long that took (ns) */
+	struct live_counters live;		/* Progress of the test, for the interval reports */
+	struct timespec rx_first;		/* CLOCK_MONOTONIC when the first data came in ... */
+	struct timespec rx_last;		/* ... and the last */
+	struct sampler smp;
+	struct cpu_cost cpu;			/* What the test cost us */
+	int hw_fd[N_HW];				/* Its hardware counters while they run, -1 when closed */
+	struct placement place;			/* Where it ran */
+	int tcpi_interval;				/* Sample TCP_INFO every so many ms, 0 for never */
+	struct sampler tcpi_smp;		/* The thread taking the samples */
+	struct timespec tcpi_t0;		/* CLOCK_MONOTONIC the samples count from */
+	struct tcpi_series tcpi;
+
+	/* Handshake progress. The hello may arrive in pieces, we keep what we have */
+	char hbuf[sizeof(struct ctrl_hdr) + CTRL_MAX];
+	int hlen;						/* How much of it we have */
+	int hneed;						/* ... and how much we need, once we know */
+
+	pthread_t thread;				/* Thread running the test */
+	};
+
+
+
+
+/* Everything about listening on one network protocol. The addresses and the
+	listening socket are shared by all the sessions of that family */
+
+struct family_info {
+
+	int n_prot;						/* 4 or 6 */
+	int domain;						/* AF_INET or AF_INET6 */
+
+	/* We need two types of address structures. One for ipv4 and other for ipv6 */
+	struct sockaddr_in ctrl4, test4;
+	struct sockaddr_in6 ctrl6, test6;
+	struct sockaddr * ctrl_addr;    /* pointer to server ctrl address */
+	struct sockaddr * test_addr;    /* pointer to server test address */
+	int addr_size;                  /* size of the address structure */
+
+	int servsock;					/* We listen on this one */
+	};
+
+
+
+
+/* This is the server wide information. With network protocol 46 we listen on
+	both families at once */
+
+struct server_info {
+
+    /* First is the generic info about port numbers and ctrl and test port
+	addresses etc */
+	int ctrl_port;
+
+	struct family_info fam[2];		/* ipv4 and/or ipv6, whatever we listen on */
+	int n_fam;
+
+	int epfd;						/* The epoll instance driving the handshakes */
+
+	int n_prot;						/* This is network protocol (4, 6 or 46 for both) */
+	int daemon;						/* Keep serving sessions (-D) */
+	int interval;					/* Report every this many ms, 0 for never (-i) */
+	int sessions;					/* Sessions accepted so far */
+	struct placement place;			/* CPUs and NUMA node for the sessions (-A, -M) */
+	unsigned long int slots;		/* Placement slots taken by running sessions, a bit each */
+	enum payload payload;			/* What the data we send is made of (-p) ... */
+	int huge;						/* ... in huge pages, locked in memory (-H) */
+	char * pool;					/* ... POOL_SIZE bytes of it, shared by all sessions */
+	char pool_desc[96];				/* ... and what we got */
+	int pool_node;					/* ... the NUMA node we last moved it to, -1 for none */
+	} si;
 
 
 
 void check_input (int, char * []);
-void perf_test ();
+void setup_family (struct family_info *, int);
+void open_listener (struct family_info *);
+void serve ();
+void accept_sessions (struct family_info *);
+int shake_hands (struct test_info *);
+int handle_hello (struct test_info *, struct ctrl_msg *);
+int refuse (struct test_info *, const char *);
+int setup_test (struct test_info *);
+void start_session (struct test_info *);
+void * run_session (void *);
+void close_session (struct test_info *);
+void drain_ctrl (struct test_info *);
+void session_error (struct test_info *, const char *);
+void perf_test (struct test_info *);
 void raise_error (const char *);
-void shake_hands ();
-int itoa (long int, char *);
-long int run_udp_test();
-long int run_tcp_test();
+void pool_init ();
+char * pool_next (size_t *, size_t);
+void ctrl_init (struct ctrl_msg *, int);
+int ctrl_put_raw (struct ctrl_msg *, int, const void *, int);
+int ctrl_put (struct ctrl_msg *, int, long int);
+int ctrl_put_str (struct ctrl_msg *, int, const char *);
+const char * ctrl_find (struct ctrl_msg *, int, int *);
+long int ctrl_get (struct ctrl_msg *, int, long int);
+int ctrl_get_str (struct ctrl_msg *, int, char *, int);
+int ctrl_check (struct ctrl_hdr *, struct ctrl_msg *);
+int ctrl_send (int, struct ctrl_msg *);
+int set_nonblocking (int, int);
+long int run_udp_test(struct test_info *);
+long int run_tcp_test(struct test_info *);
+long int run_parallel_tcp_test(struct test_info *);
+void * run_tcp_stream (void *);
+void seq_update (struct seq_stats *, uint64_t, int64_t);
+int rx_init (struct rx_state *, enum rx_mode);
+long int rx_read (struct rx_state *, int);
+void rx_free (struct rx_state *);
+void rx_verify (struct test_info *, struct rx_state *, int);
+void verify_add (struct test_info *, struct rx_state *);
+void udp_verify (struct test_info *, const char *, size_t, uint64_t);
+uint64_t pat_word (uint64_t, uint64_t);
+unsigned char pat_byte (uint64_t, uint64_t);
+uint64_t pat_seed (uint64_t, int);
+long int pat_check (const char *, size_t, uint64_t, uint64_t);
+void sampler_start (struct test_info *);
+void sampler_stop (struct test_info *);
+void * run_sampler (void *);
+long int run_tcp_rr (struct test_info *);
+long int run_udp_rr (struct test_info *);
+long int run_crr (struct test_info *);
+void * run_sender (void *);
+long int run_tcp_send (struct test_info *);
+long int run_udp_send (struct test_info *);
+void pace_wait (struct test_info *, struct timespec *, long int);
+long int run_tcp_uring (struct test_info *);
+long int run_udp_uring (struct test_info *);
+int client_done (struct test_info *);
+int uring_rx_init (struct uring *, int, size_t);
+void uring_rx_stop (struct uring *);
+void uring_error (struct test_info *, struct uring *, const char *);
+int uring_init (struct uring *, unsigned int);
+struct io_uring_sqe * uring_sqe (struct uring *);
+int uring_enter (struct uring *, unsigned int, int);
+struct io_uring_cqe * uring_cqe (struct uring *);
+void uring_seen (struct uring *);
+int uring_register (struct uring *, unsigned int, void *, unsigned int);
+void uring_recv (struct uring *);
+void uring_buf_put (struct uring *, int);
+void uring_free (struct uring *);
+void cpu_add (struct cpu_cost *, struct rusage *);
+void show_cpu_cost (struct test_info *);
+int tcp_mss (int);
+void hw_open (struct cpu_cost *, int *);
+void hw_read (struct cpu_cost *, int *);
+void place_test (struct test_info *);
+void place_release (struct test_info *);
+void place_auto (struct placement *, int);
+void pin_thread (struct test_info *, int);
+int bind_node (int);
+int pool_move (int);
+int parse_cpus (const char *, int *, int);
+void show_cpus (char *, int, int *, int);
+int read_line (const char *, char *, int);
+void tcpi_begin (struct test_info *);
+void tcpi_end (struct test_info *);
+void * run_tcpi (void *);
+void tcpi_add (struct tcpi_series *, int, int, long int);
+void tcpi_send (struct test_info *);
 
 
 
@@ -88,108 +716,164 @@ long int run_tcp_test();
 int main (int argc, char * argv[]) {
 
 	check_input(argc,argv);
-	
-	int servsock;					/* socket descriptors for server socket (we listen on this) */
-	int status;
-	socklen_t client_len;			/* length of client address */
+	sched_getaffinity(0, sizeof(si.place.allowed), &si.place.allowed);
 
-	int type = SOCK_STREAM;			/* Type of control connection is TCP */
-	
-	ti.ctrl_port = atoi(argv[1]);		/* Convert the port from string to number */
-	ti.n_prot = atoi(argv[2]);			/* Store the network protocol to be used */
+	int i;
+
+	/* check_input() has consumed the options. Shift argv so that the positional
+	arguments stay at argv[1] and argv[2] */
+	argv += optind - 1;
+
+	si.ctrl_port = atoi(argv[1]);		/* Convert the port from string to number */
+	si.n_prot = atoi(argv[2]);			/* Store the network protocol to be used */
+
+	/* 46 means both, on the same port. Each family gets a listening socket of its
+	own, so that a session runs over the family the client came in on, all the way */
+	if (si.n_prot == 46) {
+		setup_family(&si.fam[0], 4);
+		setup_family(&si.fam[1], 6);
+		si.n_fam = 2;
+		}
+	else {
+		setup_family(&si.fam[0], si.n_prot);
+		si.n_fam = 1;
+		}
+
+
+	/* A client going away in the middle of sending results should cost us that
+	session, not the whole server */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < si.n_fam; i++)
+		open_listener(&si.fam[i]);
+
+	/* Whatever we send comes out of the pool, set up before the first session */
+	pool_init();
+
+	serve();
+
+
+	printf("[INFO]: Terminating server\n");
+	for (i = 0; i < si.n_fam; i++)
+		close(si.fam[i].servsock);
+	exit(0);
+
+	}
+
+
+
+
+
+
+
+
+
+/* setup_family: This function fills in the addresses we listen on (and run the tests
+	on) for network protocol n_prot */
+
+void setup_family (struct family_info * f, int n_prot) {
 
 	/* We are supposed to support both ipv4 and ipv6. So depending on the protocol,
 	we will have to create different address structures and address family for the sockets.
-	
-	We have to do this for both ctrl and test socket. 
-	
+
+	We have to do this for both ctrl and test socket. The test address has port 0 so that
+	every session gets a port of its own from the kernel.
+
 	On client, the switch-case is simple because of the use of getaddrinfo().
 	I should try to use it here also. */
 
-	switch (ti.n_prot) {
-		case 4: ti.domain = AF_INET;
-				ti.ctrl_addr = (struct sockaddr *) &ti.ctrl4;
-				ti.test_addr = (struct sockaddr *) &ti.test4;
-				ti.cli_addr = (struct sockaddr *) &ti.cli4;
-				ti.addr_size = sizeof(ti.ctrl4);
+	f->n_prot = n_prot;
+
+	switch (n_prot) {
+		case 4: f->domain = AF_INET;
+				f->ctrl_addr = (struct sockaddr *) &f->ctrl4;
+				f->test_addr = (struct sockaddr *) &f->test4;
+				f->addr_size = sizeof(f->ctrl4);
 
 				/* Now we have to set the fields in address structures */
-				bzero( (char *) &ti.ctrl4, sizeof(ti.ctrl4) );
-				bzero( (char *) &ti.test4, sizeof(ti.test4) );
+				bzero( (char *) &f->ctrl4, sizeof(f->ctrl4) );
+				bzero( (char *) &f->test4, sizeof(f->test4) );
 
-				ti.ctrl4.sin_family = ti.domain;
-				ti.test4.sin_family = ti.domain;
+				f->ctrl4.sin_family = f->domain;
+				f->test4.sin_family = f->domain;
 
-				ti.ctrl4.sin_addr.s_addr = INADDR_ANY;
-				ti.test4.sin_addr.s_addr = INADDR_ANY;
+				f->ctrl4.sin_addr.s_addr = INADDR_ANY;
+				f->test4.sin_addr.s_addr = INADDR_ANY;
 
-				ti.ctrl4.sin_port = htons(ti.ctrl_port);
-				ti.test4.sin_port = htons(ti.ctrl_port);
+				f->ctrl4.sin_port = htons(si.ctrl_port);
+				f->test4.sin_port = 0;
 				break;
 
-		case 6: ti.domain = AF_INET6;
-				ti.ctrl_addr = (struct sockaddr *) &ti.ctrl6;
-				ti.test_addr = (struct sockaddr *) &ti.test6;
-				ti.cli_addr = (struct sockaddr *) &ti.cli6;
-				ti.addr_size = sizeof(ti.ctrl6);
+		case 6: f->domain = AF_INET6;
+				f->ctrl_addr = (struct sockaddr *) &f->ctrl6;
+				f->test_addr = (struct sockaddr *) &f->test6;
+				f->addr_size = sizeof(f->ctrl6);
 
 				/* Now we have to set the fields in address structures */
-				bzero( (char *) &ti.ctrl6, sizeof(ti.ctrl6) );
-				bzero( (char *) &ti.test6, sizeof(ti.test6) );
+				bzero( (char *) &f->ctrl6, sizeof(f->ctrl6) );
+				bzero( (char *) &f->test6, sizeof(f->test6) );
 
-				ti.ctrl6.sin6_family = ti.domain;
-				ti.test6.sin6_family = ti.domain;
+				f->ctrl6.sin6_family = f->domain;
+				f->test6.sin6_family = f->domain;
 
-				ti.ctrl6.sin6_addr = in6addr_any;
-				ti.test6.sin6_addr = in6addr_any;
+				f->ctrl6.sin6_addr = in6addr_any;
+				f->test6.sin6_addr = in6addr_any;
 
-				ti.ctrl6.sin6_port = htons(ti.ctrl_port);
-				ti.test6.sin6_port = htons(ti.ctrl_port);
+				f->ctrl6.sin6_port = htons(si.ctrl_port);
+				f->test6.sin6_port = 0;
 
-				ti.ctrl6.sin6_scope_id = 1;		// hardcoding this irritating field
-				ti.test6.sin6_scope_id = 1;		// hardcoding this irritating field
+				f->ctrl6.sin6_scope_id = 1;		// hardcoding this irritating field
+				f->test6.sin6_scope_id = 1;		// hardcoding this irritating field
 				break;
 
 		default:
-				fprintf(stderr,"[ERROR]: Invalid protocol %d\n",ti.n_prot);
+				fprintf(stderr,"[ERROR]: Invalid protocol %d\n",n_prot);
 				exit(1);
 		}
+	}
+
+
+
+
+/* open_listener: This function creates, binds and listens on the control socket of
+	one family */
+
+void open_listener (struct family_info * f) {
+
+	int type = SOCK_STREAM;			/* Type of control connection is TCP */
+	int on = 1;
 
-	
 	/* Try to create a raw socket. This will cause the socket to exist in namespace but it
 	will not have an address yet */
 
-	servsock = socket(ti.domain, type, 0);
-	if (servsock < 0)
+	f->servsock = socket(f->domain, type, 0);
+	if (f->servsock < 0)
 		raise_error("[ERROR]: Could not create socket");
-	
 
-	/* Now we have to set all the address structure fields and then call the bind. The 
-	troublesome part of having different types of address structures with different sizes
-	should be taken care by the switch-case before this. Hence this part should be clean */
+	/* A restarted daemon should not have to wait for TIME_WAIT to clear */
+	setsockopt(f->servsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 
-	if ( bind(servsock, ti.ctrl_addr, ti.addr_size) < 0 )
-		raise_error("[ERROR]: Bind failed");
-	
+	/* When we listen on both, the ipv4 socket has the port for ipv4. Otherwise the
+	ipv6 one would take ipv4 clients too (as mapped addresses) and the bind fails */
+	if (f->domain == AF_INET6 && si.n_fam > 1 &&
+		setsockopt(f->servsock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0)
+		raise_error("[ERROR]: Could not make the ipv6 socket ipv6 only");
 
-	/* Now listen to the port and if the connection comes in, accept it */
-	listen(servsock, 5);		/* 5 connections to be enqueued */
-	client_len = sizeof(*ti.cli_addr);
 
-	ti.ctrlsock = accept(servsock, ti.cli_addr, &client_len);
-	printf("[INFO]: Established ctrl connection with client\n");
+	/* Now we have to set all the address structure fields and then call the bind. The
+	troublesome part of having different types of address structures with different sizes
+	should be taken care by setup_family(). Hence this part should be clean */
 
-	if (ti.ctrlsock < 0)
-		raise_error("[ERROR]: Accept failed");
-	
-	/* Call the function to start the tests. This function should take care of handshakes */
-	perf_test();
+	if ( bind(f->servsock, f->ctrl_addr, f->addr_size) < 0 )
+		raise_error("[ERROR]: Bind failed");
 
 
-	printf("[INFO]: Terminating server\n");
-	close(servsock);
-	exit(0);
+	/* Now listen to the port. The connections are accepted from the event loop */
+	if (listen(f->servsock, SOMAXCONN) < 0)
+		raise_error("[ERROR]: Listen failed");
 
+	if (set_nonblocking(f->servsock, 1) < 0)
+		raise_error("[ERROR]: Could not make the server socket non-blocking");
 	}
 
 
@@ -200,318 +884,449 @@ int main (int argc, char * argv[]) {
 
 
 
+/* serve: This is the event loop. The listening socket and the control connections
+	still in handshake are registered with epoll. The listening sockets are registered
+	with their family, the control connections with their session.
+	When not in daemon mode, we return once the first test is over */
 
+void serve () {
 
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct test_info * t;
+	int n, i, k, ret;
 
+	si.epfd = epoll_create1(0);
+	if (si.epfd < 0)
+		raise_error("[ERROR]: Could not create epoll instance");
 
+	for (k = 0; k < si.n_fam; k++) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = &si.fam[k];
+		if (epoll_ctl(si.epfd, EPOLL_CTL_ADD, si.fam[k].servsock, &ev) < 0)
+			raise_error("[ERROR]: Could not register the server socket");
+		}
 
+	printf("[INFO]: Waiting for clients on port %d (%s)%s\n", si.ctrl_port,
+		si.n_fam > 1 ? "ipv4 and ipv6" : si.fam[0].n_prot == 4 ? "ipv4" : "ipv6", si.daemon ? " (daemon mode)" : "");
+
+	for (;;) {
+
+		n = epoll_wait(si.epfd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			raise_error("[ERROR]: epoll_wait failed");
+			}
+
+		for (i = 0; i < n; i++) {
+
+			/* New connections on one of the listening sockets */
+			for (k = 0; k < si.n_fam && events[i].data.ptr != &si.fam[k]; k++);
+			if (k < si.n_fam) {
+				accept_sessions(&si.fam[k]);
+				continue;
+				}
+
+			/* Some more of a handshake */
+			t = (struct test_info *) events[i].data.ptr;
+			ret = shake_hands(t);
+
+			if (ret < 0)
+				close_session(t);
+			else if (ret == 1) {
+				start_session(t);
+
+				/* Outside daemon mode, we are done once this test is */
+				if (!si.daemon) {
+					pthread_join(t->thread, NULL);
+					close(si.epfd);
+					return;
+					}
+				}
+			}
+		}
+	}
 
 
 
 
 
-/* perf_test: This function first initiates the handshake with client, then it calls
-	appropriate test function. It then sends the client timestamp when we received 
-	last chunk of data and total data we received */
 
-void perf_test () {
 
-	long int received_data = 0;
-	char buff[BUFF_SIZE];
-	int stat = 0;
-	struct timespec end;
 
-	/* First we need to do initial handshake with the client.*/
-	
-	shake_hands();
 
-	/* Call the test function according to the transport layer protocol we are using */
-	if (ti.t_prot == 1)
-		received_data = run_tcp_test();
-	else if (ti.t_prot == 0)
-		received_data = run_udp_test();
-	else
-		raise_error("[ERROR]: Invalid transport layer protocol");
-	
-	/* We are here means that the last chunk of the data was received. Now we need to
-	send the server the timestamp when we received the last chunk */
+/* accept_sessions: This function accepts all the pending connections on the
+	listening socket of family f and registers each of them with epoll as a new
+	session in handshake */
 
-	clock_gettime(CLOCK_REALTIME, &end);
+void accept_sessions (struct family_info * f) {
 
-	/* Now send this as a message to the client so that it knows when the last chunk was
-	received. The sending is done by converting sec and nsec numbers into strings. 
-	Apparently, just copying the structure into buffer and sending it doesn't work. */
+	struct epoll_event ev;
+	struct test_info * t;
+	int sock, i;
 
-	int len = 0;
-	len = itoa(end.tv_sec, buff);
-	stat = write(ti.ctrlsock, buff, len+1);
-	if (stat < len+1)
-		raise_error("[ERROR]: Sending the end timestamp failed");
-	sleep(1);
+	for (;;) {
 
+		sock = accept(f->servsock, NULL, NULL);
+		if (sock < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("[ERROR]: Accept failed");
+			return;
+			}
 
-	len = itoa(end.tv_nsec, buff);
-	stat = write(ti.ctrlsock, buff, len+1);
-	if (stat < len+1)
-		raise_error("[ERROR]: Sending the end timestamp failed");
-	sleep(1);
+		t = calloc(1, sizeof(struct test_info));
+		if (t == NULL || set_nonblocking(sock, 1) < 0) {
+			perror("[ERROR]: Could not set up the session");
+			free(t);
+			close(sock);
+			continue;
+			}
 
+		t->id = ++si.sessions;
+		t->fam = f;
+		t->ctrlsock = sock;
+		t->testsock = -1;
+		t->streamsock = -1;
+		t->place.slot = -1;
+		for (i = 0; i < N_HW; i++)
+			t->hw_fd[i] = -1;
+		t->t_prot = -1;
+		t->hneed = sizeof(struct ctrl_hdr);
 
+		ev.events = EPOLLIN;
+		ev.data.ptr = t;
+		if (epoll_ctl(si.epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+			perror("[ERROR]: Could not register the session");
+			close_session(t);
+			continue;
+			}
+
+		printf("[INFO]: [%d] Established ctrl connection with client over ipv%d\n", t->id, f->n_prot);
+		}
+	}
 
-	/* And then we have to tell the client how much data we actually received */
 
-	bzero(buff, BUFF_SIZE);
-	len = itoa(received_data,buff);
-	printf("[INFO]: Received %s amount of data\n",buff);
 
-	stat = write(ti.ctrlsock, buff, len+1);
-	if (stat != len+1)
-		raise_error("[ERROR]: Sending the info about received data failed");
-	printf("[INFO]: Sent information about received data to client\n");
 
-	return;
-	}
 
 
 
 
 
+/* start_session: The handshake of this session is over. Take its control
+	connection out of the event loop, make it blocking again and run the test
+	in a thread of its own */
 
+void start_session (struct test_info * t) {
 
+	epoll_ctl(si.epfd, EPOLL_CTL_DEL, t->ctrlsock, NULL);
 
+	if (set_nonblocking(t->ctrlsock, 0) < 0) {
+		perror("[ERROR]: Could not make the control connection blocking");
+		close_session(t);
+		return;
+		}
 
+	if (pthread_create(&t->thread, NULL, run_session, t) != 0) {
+		perror("[ERROR]: Could not start the session thread");
+		close_session(t);
+		return;
+		}
 
+	/* In daemon mode nobody waits for the session */
+	if (si.daemon)
+		pthread_detach(t->thread);
+	}
 
 
-/* run_tcp_test: This function keeps on receiving the data from the client
-	till the time we have received the data expected to receive. It then
-	returns the total number of bytes received to the caller */
 
-long int run_tcp_test() {
 
-	char buff[BUFF_SIZE];
-	int stat = 0;
-	long int received = 0;
+/* run_session: This is the thread body for one session. It runs the test and
+	cleans up after it */
 
-	printf("[INFO]: Starting TCP test\n");
+void * run_session (void * arg) {
 
-	while (received < ti.data_info) {
-		bzero(buff,BUFF_SIZE);
+	struct test_info * t = (struct test_info *) arg;
 
-		stat = read(ti.testsock, buff, BUFF_SIZE-1);
-		if (stat < 0)
-			raise_error("[ERROR]: Read on the socket failed");
+	perf_test(t);
+	drain_ctrl(t);
+	printf("[INFO]: [%d] Session done\n", t->id);
 
-		received += stat;
+	/* Outside daemon mode, serve() joins us and needs the thread handle */
+	if (si.daemon)
+		close_session(t);
+	else {
+		place_release(t);
+		close(t->ctrlsock);
+		if (t->testsock >= 0 && t->testsock != t->ctrlsock)
+			close(t->testsock);
 		}
-	
-	return received;
+	return NULL;
 	}
 
 
 
 
+/* drain_ctrl: This function ends our side of the control connection once the
+	results are out and reads whatever the client still sends till it closes its
+	side (or DRAIN_WAIT ms pass without a byte). A close() with unread data sends
+	a reset, which can throw away the results before the client has read them */
 
+void drain_ctrl (struct test_info * t) {
 
+	struct pollfd pfd;
+	char buff[BUFF_SIZE];
 
+	if (shutdown(t->ctrlsock, SHUT_WR) < 0)
+		return;
 
+	pfd.fd = t->ctrlsock;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, DRAIN_WAIT) > 0 && read(t->ctrlsock, buff, sizeof(buff)) > 0)
+		;
+	}
 
-/* run_udp_test: This function is trickier than TCP. As UDP is unreliable, we
-	dont know how many messages will be dropped. We cant even rely on message
-	numbers entirely because the last message itself can be dropped causing is
-	to wait too long.
-
-	Instead, here we will wait for message to arrive for 1 sec. We will do it
-	as many number of times as we are expected to receive a message. We will 
-	maintain a count of how many datagrams we received as well as how many
-	bytes we received. Then we will return the total number of received bytes */
 
 
-long int run_udp_test() {
 
+/* close_session: This function closes all the sockets of a session and frees it.
+	Closing the control connection also takes it out of epoll */
 
-	char buff[BUFF_SIZE];
-	int stat = 0;
-	long int received = 0;
-	int count;
-	int received_packets = 0;
+void close_session (struct test_info * t) {
 
-	printf("[INFO]: Starting UDP test\n");
+	int i;
 
-	struct timeval t;
-	t.tv_sec = 1;
-	t.tv_usec = 0;
+	/* The samplers look at the sockets and the streams, they go first */
+	sampler_stop(t);
+	tcpi_end(t);
+	place_release(t);
 
-	/* Set the timeout for the socket to 1 sec. If we don't receive the message
-	in one sec, then probably the message is lost */
-	if ( setsockopt(ti.testsock, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t)) < 0)
-		raise_error("[ERROR]: Could not set timeout on the test socket");
-	
-	/* Receive messages. Note the missing error check. We dont want to exit
-	on timeout error, and adding logic to check which error occurred doesnt seem
-	so important (for now atleast) */
-	for (count = 0; count <= ti.data_info+1; count++) {
-
-		stat = 0;
-		stat = recvfrom(ti.testsock, buff, BUFF_SIZE-1, 0, NULL, NULL);
-		received += stat;
-		if (stat > 0)
-			received_packets++;
+	/* The sender may be stuck in a send to a client that is gone. Shutting the
+	sockets down gets it out */
+	if (t->tx_running) {
+		shutdown(t->ctrlsock, SHUT_RDWR);
+		if (t->testsock >= 0 && t->testsock != t->ctrlsock)
+			shutdown(t->testsock, SHUT_RDWR);
+		pthread_join(t->tx_thread, NULL);
 		}
-	
-	printf("[INFO]: Received %d packets\n", received_packets);
-	return received;
+
+	if (t->testsock >= 0 && t->testsock != t->ctrlsock)
+		close(t->testsock);
+	if (t->streamsock >= 0)
+		close(t->streamsock);
+	close(t->ctrlsock);
+
+	for (i = 0; i < N_HW; i++)
+		if (t->hw_fd[i] >= 0)
+			close(t->hw_fd[i]);
+
+	free(t->streams);
+	free(t->ss);
+	free(t->tcpi.s);
+	free(t);
 	}
 
 
 
 
+/* session_error: This is raise_error() for a session thread. A failed test should
+	not take the whole server down, so we just print the messages and end the
+	session */
 
+void session_error (struct test_info * t, const char * msg) {
 
+	fprintf(stderr, "[%d] ", t->id);
+	perror(msg);
 
+	if (si.daemon) {
+		close_session(t);
+		pthread_exit(NULL);
+		}
+	exit(1);
+	}
 
 
-/* shake_hands: This function is to do initial handshake with the client and tell us how
-	much data are we expecting.
-	This should include the following:
-		1. Receive indication that client is ready for handshake
-		2. Receive information about the transport layer protocol
-		2. Receive information about the data size
-		4*. Receive confirmation that clock is synced on client (not implemented)
-		5. Send ready indicator 
-*/
 
 
 
-void shake_hands () {
 
-	int bsize = 256;
-	int ssock;				/* Just in case we need to accept a UDP connection */
-	char buff[256];
 
-	int read_ele, wrote_ele;
-	ti.t_prot = -1;
 
 
 
 
-	/* receive "ready" from client */
-	bzero(buff,bsize);
 
-	read_ele = read(ti.ctrlsock, buff, 5);
-	if (read_ele < 0)
-		raise_error("[ERROR]: Read failed during handshake.");
-	if (strcmp(buff,"ready") != 0)
-		raise_error("[ERROR]: Handshake failed. Client not ready.");
-	
-	printf("[INFO]: Client ready for handshake\n");
 
-	
 
+/* perf_test: This function calls appropriate test function once the handshake
+	with the client is over. It then sends the client timestamp when we received
+	last chunk of data and total data we received */
 
+void perf_test (struct test_info * t) {
 
-	/* receive transport layer protocol */
-	bzero(buff,bsize);
+	long int received_data = 0;
+	long int rx_time = 0;
+	struct ctrl_msg m;
+	struct timespec end, now;
+	struct rusage ru;
+	int mss;
+
+	place_test(t);
+
+	/* The counters count the threads we start from here on as well, their CPU
+	time they add themselves. They are kept in the session, so that close_session()
+	can close them if the test fails */
+	hw_open(&t->cpu, t->hw_fd);
+	getrusage(RUSAGE_THREAD, &ru);
+
+	sampler_start(t);
+	tcpi_begin(t);
+
+	/* Our own sending, if the data goes that way too. In reverse that is all
+	there is, so we just wait for it */
+	if (t->direction != DIR_FORWARD) {
+		if (pthread_create(&t->tx_thread, NULL, run_sender, t) != 0)
+			session_error(t, "[ERROR]: Could not start the sender thread");
+		t->tx_running = 1;
+		}
 
-	read_ele = read(ti.ctrlsock, buff, 3);
-	if (read_ele < 0)
-		raise_error("[ERROR]: Read failed during handshake.");
-	
+	/* Call the test function according to the transport layer protocol we are using */
+	if (t->direction == DIR_REVERSE)
+		received_data = 0;
+	else if (t->crr_size >= 0)
+		received_data = run_crr(t);
+	else if (t->req_size > 0 && t->t_prot == 1)
+		received_data = run_tcp_rr(t);
+	else if (t->req_size > 0)
+		received_data = run_udp_rr(t);
+	else if (t->t_prot == 1 && t->n_streams > 1)
+		received_data = run_parallel_tcp_test(t);
+	else if (t->t_prot == 1)
+		received_data = run_tcp_test(t);
+	else if (t->t_prot == 0)
+		received_data = run_udp_test(t);
+	else
+		session_error(t, "[ERROR]: Invalid transport layer protocol");
 
-	/* For convinience, store the transport layer protocol as int. TCP = 1, UDP = 0 */
-	if (strcmp(buff,"TCP") == 0) {
-		printf("[INFO]: Using TCP in transport layer\n");
-		ti.t_prot = 1;
+	if (t->tx_running) {
+		pthread_join(t->tx_thread, NULL);
+		t->tx_running = 0;
 		}
-	else if (strcmp(buff,"UDP") == 0) {
-		printf("[INFO]: Using UDP in transport layer\n");
-		ti.t_prot = 0;
+
+	sampler_stop(t);
+	tcpi_end(t);
+	cpu_add(&t->cpu, &ru);
+	hw_read(&t->cpu, t->hw_fd);
+
+	/* Our threads are done. The client may start its next test as soon as it
+	has the result, and that one can have our CPUs */
+	place_release(t);
+
+	/* We are here means that the last chunk of the data was received. Now we need to
+	send the server the timestamp when we received the last chunk.
+
+	That is not now: the UDP test only ends after a second of silence, and a TCP
+	test may end with waiting for EOF. So we take the wall clock now and go back by
+	how long ago the last chunk came in, by the monotonic clock */
+
+	clock_gettime(CLOCK_REALTIME, &end);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (received_data > 0 || t->conns > 0) {
+		long int ago = (now.tv_sec - t->rx_last.tv_sec) * 1000000000L + (now.tv_nsec - t->rx_last.tv_nsec);
+		long int at = end.tv_nsec - ago % 1000000000L;
+
+		end.tv_sec -= ago / 1000000000L;
+		if (at < 0) {
+			end.tv_sec--;
+			at += 1000000000L;
+			}
+		end.tv_nsec = at;
+
+		rx_time = (t->rx_last.tv_sec - t->rx_first.tv_sec) * 1000000000L + (t->rx_last.tv_nsec - t->rx_first.tv_nsec);
 		}
-	else
-		raise_error("[ERROR]: Received invalid transport layer protocol");
-	
-
-	/* If we are using TCP in transport layer, then receive datasize string from client. 
-	This should not be more than 10 characters (we are not expecting GBs of data).
-	If we are using UDP in transport layer then receive number of messages from the client
-	*/
-
-	bzero(buff,bsize);
-
-	if (ti.t_prot == 1) {
-		
-		/* TCP */
-		read_ele = read(ti.ctrlsock, buff, 10);
-		if (read_ele < 0)
-			raise_error("[ERROR]: Read failed during handshake.");
-	
-		ti.data_info = atoi(buff);
-		if (ti.data_info <= 0)
-			raise_error("[ERROR]: Invalid datasize parameter from client.");
-		}
-	else if (ti.t_prot == 0) {
-
-		/* UDP */
-		read_ele = read(ti.ctrlsock, buff, 10);
-		if (read_ele < 0)
-			raise_error("[ERROR]: Read failed during handshake.");
-	
-		ti.data_info = atoi(buff);
-		if (ti.data_info <= 0)
-			raise_error("[ERROR]: Invalid number of packets parameter from client.");
+
+	/* Now tell the client when the last chunk was received, how much data we actually
+	received and how long that took. For UDP, also what we found out from the
+	sequence numbers. All in one message */
+
+	tcpi_send(t);
+
+	ctrl_init(&m, MSG_RESULT);
+	ctrl_put(&m, P_END_SEC, end.tv_sec);
+	ctrl_put(&m, P_END_NSEC, end.tv_nsec);
+	ctrl_put(&m, P_RECEIVED, received_data);
+	ctrl_put(&m, P_RX_TIME, rx_time);
+
+	printf("[INFO]: [%d] Received %ld amount of data in %.3f ms\n",t->id,received_data,rx_time / 1e6);
+
+	if (t->t_prot == 0 && t->ss != NULL) {
+		ctrl_put(&m, P_UNIQUE, t->ss->unique);
+		ctrl_put(&m, P_DUPLICATES, t->ss->duplicates);
+		ctrl_put(&m, P_REORDERED, t->ss->reordered);
+		ctrl_put(&m, P_MAX_REORDER, t->ss->max_reorder);
+		ctrl_put(&m, P_HIGHEST, t->ss->next);
+		ctrl_put(&m, P_JITTER, t->ss->jitter);
+
+		printf("[INFO]: [%d] UDP: %lu unique, %lu duplicates, %lu reordered (max %lu back), jitter %.3f us\n",
+			t->id, (unsigned long) t->ss->unique, (unsigned long) t->ss->duplicates,
+			(unsigned long) t->ss->reordered, (unsigned long) t->ss->max_reorder, t->ss->jitter / 1000.0);
 		}
-	else
-		raise_error("[ERROR]: Received invalid transport layer protocol");
 
-	printf("[INFO]:	Received data size information (%ld)\n",ti.data_info);
+	if (t->direction != DIR_FORWARD) {
+		ctrl_put(&m, P_SENT, t->tx_sent);
+		ctrl_put(&m, P_SENT_PKTS, t->tx_pkts);
+		ctrl_put(&m, P_TX_TIME, t->tx_time);
+		printf("[INFO]: [%d] Sent %ld amount of data in %.3f ms\n", t->id, t->tx_sent, t->tx_time / 1e6);
+		}
 
-	bzero(buff,bsize);
+	if (t->crr_size >= 0) {
+		ctrl_put(&m, P_CONNS, t->conns);
+		ctrl_put(&m, P_TFO_CONNS, t->tfo_conns);
+		}
 
-	/* Now we have to set up a test connection (if any)
-		For UDP, we will open a new socket and accept connection there. The port number will be 
-			the same port where we are listening for ctrl connection
-		For TCP, we will just continue on this socket only.
-	*/
+	/* Per family, a middlebox may only get in the way of one of them */
+	if (t->seed != 0) {
+		ctrl_put(&m, P_CHECKED, t->checked);
+		ctrl_put(&m, P_CORRUPT_BYTES, t->corrupt_bytes);
+		ctrl_put(&m, P_CORRUPT_CHUNKS, t->corrupt_chunks);
+		printf("[%s]: [%d] Payload check over ipv%d: %ld of %ld bytes corrupted, in %ld %s\n",
+			t->corrupt_bytes > 0 ? "WARNING" : "INFO", t->id, t->fam->n_prot, t->corrupt_bytes, t->checked,
+			t->corrupt_chunks, t->t_prot == 1 ? "reads" : "datagrams");
+		}
 
-	if (ti.t_prot == 1) {
+	/* What it cost us, per byte and per packet: a datagram for UDP, an MSS sized
+	segment for TCP (the control connection has the same MSS as the test), a
+	transaction or a connection */
+	t->cpu.bytes = received_data + t->tx_sent;
+	if (t->crr_size >= 0)
+		t->cpu.packets = t->conns;
+	else if (t->req_size > 0)
+		t->cpu.packets = received_data / t->req_size;
+	else if (t->t_prot == 1)
+		t->cpu.packets = (mss = tcp_mss(t->ctrlsock)) > 0 ? t->cpu.bytes / mss : 0;
+	else
+		t->cpu.packets = received_data / t->msg_size + t->tx_pkts;
+
+	ctrl_put(&m, P_CPU_USER, t->cpu.user);
+	ctrl_put(&m, P_CPU_SYS, t->cpu.sys);
+	ctrl_put(&m, P_VCSW, t->cpu.vcsw);
+	ctrl_put(&m, P_IVCSW, t->cpu.ivcsw);
+	ctrl_put(&m, P_CYCLES, t->cpu.hw[HW_CYCLES]);
+	ctrl_put(&m, P_INSTRUCTIONS, t->cpu.hw[HW_INSTRUCTIONS]);
+	ctrl_put(&m, P_CACHE_MISSES, t->cpu.hw[HW_CACHE_MISSES]);
+	ctrl_put(&m, P_HW_USER_ONLY, t->cpu.user_only);
+	ctrl_put(&m, P_HW_ERROR, t->cpu.hw_error);
+	ctrl_put(&m, P_CPU_BYTES, t->cpu.bytes);
+	ctrl_put(&m, P_CPU_PACKETS, t->cpu.packets);
+	if (t->place.automatic || t->place.n_cpus > 0 || t->place.node_opt >= 0)
+		ctrl_put_str(&m, P_PLACEMENT, t->place.desc);
+	show_cpu_cost(t);
+
+	if (ctrl_send(t->ctrlsock, &m) < 0)
+		session_error(t, "[ERROR]: Sending the results failed");
+	printf("[INFO]: [%d] Sent information about received data to client\n",t->id);
 
-		/* It is easy for TCP, we will use the same connection. So just copy the socket
-		descriptor and port number (this is actually a port number where server is listening)
-		The port number is to be used by client to check if we are setting up new server
-		to accept UDP connection */
-		ti.test_port = ti.ctrl_port;
-		ti.testsock = ti.ctrlsock;
-		printf("[INFO]: Ready for TCP test\n");
-		}
-
-	else if (ti.t_prot == 0) {
-		
-		/* For UDP, we have to create a UDP socket and bind. This is painful but important.
-		We create a UDP socket on the same port number where server is listening. This is
-		allowed because UDP and TCP sockets are different */
-		ssock = socket(ti.domain, SOCK_DGRAM, 0);
-		if (ssock < 0)
-			raise_error("[ERROR]: Could not create socket for test connection");
-
-		/* Bind with test address. This has SOCK_DGRAM type specified */
-		if ( bind(ssock, ti.test_addr, ti.addr_size) < 0 )
-			raise_error("[ERROR]: Could not bind for test connection");
-		ti.testsock = ssock;		/* set the test socket descriptor */
-
-		}
-	else 
-		raise_error("[ERROR]: Received invalid transport layer protocol");
-
-
-	bzero(buff,bsize);
-
-	/* Tell client we are ready to receive the data */
-	strcpy(buff,"ready");
-	wrote_ele = write(ti.ctrlsock, buff, 5);
-	if (wrote_ele != 5)
-		raise_error("[ERROR]: Sending the ready signal failed");
-	printf("[INFO]: Server ready for test\n");
-	
 	return;
 	}
 
@@ -524,68 +1339,3228 @@ void shake_hands () {
 
 
 
-/* check_input: This function is to check that the input to this program are proper. This
-	includes checking the number of arguments and their types */
 
 
-void check_input (int c, char * v[]) {
+/* run_tcp_test: This function keeps on receiving the data from the client
+	till the time we have received the data expected to receive. It then
+	returns the total number of bytes received to the caller */
 
-	/* Not enough args? */
-	if (c < 3) {
-		printf("Usage: %s [port] [protocol] \n\n\tWhere\n\t\tprotocol can be 4 (ipv4) or 6 (ipv6)\n",v[0]);
-		exit(1);
-		}
-	
-	/* The port number should not be special */
-	if (atoi(v[1]) < 2000) {
-		fprintf(stderr,"The input port must be greater than 2000");
-		exit(1);
-		}
-	
-	/* Network protocol has to be ipv4 or ipv6 (4/6) */
-	if (atoi(v[2]) != 4 && atoi(v[2]) != 6) {
-		fprintf(stderr,"Invalid protocol number %d\n",atoi(v[2]));
-		exit(1);
-		}
-	}
+long int run_tcp_test(struct test_info * t) {
+
+	struct rx_state rx;
+	long int stat = 0;
+	long int received = 0;
 
+	/* The io_uring engine has a loop of its own. If the kernel won't give us a
+	ring, we carry on with read() */
+	if (t->engine == ENGINE_URING && (received = run_tcp_uring(t)) >= 0)
+		return received;
+	received = 0;
 
+	printf("[INFO]: [%d] Starting TCP test\n", t->id);
 
+	if (rx_init(&rx, t->rx_mode) < 0)
+		session_error(t, "[ERROR]: Could not set up the receive path");
+	rx_verify(t, &rx, t->testsock);
 
-/* raise_error: This function is for printing a message from the program, then
-	printing the message from the system and then exit with non-zero status */
+	while (received < t->data_info) {
 
-void raise_error (const char * msg) {
+		stat = rx_read(&rx, t->testsock);
+		if (stat < 0)
+			session_error(t, "[ERROR]: Read on the socket failed");
 
-	perror(msg);
-	exit(1);
+		/* Client went away before sending everything. Don't spin on EOF */
+		if (stat == 0)
+			break;
+
+		/* A vDSO call, next to nothing compared to the read() */
+		clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+		if (received == 0)
+			t->rx_first = t->rx_last;
+
+		received += stat;
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		}
+
+	verify_add(t, &rx);
+	rx_free(&rx);
+	return received;
 	}
 
 
 
 
 
-/* itoa: This function converts a given integer into a string. It assumes
-	that the integer will not be a negative number (which is our case).
-	NOTE: In case of 0, it will generate a C-string as "0\0". Returns 
-	length of the C-string excluding the null character (1 for our example) */
 
-int itoa (long int a, char * i) {
-	
-	/* First we need to find out the length of the string to be. This has to
-	be recursive */
-	
-	long int d = 10;
-	int len;
 
-	for (len = 0; a/d > 0; len++, d *= 10);
 
-	i[len+1] = '\0';
 
-	for (d = len; d >= 0; d--) {
-		i[d] = '0' + (a % 10);
-		a /= 10;
+/* run_parallel_tcp_test: This function accepts t->n_streams test connections
+	from the client and reads all of them at once, one thread per connection.
+	Each stream is read till the client closes it. It returns the total number
+	of bytes received over all the streams.
+
+	The sockets are ours to close, after the threads are done with them. If a
+	stream can't be accepted or started, the ones that run already are shut down
+	and joined before session_error() frees the session under them */
+
+long int run_parallel_tcp_test(struct test_info * t) {
+
+	int i, k, err;
+	int socks[MAX_STREAMS];
+	long int received = 0;
+	const char * msg = NULL;
+
+	printf("[INFO]: [%d] Starting TCP test over %d streams\n", t->id, t->n_streams);
+
+	/* The client connects the streams to the session's stream socket as soon as
+	it sees our "ready", so they are probably already sitting in the backlog */
+	for (i = 0; i < t->n_streams; i++) {
+
+		t->streams[i].id = i;
+		t->streams[i].rx_mode = t->rx_mode;
+		t->streams[i].cpu = &t->cpu;
+		t->streams[i].t = t;
+		t->streams[i].sock = socks[i] = accept(t->streamsock, NULL, NULL);
+		if (socks[i] < 0) {
+			msg = "[ERROR]: Accept failed for the stream";
+			break;
+			}
+
+		if ((errno = pthread_create(&t->streams[i].thread, NULL, run_tcp_stream, &t->streams[i])) != 0) {
+			close(socks[i]);
+			t->streams[i].sock = -1;
+			msg = "[ERROR]: Could not start the stream thread";
+			break;
+			}
+		}
+
+	if (msg != NULL) {
+		err = errno;
+		for (k = 0; k < i; k++)
+			shutdown(socks[k], SHUT_RDWR);
+		for (k = 0; k < i; k++) {
+			pthread_join(t->streams[k].thread, NULL);
+			close(socks[k]);
+			}
+		errno = err;
+		session_error(t, msg);
 		}
-	return len;
+
+	/* The test ran from the first chunk on any stream to the last chunk on any */
+	for (i = 0; i < t->n_streams; i++) {
+		pthread_join(t->streams[i].thread, NULL);
+		close(socks[i]);
+		printf("[INFO]: [%d] Stream %d received %ld bytes\n", t->id, t->streams[i].id, t->streams[i].received);
+
+		if (t->streams[i].received > 0) {
+			if (received == 0 || t->streams[i].first.tv_sec < t->rx_first.tv_sec ||
+				(t->streams[i].first.tv_sec == t->rx_first.tv_sec && t->streams[i].first.tv_nsec < t->rx_first.tv_nsec))
+				t->rx_first = t->streams[i].first;
+			if (received == 0 || t->streams[i].last.tv_sec > t->rx_last.tv_sec ||
+				(t->streams[i].last.tv_sec == t->rx_last.tv_sec && t->streams[i].last.tv_nsec > t->rx_last.tv_nsec))
+				t->rx_last = t->streams[i].last;
+			}
+		received += t->streams[i].received;
+		}
+
+	return received;
 	}
 
+
+
+
+
+
+
+
+/* run_tcp_stream: This is the thread body for one parallel stream. It reads
+	till the client closes the connection (or the session shuts it down) and keeps
+	the count in the (cache line padded) stream structure */
+
+void * run_tcp_stream (void * arg) {
+
+	struct stream_info * st = (struct stream_info *) arg;
+	struct rx_state rx;
+	struct rusage ru;
+	long int stat = 0;
+	long int received = 0;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	pin_thread(st->t, st->id);
+
+	if (rx_init(&rx, st->rx_mode) < 0)
+		perror("[ERROR]: Could not set up the receive path");
+	else {
+
+		rx_verify(st->t, &rx, st->sock);
+		while ((stat = rx_read(&rx, st->sock)) > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &st->last);
+			if (received == 0)
+				st->first = st->last;
+
+			received += stat;
+			__atomic_store_n(&st->received, received, __ATOMIC_RELAXED);
+			}
+
+		if (stat < 0)
+			perror("[ERROR]: Read on the stream socket failed");
+		verify_add(st->t, &rx);
+		rx_free(&rx);
+		}
+
+	/* The TCP_INFO sampler may still be looking at it. Done is done, whatever
+	TCP_INFO says after this is not about the test */
+	__atomic_store_n(&st->sock, -1, __ATOMIC_RELAXED);
+	cpu_add(st->cpu, &ru);
+	return NULL;
+	}
+
+
+
+
+
+
+
+
+
+/* rx_init: This function sets up a TCP receive path. We used to bzero() the buffer
+	before every read(), which only cost us a memset per chunk; nobody looks at the
+	data anyway (unless the client wants it checked, see rx_verify()). Now copy
+	mode just reads into the same buffer over and over, big mode does the same with
+	a buffer large enough to take a good part of the socket buffer per call, and
+	discard mode never brings the data to user space at all. Returns -1 if
+	something could not be set up */
+
+int rx_init (struct rx_state * rx, enum rx_mode mode) {
+
+	memset(rx, 0, sizeof(*rx));
+	rx->mode = mode;
+	rx->pipefd[0] = rx->pipefd[1] = rx->devnull = -1;
+
+	if (mode == RX_DISCARD) {
+		if (pipe(rx->pipefd) < 0)
+			return -1;
+		fcntl(rx->pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);		/* Best effort, bigger is better */
+		rx->devnull = open("/dev/null", O_WRONLY);
+		return rx->devnull < 0 ? -1 : 0;
+		}
+
+	rx->len = (mode == RX_BIG) ? BIG_BUFF_SIZE : BUFF_SIZE-1;
+	rx->buff = malloc(rx->len);
+	return rx->buff == NULL ? -1 : 0;
+	}
+
+
+
+
+/* rx_read: This function takes in whatever the socket has for us with the receive
+	path of rx and throws it away. It returns the number of bytes, 0 on EOF and -1 on
+	error, just like read().
+
+	In discard mode, splice() moves the socket's pages into the pipe and then out to
+	/dev/null, without a single byte being copied to user space */
+
+long int rx_read (struct rx_state * rx, int sock) {
+
+	ssize_t n, out, drained;
+	long int bad;
+
+	if (rx->mode != RX_DISCARD) {
+		n = read(sock, rx->buff, rx->len);
+
+		/* Checking the pattern (-V) reads it once more, while it is still in the cache */
+		if (n > 0 && rx->seed != 0) {
+			bad = pat_check(rx->buff, n, rx->seed, rx->pos);
+			rx->pos += n;
+			if (bad > 0) {
+				rx->bad_bytes += bad;
+				rx->bad_reads++;
+				}
+			}
+		return n;
+		}
+
+	n = splice(sock, NULL, rx->pipefd[1], NULL, PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+	if (n <= 0)
+		return n;
+
+	for (drained = 0; drained < n; drained += out) {
+		out = splice(rx->pipefd[0], NULL, rx->devnull, NULL, n - drained, SPLICE_F_MOVE);
+		if (out <= 0)
+			return -1;
+		}
+
+	return n;
+	}
+
+
+
+
+/* rx_free: This function releases whatever rx_init() set up */
+
+void rx_free (struct rx_state * rx) {
+
+	free(rx->buff);
+	if (rx->pipefd[0] >= 0) {
+		close(rx->pipefd[0]);
+		close(rx->pipefd[1]);
+		}
+	if (rx->devnull >= 0)
+		close(rx->devnull);
+	}
+
+
+
+
+/* rx_verify: This function makes rx_read() check the payload of a TCP connection,
+	if the client asked for that. Every connection has a pattern of its own, the
+	client's port tells which */
+
+void rx_verify (struct test_info * t, struct rx_state * rx, int sock) {
+
+	struct sockaddr_storage peer;
+	socklen_t len = sizeof(peer);
+	int port = 0;
+
+	if (t->seed == 0)
+		return;
+
+	if (getpeername(sock, (struct sockaddr *) &peer, &len) == 0)
+		port = ntohs(peer.ss_family == AF_INET ? ((struct sockaddr_in *) &peer)->sin_port :
+												  ((struct sockaddr_in6 *) &peer)->sin6_port);
+	rx->seed = pat_seed(t->seed, port);
+	}
+
+
+
+
+/* verify_add: This function adds what rx_read() checked on one connection to the
+	session. Parallel streams all add theirs */
+
+void verify_add (struct test_info * t, struct rx_state * rx) {
+
+	__atomic_add_fetch(&t->checked, rx->pos, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&t->corrupt_bytes, rx->bad_bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&t->corrupt_chunks, rx->bad_reads, __ATOMIC_RELAXED);
+	}
+
+
+
+
+/* udp_verify: This function checks the payload of datagram seq (len bytes at
+	dgram, header included). The datagrams are laid end to end in the stream of the
+	UDP test, so it starts at seq * the size the client sends. A datagram of another
+	size is off as a whole */
+
+void udp_verify (struct test_info * t, const char * dgram, size_t len, uint64_t seq) {
+
+	long int bad;
+
+	if (len != (size_t) t->msg_size) {
+		t->checked += len - sizeof(struct dgram_hdr);
+		t->corrupt_bytes += len - sizeof(struct dgram_hdr);
+		t->corrupt_chunks++;
+		return;
+		}
+
+	bad = pat_check(dgram + sizeof(struct dgram_hdr), len - sizeof(struct dgram_hdr), pat_seed(t->seed, 0),
+		seq * t->msg_size + sizeof(struct dgram_hdr));
+	t->checked += len - sizeof(struct dgram_hdr);
+	if (bad > 0) {
+		t->corrupt_bytes += bad;
+		t->corrupt_chunks++;
+		}
+	}
+
+
+
+
+/* pat_word: This function is the payload pattern of a verified test (-V). Every 8
+	bytes of a stream, counted from its start, are one word of a sequence seeded for
+	that stream: seed + w * PAT_STEP, scrambled with a shift. No two words of a
+	stream are the same, so a byte that is changed, lost, duplicated or moved shows.
+	The loops step from one word to the next with an add, a shift and an xor, which
+	the CPU does for several words at once. It has to stay the same as in c_perf.c */
+
+uint64_t pat_word (uint64_t seed, uint64_t w) {
+
+	uint64_t x = seed + w * PAT_STEP;
+
+	return x ^ (x >> 29);
+	}
+
+
+
+
+/* pat_byte: This function is byte off of the pattern, the words are little endian.
+	It has to stay the same as in c_perf.c */
+
+unsigned char pat_byte (uint64_t seed, uint64_t off) {
+
+	return pat_word(seed, off / 8) >> (off % 8 * 8);
+	}
+
+
+
+
+/* pat_seed: This function gives the pattern of one stream of the test: a TCP
+	connection by the client's port, the UDP test by port 0. It has to stay the
+	same as in c_perf.c */
+
+uint64_t pat_seed (uint64_t seed, int port) {
+
+	return pat_word(seed, (uint64_t) port << 32);
+	}
+
+
+
+
+/* pat_check: This function compares len bytes at buf with the pattern of a stream
+	at offset off of it and returns how many bytes are off. Whole words are compared
+	at once, only a word that is off is looked at byte by byte */
+
+long int pat_check (const char * buf, size_t len, uint64_t seed, uint64_t off) {
+
+	uint64_t w[PAT_LANES], x[PAT_LANES], diff = 0;
+	long int bad = 0;
+	size_t i = 0, j;
+	int k;
+
+	/* The bytes up to the first whole word ... */
+	for (; i < len && (off + i) % 8 != 0; i++)
+		bad += (unsigned char) buf[i] != pat_byte(seed, off + i);
+
+	/* ... PAT_LANES words at a time, like the client makes them. No branch in
+	here; only if something was off do we go through it again, byte by byte ... */
+	for (k = 0; k < PAT_LANES; k++)
+		x[k] = seed + ((off + i) / 8 + k) * PAT_STEP;
+
+	for (j = i; j + sizeof(w) <= len; j += sizeof(w)) {
+		memcpy(w, buf + j, sizeof(w));
+		for (k = 0; k < PAT_LANES; k++) {
+			diff |= w[k] ^ htole64(x[k] ^ (x[k] >> 29));
+			x[k] += PAT_LANES * PAT_STEP;
+			}
+		}
+
+	if (diff == 0)
+		i = j;
+
+	/* ... and what is left */
+	for (; i < len; i++)
+		bad += (unsigned char) buf[i] != pat_byte(seed, off + i);
+
+	return bad;
+	}
+
+
+
+
+
+
+
+
+
+/* run_udp_test: This function is trickier than TCP. As UDP is unreliable, we
+	dont know how many messages will be dropped. We cant even rely on message
+	numbers entirely because the last message itself can be dropped causing is
+	to wait too long.
+
+	Instead, here we keep receiving till we have got as many messages as the client
+	said it will send, or till nothing arrives for 1 sec. Then probably the rest is
+	lost. (The client may take a moment to start, so we are more patient about the
+	first message. In a timed test the client may just be slow, so then silence only
+	ends it once the client has said it is done.) We maintain a count of how many
+	datagrams we received as well as how many bytes we received. Then we will return
+	the total number of received bytes. The sequence numbers in the datagram headers
+	go into t->ss.
+
+	Datagrams are taken t->batch at a time with recvmmsg(). MSG_WAITFORONE makes it
+	block only for the first of them and return whatever else is already queued.
+	The kernel stamps every message with its arrival time (SO_TIMESTAMPNS), which is
+	what the jitter is worked out from.
+
+	In copy mode every datagram is copied into a buffer of the size the client sends.
+	In big mode, the buffers can take the largest datagram there is. In discard mode
+	we only copy the first TRUNC_LEN bytes of each datagram (enough for the header)
+	and MSG_TRUNC makes the kernel still tell us how long it really was.
+
+	With GRO, the stack may hand us several datagrams of the same flow glued together
+	in one message. A control message tells us the size of the segments, from which
+	we work out how many datagrams the message really was. Each of them has its own
+	header; the ones beyond what we copied (discard mode) are taken to follow on from
+	the first one */
+
+
+long int run_udp_test(struct test_info * t) {
+
+
+	char * buff;
+	char * control;
+	int stat = 0;
+	int i, idle = 0, one = 1;
+	int flags = MSG_WAITFORONE;
+	int gro = (t->offload & OFFLOAD_GRO) != 0;
+	int seg, segs, gro_size, gro_size_seen = 0, k;
+	size_t len = t->msg_size;
+	size_t clen = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timespec));
+	long int received = 0;
+	long int received_packets = 0;
+	long int messages = 0, coalesced = 0, max_segs = 0;
+	int64_t arrival, transit = 0;
+	uint64_t seq = 0;
+	struct mmsghdr * msgs;
+	struct iovec * iov;
+	struct cmsghdr * cm;
+	struct dgram_hdr hdr;
+	struct timespec ts;
+
+	if (t->engine == ENGINE_URING && (received = run_udp_uring(t)) >= 0)
+		return received;
+	received = 0;
+
+	printf("[INFO]: [%d] Starting UDP test (batch of %d%s)\n", t->id, t->batch, gro ? ", GRO" : "");
+
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+
+	/* Set the timeout for the socket to 1 sec. If we don't receive the message
+	in one sec, then probably the message is lost */
+	if ( setsockopt(t->testsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		session_error(t, "[ERROR]: Could not set timeout on the test socket");
+
+	if (gro && setsockopt(t->testsock, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0)
+		session_error(t, "[ERROR]: Could not enable UDP_GRO on the test socket");
+
+	if (setsockopt(t->testsock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0)
+		session_error(t, "[ERROR]: Could not enable receive timestamps on the test socket");
+
+	/* A GRO message can be as big as the biggest datagram, even if the datagrams
+	in it are small */
+	if (t->rx_mode == RX_BIG || (gro && t->rx_mode == RX_COPY))
+		len = MAX_DGRAM;
+	else if (t->rx_mode == RX_DISCARD) {
+		len = TRUNC_LEN;
+		flags |= MSG_TRUNC;
+		}
+
+	/* Every message in the batch needs a buffer of its own and room for the
+	timestamp (and with GRO, segment size) control messages */
+	buff = malloc((size_t) t->batch * len);
+	msgs = calloc(t->batch, sizeof(struct mmsghdr));
+	iov = calloc(t->batch, sizeof(struct iovec));
+	control = calloc(t->batch, clen);
+	t->ss = calloc(1, sizeof(struct seq_stats));
+	if (buff == NULL || msgs == NULL || iov == NULL || control == NULL || t->ss == NULL)
+		session_error(t, "[ERROR]: Could not allocate the receive buffers");
+
+	for (i = 0; i < t->batch; i++) {
+		iov[i].iov_base = buff + (size_t) i * len;
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+	while (received_packets < t->data_info) {
+
+		/* The kernel overwrites the control length with what it used */
+		for (i = 0; i < t->batch; i++) {
+			msgs[i].msg_hdr.msg_control = control + (size_t) i * clen;
+			msgs[i].msg_hdr.msg_controllen = clen;
+			}
+
+		stat = recvmmsg(t->testsock, msgs, t->batch, flags, NULL);
+
+		if (stat < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				session_error(t, "[ERROR]: Read on the socket failed");
+
+			/* Timed out. A timed test goes on till the client says it is done */
+			if (received_packets > 0 && t->duration > 0 && !client_done(t))
+				continue;
+			if (received_packets > 0 || ++idle >= UDP_START_WAIT)
+				break;
+			continue;
+			}
+
+		/* Once per batch is close enough, they were all queued when we got here */
+		clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+		if (received_packets == 0)
+			t->rx_first = t->rx_last;
+
+		for (i = 0; i < stat; i++) {
+
+			received += msgs[i].msg_len;
+			segs = 1;
+			gro_size = msgs[i].msg_len;
+			arrival = 0;
+
+			for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+				if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+					memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+					if (seg > 0) {
+						segs = (msgs[i].msg_len + seg - 1) / seg;
+						gro_size = gro_size_seen = seg;
+						}
+					}
+				else if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+					memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+					arrival = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+					}
+				}
+
+			/* The header of every datagram in this message */
+			for (k = 0; k < segs; k++) {
+
+				if ((size_t) k * gro_size + sizeof(hdr) <= len && (size_t) k * gro_size + sizeof(hdr) <= msgs[i].msg_len) {
+					memcpy(&hdr, (char *) iov[i].iov_base + (size_t) k * gro_size, sizeof(hdr));
+					seq = be64toh(hdr.seq);
+					transit = arrival - ((int64_t) be64toh(hdr.sec) * 1000000000 + ntohl(hdr.nsec));
+					if (t->seed != 0)
+						udp_verify(t, (char *) iov[i].iov_base + (size_t) k * gro_size,
+							msgs[i].msg_len - (size_t) k * gro_size < (size_t) gro_size ? msgs[i].msg_len - (size_t) k * gro_size : (size_t) gro_size, seq);
+					}
+				else if (k > 0)
+					seq++;			/* Not copied, assume it follows on */
+				else
+					continue;		/* Too short to have a header at all */
+
+				seq_update(t->ss, seq, arrival != 0 ? transit : 0);
+				}
+
+			if (segs > 1)
+				coalesced++;
+			if (segs > max_segs)
+				max_segs = segs;
+			received_packets += segs;
+			}
+
+		messages += stat;
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.packets, received_packets, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.unique, (long int) t->ss->unique, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.expected, (long int) t->ss->next, __ATOMIC_RELAXED);
+		}
+
+	free(control);
+	free(iov);
+	free(msgs);
+	free(buff);
+
+	printf("[INFO]: [%d] Received %ld packets\n", t->id, received_packets);
+	if (gro)
+		printf("[INFO]: [%d] GRO: %ld messages for %ld packets, %ld coalesced (up to %ld segments of %d bytes)\n",
+			t->id, messages, received_packets, coalesced, max_segs, gro_size_seen);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* run_tcp_uring: This function is run_tcp_test() with io_uring. One multishot recv
+	stays armed on the socket and completes once for every chunk the kernel puts into
+	one of our provided buffers, so a single io_uring_enter() collects everything that
+	has come in since the last one. The buffers are as big as those of the receive
+	path (copy or big) and go back into the ring as soon as we have counted them.
+	It returns the bytes received, or -1 if io_uring could not be set up */
+
+long int run_tcp_uring (struct test_info * t) {
+
+	struct uring r;
+	struct io_uring_cqe * cqe;
+	size_t len = (t->rx_mode == RX_BIG) ? BIG_BUFF_SIZE : BUFF_SIZE-1;
+	long int received = 0, chunks = 0;
+	int got, eof = 0;
+
+	if (uring_rx_init(&r, t->testsock, len) < 0) {
+		fprintf(stderr, "[%d] ", t->id);
+		perror("[WARNING]: Could not set up io_uring, receiving with read() instead");
+		return -1;
+		}
+
+	printf("[INFO]: [%d] Starting TCP test over io_uring (%d buffers of %zu bytes)\n", t->id, URING_BUFS, len);
+
+	while (received < t->data_info && !eof) {
+
+		/* Out of buffers, the recv has stopped. They are back in the ring by now */
+		if (!r.armed) {
+			uring_recv(&r);
+			r.rearms++;
+			}
+
+		if (uring_enter(&r, 1, -1) < 0)
+			uring_error(t, &r, "[ERROR]: io_uring_enter failed");
+
+		for (got = 0; (cqe = uring_cqe(&r)) != NULL; uring_seen(&r)) {
+			if (cqe->user_data != URING_RECV)
+				continue;
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				r.armed = 0;
+
+			if (cqe->res > 0) {
+				uring_buf_put(&r, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+				received += cqe->res;
+				got++;
+				}
+			else if (cqe->res == 0)
+				eof = 1;			/* Client went away before sending everything */
+			else if (cqe->res != -ENOBUFS) {
+				errno = -cqe->res;
+				uring_error(t, &r, "[ERROR]: Read on the socket failed");
+				}
+			}
+
+		if (got > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+			if (chunks == 0)
+				t->rx_first = t->rx_last;
+			chunks += got;
+			}
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		}
+
+	uring_rx_stop(&r);
+	printf("[INFO]: [%d] io_uring: %ld chunks in %ld system calls, recv armed again %ld times\n",
+		t->id, chunks, r.enters, r.rearms);
+	uring_free(&r);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* run_udp_uring: This function is run_udp_test() with io_uring. Every datagram
+	completes the multishot recv once, in a provided buffer of the size the client
+	sends (big mode: the largest datagram there is). The timeout of io_uring_enter()
+	does what SO_RCVTIMEO does for recvmmsg(): a second without a datagram ends the
+	test. A plain recv does not get the kernel's receive timestamps, so the jitter is
+	worked out from when we reaped the completions, once per io_uring_enter().
+	It returns the bytes received, or -1 if io_uring could not be set up */
+
+long int run_udp_uring (struct test_info * t) {
+
+	struct uring r;
+	struct io_uring_cqe * cqe;
+	struct dgram_hdr hdr;
+	struct timespec ts;
+	size_t len = (t->rx_mode == RX_BIG) ? MAX_DGRAM : (size_t) t->msg_size;
+	long int received = 0, received_packets = 0;
+	int got, idle = 0;
+	int64_t arrival;
+
+	if (uring_rx_init(&r, t->testsock, len) < 0) {
+		fprintf(stderr, "[%d] ", t->id);
+		perror("[WARNING]: Could not set up io_uring, receiving with recvmmsg() instead");
+		return -1;
+		}
+
+	t->ss = calloc(1, sizeof(struct seq_stats));
+	if (t->ss == NULL)
+		uring_error(t, &r, "[ERROR]: Could not allocate the receive buffers");
+
+	printf("[INFO]: [%d] Starting UDP test over io_uring (%d buffers of %zu bytes)\n", t->id, URING_BUFS, len);
+
+	while (received_packets < t->data_info) {
+
+		if (!r.armed) {
+			uring_recv(&r);
+			r.rearms++;
+			}
+
+		if (uring_enter(&r, 1, 1000) < 0) {
+			if (errno != ETIME)
+				uring_error(t, &r, "[ERROR]: io_uring_enter failed");
+
+			/* Timed out */
+			if (received_packets > 0 && t->duration > 0 && !client_done(t))
+				continue;
+			if (received_packets > 0 || ++idle >= UDP_START_WAIT)
+				break;
+			continue;
+			}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		arrival = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+		for (got = 0; (cqe = uring_cqe(&r)) != NULL; uring_seen(&r)) {
+			if (cqe->user_data != URING_RECV)
+				continue;
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				r.armed = 0;
+
+			if (cqe->res > 0) {
+				int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+				if ((size_t) cqe->res >= sizeof(hdr)) {
+					memcpy(&hdr, r.bufs + (size_t) bid * r.buf_len, sizeof(hdr));
+					seq_update(t->ss, be64toh(hdr.seq),
+						arrival - ((int64_t) be64toh(hdr.sec) * 1000000000 + ntohl(hdr.nsec)));
+					}
+
+				uring_buf_put(&r, bid);
+				received += cqe->res;
+				received_packets++;
+				got++;
+				}
+			else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+				errno = -cqe->res;
+				uring_error(t, &r, "[ERROR]: Read on the socket failed");
+				}
+			}
+
+		if (got > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+			if (received_packets == got)
+				t->rx_first = t->rx_last;
+			}
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.packets, received_packets, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.unique, (long int) t->ss->unique, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.expected, (long int) t->ss->next, __ATOMIC_RELAXED);
+		}
+
+	uring_rx_stop(&r);
+	printf("[INFO]: [%d] Received %ld packets\n", t->id, received_packets);
+	printf("[INFO]: [%d] io_uring: %ld datagrams in %ld system calls, recv armed again %ld times\n",
+		t->id, received_packets, r.enters, r.rearms);
+	uring_free(&r);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* client_done: This function is for the UDP loops of a timed test, which only
+	know that nothing came in for a while. It looks (without waiting) whether the
+	client has told us on the control connection that it is done. A client that is
+	gone is done too */
+
+int client_done (struct test_info * t) {
+
+	struct pollfd pfd;
+	struct ctrl_msg m;
+	struct ctrl_hdr h;
+
+	pfd.fd = t->ctrlsock;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return 0;
+
+	if (recv(t->ctrlsock, &h, sizeof(h), MSG_WAITALL) != sizeof(h) || ctrl_check(&h, &m) < 0 ||
+		(m.len > 0 && recv(t->ctrlsock, m.body, m.len, MSG_WAITALL) != (ssize_t) m.len)) {
+		fprintf(stderr, "[WARNING]: [%d] Lost the client while waiting for the end of the test\n", t->id);
+		return 1;
+		}
+
+	if (m.type == MSG_END)
+		printf("[INFO]: [%d] Client is done, it sent %ld datagrams\n", t->id, ctrl_get(&m, P_SENT_PKTS, 0));
+	return 1;
+	}
+
+
+
+
+
+
+
+
+
+/* uring_rx_init: This function sets up a ring for receiving on sock: the socket
+	is registered (the recv names it by index, so the kernel does not look it up
+	and take a reference every time), URING_BUFS buffers of len bytes go into the
+	provided buffer ring, and the multishot recv is armed. The buffer ring came in
+	5.19 but the multishot recv only in 6.0, which turns the flag down with EINVAL
+	as soon as the recv is submitted, so it is submitted here to find out. Returns
+	-1 (with errno) if any of it fails, then nothing is left behind */
+
+int uring_rx_init (struct uring * r, int sock, size_t len) {
+
+	struct io_uring_buf_reg reg;
+	struct io_uring_cqe * cqe;
+	int i, e;
+
+	if (uring_init(r, URING_BUFS) < 0)
+		return -1;
+
+	if (uring_register(r, IORING_REGISTER_FILES, &sock, 1) < 0)
+		goto fail;
+
+	/* The ring of buffers has to be page aligned */
+	r->br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->br == MAP_FAILED) {
+		r->br = NULL;
+		goto fail;
+		}
+
+	r->buf_len = len;
+	r->bufs = malloc(URING_BUFS * len);
+	if (r->bufs == NULL)
+		goto fail;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t) r->br;
+	reg.ring_entries = URING_BUFS;
+	reg.bgid = 0;
+	if (uring_register(r, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto fail;
+
+	for (i = 0; i < URING_BUFS; i++)
+		uring_buf_put(r, i);
+
+	uring_recv(r);
+	if (uring_enter(r, 0, -1) < 0)
+		goto fail;
+	cqe = uring_cqe(r);
+	if (cqe != NULL && cqe->user_data == URING_RECV && cqe->res == -EINVAL) {
+		errno = EINVAL;
+		goto fail;
+		}
+	return 0;
+
+fail:
+	e = errno;
+	uring_free(r);
+	errno = e;
+	return -1;
+	}
+
+
+
+
+/* uring_rx_stop: This function cancels the multishot recv, if it is still armed,
+	and waits for its last completion. Anything the recv still picks up is dropped,
+	but the client has nothing more to send on the test socket by then. For TCP that
+	is the control connection, and the results go out on it next */
+
+void uring_rx_stop (struct uring * r) {
+
+	struct io_uring_sqe * sqe;
+	struct io_uring_cqe * cqe;
+
+	if (!r->armed || (sqe = uring_sqe(r)) == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = URING_RECV;
+	sqe->user_data = URING_CANCEL;
+
+	while (r->armed && uring_enter(r, 1, 1000) == 0)
+		for (; (cqe = uring_cqe(r)) != NULL; uring_seen(r))
+			if (cqe->user_data == URING_RECV && !(cqe->flags & IORING_CQE_F_MORE))
+				r->armed = 0;
+	}
+
+
+
+
+/* uring_error: This is session_error() for the uring loops. The ring holds a
+	reference to the test socket, so it has to go before the session is closed */
+
+void uring_error (struct test_info * t, struct uring * r, const char * msg) {
+
+	int e = errno;
+
+	uring_free(r);
+	errno = e;
+	session_error(t, msg);
+	}
+
+
+
+
+/* uring_init: This function sets up an io_uring with room for entries submissions
+	and maps its rings. The submission array never changes, entry i always points
+	at submission i, so it is filled in once here. Returns -1 (with errno) if the
+	kernel won't give us a ring, because it is too old or io_uring is switched off */
+
+int uring_init (struct uring * r, unsigned int entries) {
+
+	struct io_uring_params p;
+	unsigned int i;
+	char * sq, * cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Newer kernels have both rings in one mapping */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = 0;
+		}
+
+	r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_ring = r->cq_len == 0 ? r->sq_ring :
+		mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+	if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+		uring_free(r);
+		return -1;
+		}
+
+	sq = r->sq_ring;
+	cq = r->cq_ring;
+	r->sq_khead = (unsigned int *) (sq + p.sq_off.head);
+	r->sq_ktail = (unsigned int *) (sq + p.sq_off.tail);
+	r->sq_array = (unsigned int *) (sq + p.sq_off.array);
+	r->sq_mask = *(unsigned int *) (sq + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sq_tail = r->sq_submitted = *r->sq_ktail;
+	r->cq_khead = (unsigned int *) (cq + p.cq_off.head);
+	r->cq_ktail = (unsigned int *) (cq + p.cq_off.tail);
+	r->cq_mask = *(unsigned int *) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	for (i = 0; i < r->sq_entries; i++)
+		r->sq_array[i] = i;
+
+	return 0;
+	}
+
+
+
+
+/* uring_sqe: This function hands out the next free submission entry, cleared, or
+	NULL if all of them are still waiting for the kernel to take them */
+
+struct io_uring_sqe * uring_sqe (struct uring * r) {
+
+	struct io_uring_sqe * sqe;
+
+	if (r->sq_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE) >= r->sq_entries)
+		return NULL;
+
+	sqe = &r->sqes[r->sq_tail & r->sq_mask];
+	r->sq_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+	}
+
+
+
+
+/* uring_enter: This function publishes the submissions filled and the buffers given
+	back since the last call, hands them to the kernel and waits till at least wait
+	completions are there, or timeout_ms have passed (-1 waits for ever). All in one
+	system call. Returns -1 (with errno, ETIME for the timeout) if that fails */
+
+int uring_enter (struct uring * r, unsigned int wait, int timeout_ms) {
+
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	/* The entries have to be visible before the tail that says they are there */
+	__atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+	if (r->br != NULL)
+		__atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		arg.ts = (uintptr_t) &ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		}
+
+	while ((ret = syscall(__NR_io_uring_enter, r->fd, r->sq_tail - r->sq_submitted, wait, flags,
+						  timeout_ms >= 0 ? &arg : NULL, timeout_ms >= 0 ? sizeof(arg) : 0)) < 0 && errno == EINTR)
+		;
+
+	r->enters++;
+	if (ret < 0)
+		return -1;
+
+	r->sq_submitted += ret;
+	return 0;
+	}
+
+
+
+
+/* uring_cqe: This function returns the oldest completion we have not looked at
+	yet, or NULL if there is none. uring_seen() gives its slot back to the kernel */
+
+struct io_uring_cqe * uring_cqe (struct uring * r) {
+
+	unsigned int head = *r->cq_khead;
+
+	if (head == __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & r->cq_mask];
+	}
+
+void uring_seen (struct uring * r) {
+
+	__atomic_store_n(r->cq_khead, *r->cq_khead + 1, __ATOMIC_RELEASE);
+	}
+
+
+
+
+/* uring_register: This function registers files or a buffer ring (n of them at
+	arg) with the ring. Returns -1 (with errno) if the kernel refuses */
+
+int uring_register (struct uring * r, unsigned int opcode, void * arg, unsigned int n) {
+
+	return syscall(__NR_io_uring_register, r->fd, opcode, arg, n) < 0 ? -1 : 0;
+	}
+
+
+
+
+/* uring_recv: This function arms the multishot recv on the registered socket. It
+	takes a buffer from group 0 for every completion */
+
+void uring_recv (struct uring * r) {
+
+	struct io_uring_sqe * sqe = uring_sqe(r);
+
+	if (sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->fd = 0;					/* Index into the registered files */
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = 0;
+	sqe->user_data = URING_RECV;
+	r->armed = 1;
+	}
+
+
+
+
+/* uring_buf_put: This function puts buffer bid back into the provided buffer ring.
+	The kernel only sees it once uring_enter() has moved the tail */
+
+void uring_buf_put (struct uring * r, int bid) {
+
+	struct io_uring_buf * b = &r->br->bufs[r->br_tail & (URING_BUFS - 1)];
+
+	b->addr = (uintptr_t) (r->bufs + (size_t) bid * r->buf_len);
+	b->len = r->buf_len;
+	b->bid = bid;
+	r->br_tail++;
+	}
+
+
+
+
+/* uring_free: This function unmaps the rings, frees the buffers and closes the
+	ring. Whatever is still in flight is cancelled by the kernel */
+
+void uring_free (struct uring * r) {
+
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_len > 0 && r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+		munmap(r->cq_ring, r->cq_len);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_len);
+	close(r->fd);
+
+	if (r->br != NULL)
+		munmap(r->br, URING_BUFS * sizeof(struct io_uring_buf));
+	free(r->bufs);
+	}
+
+
+
+
+
+
+
+
+
+/* run_tcp_rr: This function answers the requests of a request/response test over
+	the TCP connection. We read exactly one request, write one response and so on,
+	t->data_info times or till the client closes. Nagle would hold our small
+	responses back, so it is off. It returns the bytes of requests received */
+
+long int run_tcp_rr (struct test_info * t) {
+
+	char * buff;
+	int one = 1;
+	long int done, n, stat, received = 0;
+
+	printf("[INFO]: [%d] Starting TCP request/response test\n", t->id);
+
+	if (setsockopt(t->testsock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+		session_error(t, "[ERROR]: Could not set TCP_NODELAY on the test socket");
+
+	buff = calloc(1, t->req_size > t->resp_size ? t->req_size : t->resp_size);
+	if (buff == NULL)
+		session_error(t, "[ERROR]: Could not allocate the buffer");
+
+	for (done = 0; done < t->data_info; done++) {
+
+		stat = recv(t->testsock, buff, t->req_size, MSG_WAITALL);
+		if (stat < 0)
+			session_error(t, "[ERROR]: Read on the socket failed");
+
+		/* Client went away */
+		if (stat < t->req_size)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+		if (received == 0)
+			t->rx_first = t->rx_last;
+		received += stat;
+
+		for (n = 0; n < t->resp_size; n += stat) {
+			stat = write(t->testsock, buff + n, t->resp_size - n);
+			if (stat <= 0)
+				session_error(t, "[ERROR]: Write on the socket failed");
+			}
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.packets, done + 1, __ATOMIC_RELAXED);
+		}
+
+	free(buff);
+	printf("[INFO]: [%d] Answered %ld requests\n", t->id, done);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* run_udp_rr: This function answers the requests of a request/response test on the
+	UDP test socket. Every datagram that comes in is a request, and the response goes
+	back to wherever it came from. The response is made in the same buffer, so it
+	starts with the start of the request; that is where the client put the number
+	of the request. A lost request is never coming, so the test ends after t->data_info
+	requests or RR_IDLE seconds without one */
+
+long int run_udp_rr (struct test_info * t) {
+
+	char * buff;
+	int idle = 0;
+	long int stat, done = 0, received = 0;
+	size_t len = t->req_size > t->resp_size ? t->req_size : t->resp_size;
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	struct timeval tv;
+
+	printf("[INFO]: [%d] Starting UDP request/response test\n", t->id);
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	if (setsockopt(t->testsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		session_error(t, "[ERROR]: Could not set timeout on the test socket");
+
+	buff = calloc(1, len);
+	if (buff == NULL)
+		session_error(t, "[ERROR]: Could not allocate the buffer");
+
+	while (done < t->data_info) {
+
+		from_len = sizeof(from);
+		stat = recvfrom(t->testsock, buff, len, 0, (struct sockaddr *) &from, &from_len);
+
+		if (stat < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				session_error(t, "[ERROR]: Read on the socket failed");
+			if (++idle >= (done > 0 ? RR_IDLE : UDP_START_WAIT))
+				break;
+			continue;
+			}
+		idle = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+		if (done == 0)
+			t->rx_first = t->rx_last;
+		received += stat;
+		done++;
+
+		if (sendto(t->testsock, buff, t->resp_size, 0, (struct sockaddr *) &from, from_len) < 0)
+			session_error(t, "[ERROR]: Write on the socket failed");
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.packets, done, __ATOMIC_RELAXED);
+		}
+
+	free(buff);
+	printf("[INFO]: [%d] Answered %ld requests\n", t->id, done);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* run_crr: This function serves the connection rate test. We accept the client's
+	connections one after the other on the stream socket, read its message and send
+	it back (if there is one) and close, t->data_info times. We close first, so the
+	client does not end up with a TIME_WAIT (and one port less) per connection.
+	TCP_INFO tells us whether the connection came with data in the SYN, that is,
+	whether Fast Open worked. It returns the bytes of messages received */
+
+long int run_crr (struct test_info * t) {
+
+	char * buff;
+	int sock;
+	long int n, stat, received = 0;
+	struct tcp_info info;
+	socklen_t info_len;
+
+	printf("[INFO]: [%d] Starting connection rate test\n", t->id);
+
+	buff = calloc(1, t->crr_size > 0 ? t->crr_size : 1);
+	if (buff == NULL)
+		session_error(t, "[ERROR]: Could not allocate the buffer");
+
+	while (t->conns < t->data_info) {
+
+		/* The accept() times out after ACCEPT_TIMEOUT, then the client is gone */
+		sock = accept(t->streamsock, NULL, NULL);
+		if (sock < 0 && errno == EINTR)
+			continue;
+		if (sock < 0)
+			break;
+
+		if (t->crr_size > 0) {
+			stat = recv(sock, buff, t->crr_size, MSG_WAITALL);
+			if (stat == t->crr_size) {
+				received += stat;
+				for (n = 0; n < t->crr_size; n += stat) {
+					stat = write(sock, buff + n, t->crr_size - n);
+					if (stat <= 0)
+						break;
+					}
+				}
+			}
+
+		info_len = sizeof(info);
+		if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA))
+			t->tfo_conns++;
+
+		close(sock);
+
+		clock_gettime(CLOCK_MONOTONIC, &t->rx_last);
+		if (t->conns == 0)
+			t->rx_first = t->rx_last;
+		t->conns++;
+
+		__atomic_store_n(&t->live.bytes, received, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->live.packets, t->conns, __ATOMIC_RELAXED);
+		}
+
+	free(buff);
+	printf("[INFO]: [%d] Accepted %ld connections, %ld with data in the SYN\n", t->id, t->conns, t->tfo_conns);
+	return received;
+	}
+
+
+
+
+
+
+
+
+
+/* run_sender: This is the thread body that sends to the client, in reverse and
+	both. It times the sending by the monotonic clock, first to last send. A failed
+	send only ends the sending: the receiving may still be going on in the session
+	thread, which is the one to give up on the session */
+
+void * run_sender (void * arg) {
+
+	struct test_info * t = (struct test_info *) arg;
+	struct timespec start, end;
+	struct rusage ru;
+
+	pin_thread(t, 1);
+	getrusage(RUSAGE_THREAD, &ru);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (t->t_prot == 1)
+		t->tx_sent = run_tcp_send(t);
+	else
+		t->tx_sent = run_udp_send(t);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	t->tx_time = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+	cpu_add(&t->cpu, &ru);
+	return NULL;
+	}
+
+
+
+
+
+
+
+
+
+/* run_tcp_send: This function writes t->data_info bytes to the client over the TCP
+	connection. Exactly that many: the results go over the same connection after
+	them, and the client reads the data by its length */
+
+long int run_tcp_send (struct test_info * t) {
+
+	size_t cur = 0;
+	long int stat, chunk, sent = 0;
+
+	printf("[INFO]: [%d] Starting to send over TCP\n", t->id);
+
+	while (sent < t->data_info) {
+
+		chunk = t->data_info - sent < t->msg_size ? t->data_info - sent : t->msg_size;
+		stat = write(t->testsock, pool_next(&cur, chunk), chunk);
+		if (stat < 0 && errno == EINTR)
+			continue;
+		if (stat <= 0) {
+			fprintf(stderr, "[ERROR]: [%d] Write on the socket failed: %s\n", t->id, strerror(errno));
+			break;
+			}
+
+		sent += stat;
+		__atomic_store_n(&t->live.tx_bytes, sent, __ATOMIC_RELAXED);
+		}
+
+	return sent;
+	}
+
+
+
+
+
+
+
+
+
+/* run_udp_send: This function sends t->data_info datagrams to the client over the
+	(connected) UDP test socket. They look just like the client's: the same header
+	with sequence number and send time, and as long, so the client can tell loss,
+	reordering and jitter the same way we do. The payload after the header is the
+	next chunk of the pool.
+
+	We send the way the client does: t->batch messages per sendmmsg(), each of them
+	a GSO super-datagram if the client uses GSO (and the datagrams fit the path MTU),
+	paced at its rate if it has one. A full qdisc (ENOBUFS) gets a moment to drain,
+	we don't spin on it */
+
+long int run_udp_send (struct test_info * t) {
+
+	size_t cur = 0;
+	int i, j, n, stat, mtu = 0, per_msg = 1;
+	int seg = t->msg_size;
+	long int k, queued, sent = 0;
+	socklen_t len = sizeof(mtu);
+	struct mmsghdr * msgs;
+	struct iovec * iov;
+	struct dgram_hdr * hdr;
+	struct timespec now, pace_start;
+	struct timespec nap = { 0, NOBUFS_WAIT_NS };
+
+	if (t->offload & OFFLOAD_GSO) {
+		if (t->fam->n_prot == 4)
+			getsockopt(t->testsock, IPPROTO_IP, IP_MTU, &mtu, &len);
+		else
+			getsockopt(t->testsock, IPPROTO_IPV6, IPV6_MTU, &mtu, &len);
+
+		per_msg = GSO_MAX_SIZE / seg;
+		if (per_msg > GSO_MAX_SEGS)
+			per_msg = GSO_MAX_SEGS;
+		if (mtu > 0 && seg + 8 + (t->fam->n_prot == 4 ? 20 : 40) > mtu) {
+			printf("[INFO]: [%d] %d byte datagrams don't fit the path MTU %d, sending them without GSO\n", t->id, seg, mtu);
+			per_msg = 1;
+			}
+		else if (per_msg > 1 && setsockopt(t->testsock, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) < 0) {
+			fprintf(stderr, "[WARNING]: [%d] Could not enable UDP_SEGMENT, sending without GSO: %s\n", t->id, strerror(errno));
+			per_msg = 1;
+			}
+		if (per_msg < 1)
+			per_msg = 1;
+		}
+
+	if (t->rate > 0) {
+		unsigned int bytes_per_sec = t->rate / 8 > 4000000000.0 ? 4000000000U : (unsigned int) (t->rate / 8);
+		setsockopt(t->testsock, SOL_SOCKET, SO_MAX_PACING_RATE, &bytes_per_sec, sizeof(bytes_per_sec));
+		}
+
+	printf("[INFO]: [%d] Starting to send over UDP (batch of %d, %d datagrams per message%s)\n",
+		t->id, t->batch, per_msg, t->rate > 0 ? ", paced" : "");
+
+	/* Two iovecs (header, payload) per datagram, per_msg datagrams per message */
+	msgs = calloc(t->batch, sizeof(struct mmsghdr));
+	iov = calloc((size_t) t->batch * per_msg * 2, sizeof(struct iovec));
+	hdr = calloc((size_t) t->batch * per_msg, sizeof(struct dgram_hdr));
+	if (msgs == NULL || iov == NULL || hdr == NULL) {
+		fprintf(stderr, "[ERROR]: [%d] Could not allocate the message vector\n", t->id);
+		free(msgs);
+		free(iov);
+		free(hdr);
+		return 0;
+		}
+
+	for (i = 0; i < t->batch * per_msg; i++) {
+		iov[2*i].iov_base = &hdr[i];
+		iov[2*i].iov_len = sizeof(struct dgram_hdr);
+		iov[2*i+1].iov_len = seg - sizeof(struct dgram_hdr);
+		}
+	for (i = 0; i < t->batch; i++)
+		msgs[i].msg_hdr.msg_iov = &iov[2 * per_msg * i];
+
+	clock_gettime(CLOCK_MONOTONIC, &pace_start);
+
+	while (t->tx_pkts < t->data_info) {
+
+		if (t->rate > 0)
+			pace_wait(t, &pace_start, sent);
+
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* Fill up the batch, without overshooting in the last one */
+		for (n = 0, queued = 0; n < t->batch && t->tx_pkts + queued < t->data_info; n++) {
+			k = t->data_info - t->tx_pkts - queued;
+			if (k > per_msg)
+				k = per_msg;
+			msgs[n].msg_hdr.msg_iovlen = 2 * k;
+
+			for (j = 0; j < k; j++) {
+				hdr[n * per_msg + j].seq = htobe64(t->tx_pkts + queued + j);
+				hdr[n * per_msg + j].sec = htobe64(now.tv_sec);
+				hdr[n * per_msg + j].nsec = htonl(now.tv_nsec);
+				iov[2 * (n * per_msg + j) + 1].iov_base = pool_next(&cur, seg - sizeof(struct dgram_hdr));
+				}
+			queued += k;
+			}
+
+		stat = sendmmsg(t->testsock, msgs, n, 0);
+		if (stat < 0 && errno == EINTR)
+			continue;
+		if (stat < 0 && errno == ENOBUFS) {
+			nanosleep(&nap, NULL);
+			continue;
+			}
+		if (stat < 0) {
+			fprintf(stderr, "[ERROR]: [%d] Write on the socket failed: %s\n", t->id, strerror(errno));
+			break;
+			}
+
+		for (i = 0; i < stat; i++) {
+			sent += msgs[i].msg_len;
+			t->tx_pkts += msgs[i].msg_len / seg;
+			}
+		__atomic_store_n(&t->live.tx_bytes, sent, __ATOMIC_RELAXED);
+		}
+
+	free(msgs);
+	free(iov);
+	free(hdr);
+	return sent;
+	}
+
+
+
+
+/* pace_wait: This function holds the sender of a session back till the bytes it
+	has sent so far are due at t->rate, like the client's pacing: sleep till shortly
+	before, then spin on CLOCK_MONOTONIC for the rest */
+
+void pace_wait (struct test_info * t, struct timespec * start, long int sent_bytes) {
+
+	struct timespec now, wake;
+	double due_ns = sent_bytes * 8 / t->rate * 1e9;
+	double now_ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+
+	if (due_ns - now_ns > PACING_SPIN_NS) {
+		long long at = (long long) start->tv_sec * 1000000000LL + start->tv_nsec + (long long) (due_ns - PACING_SPIN_NS);
+		wake.tv_sec = at / 1000000000LL;
+		wake.tv_nsec = at % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+		}
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ns = (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+		} while (now_ns < due_ns);
+	}
+
+
+
+
+
+
+
+
+
+/* sampler_start: This function starts the interval reporter of a session, if we
+	were asked for one (-i). The reporter only ever reads the live counters, so the
+	receive loops don't know or care whether it runs */
+
+void sampler_start (struct test_info * t) {
+
+	pthread_condattr_t attr;
+
+	if (si.interval <= 0)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->smp.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&t->smp.lock, NULL);
+	t->smp.stop = 0;
+
+	if (pthread_create(&t->smp.thread, NULL, run_sampler, t) != 0) {
+		perror("[WARNING]: Could not start the interval reporter");
+		return;
+		}
+	t->smp.running = 1;
+	}
+
+
+
+
+/* sampler_stop: This function wakes the interval reporter up, tells it to stop and
+	waits for it. Safe to call when there is none */
+
+void sampler_stop (struct test_info * t) {
+
+	if (!t->smp.running)
+		return;
+
+	pthread_mutex_lock(&t->smp.lock);
+	t->smp.stop = 1;
+	pthread_cond_signal(&t->smp.cond);
+	pthread_mutex_unlock(&t->smp.lock);
+
+	pthread_join(t->smp.thread, NULL);
+	pthread_cond_destroy(&t->smp.cond);
+	pthread_mutex_destroy(&t->smp.lock);
+	t->smp.running = 0;
+	}
+
+
+
+
+/* run_sampler: This is the thread body of the interval reporter. Every si.interval
+	ms it reads the counters of the session and prints what changed since the last
+	time. The deadlines are absolute, so printing doesn't make the intervals drift.
+	For UDP the loss of an interval is how much further the sequence numbers got
+	minus how many distinct datagrams came in; a late datagram makes up for the
+	loss of an earlier interval and may show as negative loss */
+
+void * run_sampler (void * arg) {
+
+	struct test_info * t = (struct test_info *) arg;
+	struct timespec start, due;
+	long int bytes, packets, unique, expected, lost;
+	long int last_bytes = 0, last_packets = 0, last_unique = 0, last_expected = 0;
+	long int tx, last_tx = 0;
+	double from = 0, to, secs;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	due = start;
+
+	pthread_mutex_lock(&t->smp.lock);
+
+	for (n = 1; !t->smp.stop; n++) {
+
+		due.tv_sec = start.tv_sec + ((long int) n * si.interval) / 1000;
+		due.tv_nsec = start.tv_nsec + (((long int) n * si.interval) % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+			}
+
+		while (!t->smp.stop && pthread_cond_timedwait(&t->smp.cond, &t->smp.lock, &due) != ETIMEDOUT);
+		if (t->smp.stop)
+			break;
+
+		bytes = __atomic_load_n(&t->live.bytes, __ATOMIC_RELAXED);
+		if (t->t_prot == 1 && t->n_streams > 1)
+			for (i = 0, bytes = 0; i < t->n_streams; i++)
+				bytes += __atomic_load_n(&t->streams[i].received, __ATOMIC_RELAXED);
+
+		to = (double) n * si.interval / 1000;
+		secs = to - from;
+
+		if (t->t_prot == 0) {
+			packets = __atomic_load_n(&t->live.packets, __ATOMIC_RELAXED);
+			unique = __atomic_load_n(&t->live.unique, __ATOMIC_RELAXED);
+			expected = __atomic_load_n(&t->live.expected, __ATOMIC_RELAXED);
+			lost = (expected - last_expected) - (unique - last_unique);
+
+			printf("[INFO]: [%d] %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s %9ld pkts %10.0f pkt/s lost %ld (%.2f %%)\n",
+				t->id, from, to, bytes - last_bytes, (bytes - last_bytes) * 8 / secs / 1e6,
+				packets - last_packets, (packets - last_packets) / secs, lost,
+				expected > last_expected ? 100.0 * lost / (expected - last_expected) : 0.0);
+
+			last_packets = packets;
+			last_unique = unique;
+			last_expected = expected;
+			}
+		else if (t->crr_size >= 0) {
+			packets = __atomic_load_n(&t->live.packets, __ATOMIC_RELAXED);
+			printf("[INFO]: [%d] %7.2f-%-7.2f s %9ld conns %10.0f conn/s\n",
+				t->id, from, to, packets - last_packets, (packets - last_packets) / secs);
+			last_packets = packets;
+			}
+		else
+			printf("[INFO]: [%d] %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s\n",
+				t->id, from, to, bytes - last_bytes, (bytes - last_bytes) * 8 / secs / 1e6);
+
+		if (t->direction != DIR_FORWARD) {
+			tx = __atomic_load_n(&t->live.tx_bytes, __ATOMIC_RELAXED);
+			printf("[INFO]: [%d] %7.2f-%-7.2f s %12ld bytes %10.2f Mbit/s (sent)\n",
+				t->id, from, to, tx - last_tx, (tx - last_tx) * 8 / secs / 1e6);
+			last_tx = tx;
+			}
+
+		last_bytes = bytes;
+		from = to;
+		}
+
+	pthread_mutex_unlock(&t->smp.lock);
+	return NULL;
+	}
+
+
+
+
+
+
+
+
+
+/* place_test: This function puts the session where -A and -M say. The memory of
+	the session thread (and the threads it starts) comes from the NUMA node, and the
+	thread itself goes on the first CPU; the others pin themselves as they start.
+	The client gets told what we chose along with the result.
+
+	With -D sessions can run at the same time. Each takes the lowest slot that no
+	running session has and starts that many times a session's threads down the
+	CPU list, so they only share CPUs once the list runs out (and we say so) */
+
+void place_test (struct test_info * t) {
+
+	struct placement * p = &t->place;
+	unsigned long int taken;
+	char list[192];
+	int len, per, slot, shared = 0;
+
+	*p = si.place;
+	p->node = p->node_opt;
+	p->base = 0;
+	p->slot = -1;
+	if (p->automatic)
+		place_auto(p, t->ctrlsock);
+
+	if (p->n_cpus > 0) {
+		taken = __atomic_load_n(&si.slots, __ATOMIC_RELAXED);
+		do
+			slot = ~taken == 0 ? -1 : __builtin_ctzl(~taken);
+		while (slot >= 0 && !__atomic_compare_exchange_n(&si.slots, &taken, taken | (1UL << slot),
+														  0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+		/* The session thread and the sender, or a thread for every stream */
+		per = t->n_streams > 2 ? t->n_streams : 2;
+		p->slot = slot;
+		p->base = slot > 0 ? slot * per : 0;
+		if (slot != 0 && (slot < 0 || p->base + per > p->n_cpus)) {
+			fprintf(stderr, "[WARNING]: [%d] Other sessions are running, this one shares CPUs with them\n", t->id);
+			shared = 1;
+			}
+		}
+
+	if (p->node >= 0 && bind_node(p->node) < 0) {
+		fprintf(stderr, "[%d] ", t->id);
+		perror("[WARNING]: Could not bind the memory to the NUMA node");
+		p->node = -1;
+		}
+	else if (p->node >= 0 && t->direction != DIR_FORWARD && pool_move(p->node) < 0) {
+		fprintf(stderr, "[%d] ", t->id);
+		perror("[WARNING]: Could not move the payload pool to the NUMA node");
+		}
+	pin_thread(t, 0);
+
+	show_cpus(list, sizeof(list), p->cpus, p->n_cpus);
+	len = snprintf(p->desc, sizeof(p->desc), p->n_cpus > 0 ? "threads on CPUs %s" : "threads anywhere", list);
+	if (p->n_cpus > 0 && p->base % p->n_cpus != 0)
+		len += snprintf(p->desc + len, sizeof(p->desc) - len, " from CPU %d (session slot %d)",
+						p->cpus[p->base % p->n_cpus], p->slot);
+	if (shared)
+		len += snprintf(p->desc + len, sizeof(p->desc) - len, ", shared with other sessions");
+	len += snprintf(p->desc + len, sizeof(p->desc) - len, p->node >= 0 ? ", memory on node %d" : ", memory anywhere", p->node);
+	if (p->automatic)
+		snprintf(p->desc + len, sizeof(p->desc) - len, " (%s)", p->why);
+
+	if (p->automatic || p->n_cpus > 0 || p->node_opt >= 0)
+		printf("[INFO]: [%d] Placement: %s\n", t->id, p->desc);
+	}
+
+
+
+
+/* place_release: This function gives the placement slot of session t back, once
+	its threads are done */
+
+void place_release (struct test_info * t) {
+
+	if (t->place.slot >= 0)
+		__atomic_and_fetch(&si.slots, ~(1UL << t->place.slot), __ATOMIC_RELEASE);
+	t->place.slot = -1;
+	}
+
+
+
+
+/* pin_thread: This function pins the calling thread, thread k of session t, to its
+	CPU. Every session thread starts out unpinned, so there is nothing to undo */
+
+void pin_thread (struct test_info * t, int k) {
+
+	struct placement * p = &t->place;
+	cpu_set_t set;
+	int e;
+
+	if (p->n_cpus == 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(p->cpus[(p->base + k) % p->n_cpus], &set);
+
+	if ((e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+		fprintf(stderr,"[%d] [WARNING]: Could not pin test thread %d: %s\n", t->id, k, strerror(e));
+	}
+
+
+
+
+/* parse_cpus: This function reads a CPU list like sysfs writes them ("0-3,8,10-11")
+	into cpus, at most max of them. It returns how many there are, -1 if the list
+	is not one */
+
+int parse_cpus (const char * s, int * cpus, int max) {
+
+	int n = 0, a, b;
+	char * end;
+
+	while (*s != '\0' && *s != '\n') {
+
+		a = b = strtol(s, &end, 10);
+		if (end == s || a < 0)
+			return -1;
+		s = end;
+
+		if (*s == '-') {
+			b = strtol(s + 1, &end, 10);
+			if (end == s + 1 || b < a)
+				return -1;
+			s = end;
+			}
+
+		for (; a <= b && n < max; a++)
+			cpus[n++] = a;
+
+		if (*s == ',')
+			s++;
+		else if (*s != '\0' && *s != '\n')
+			return -1;
+		}
+
+	return n;
+	}
+
+
+
+
+/* show_cpus: This function writes cpus (n of them) into buf as a CPU list, with
+	runs of CPUs as ranges */
+
+void show_cpus (char * buf, int size, int * cpus, int n) {
+
+	int i, j, len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < n && len < size; i = j + 1) {
+		for (j = i; j + 1 < n && cpus[j + 1] == cpus[j] + 1; j++)
+			;
+		if (j > i)
+			len += snprintf(buf + len, size - len, "%s%d-%d", i > 0 ? "," : "", cpus[i], cpus[j]);
+		else
+			len += snprintf(buf + len, size - len, "%s%d", i > 0 ? "," : "", cpus[i]);
+		}
+	}
+
+
+
+
+/* read_line: This function reads the first line of a (sysfs or proc) file into buf.
+	Returns -1 if there is no such file */
+
+int read_line (const char * path, char * buf, int size) {
+
+	FILE * f = fopen(path, "r");
+
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, size, f) == NULL)
+		buf[0] = '\0';
+	fclose(f);
+	return 0;
+	}
+
+
+
+
+/* place_auto: This function works out where the test should run from the NIC the
+	connection sock goes through: the interface with its local address, the NUMA node
+	of the device and the CPUs its interrupts are sent to (its MSI vectors). The
+	threads go on the CPUs of that node, but not on the ones taking the interrupts,
+	so that the softirq processing and the test don't fight over a core. If that
+	leaves nothing, the interrupt CPUs will do. Loopback and virtual interfaces have
+	no device, then we leave it to the scheduler and say why */
+
+void place_auto (struct placement * p, int sock) {
+
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	struct ifaddrs * ifs, * i;
+	char ifname[64] = "", path[320], buf[4096], list[128];
+	int cpus[MAX_PIN], n, k, irqs = 0;
+	cpu_set_t irq;
+	DIR * d;
+	struct dirent * de;
+
+	p->n_cpus = 0;
+	CPU_ZERO(&irq);
+
+	if (getsockname(sock, (struct sockaddr *) &local, &len) < 0 || getifaddrs(&ifs) < 0) {
+		snprintf(p->why, sizeof(p->why), "auto: no local address");
+		return;
+		}
+
+	for (i = ifs; i != NULL && ifname[0] == '\0'; i = i->ifa_next) {
+		if (i->ifa_addr == NULL || i->ifa_addr->sa_family != local.ss_family)
+			continue;
+		if (local.ss_family == AF_INET && ((struct sockaddr_in *) i->ifa_addr)->sin_addr.s_addr ==
+				((struct sockaddr_in *) &local)->sin_addr.s_addr)
+			snprintf(ifname, sizeof(ifname), "%s", i->ifa_name);
+		if (local.ss_family == AF_INET6 && memcmp(&((struct sockaddr_in6 *) i->ifa_addr)->sin6_addr,
+				&((struct sockaddr_in6 *) &local)->sin6_addr, sizeof(struct in6_addr)) == 0)
+			snprintf(ifname, sizeof(ifname), "%s", i->ifa_name);
+		}
+	freeifaddrs(ifs);
+
+	if (ifname[0] == '\0') {
+		snprintf(p->why, sizeof(p->why), "auto: no interface with our address");
+		return;
+		}
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+	if (read_line(path, buf, sizeof(buf)) < 0) {
+		snprintf(p->why, sizeof(p->why), "auto: %s has no device, left to the scheduler", ifname);
+		return;
+		}
+	if (p->node_opt < 0)
+		p->node = atoi(buf);
+
+	/* The interrupts of the device and where they go */
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname);
+	if ((d = opendir(path)) != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9')
+				continue;
+			snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", de->d_name);
+			if (read_line(path, buf, sizeof(buf)) < 0 || (n = parse_cpus(buf, cpus, MAX_PIN)) < 0)
+				continue;
+			for (k = 0; k < n; k++)
+				if (cpus[k] < CPU_SETSIZE)
+					CPU_SET(cpus[k], &irq);
+			irqs++;
+			}
+		closedir(d);
+		}
+
+	/* The CPUs of the node, or all of ours if the device doesn't say */
+	n = -1;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", p->node);
+	if (p->node >= 0 && read_line(path, buf, sizeof(buf)) == 0)
+		n = parse_cpus(buf, cpus, MAX_PIN);
+	if (n < 0)
+		for (n = 0, k = 0; k < CPU_SETSIZE && n < MAX_PIN; k++)
+			if (CPU_ISSET(k, &p->allowed))
+				cpus[n++] = k;
+
+	for (k = 0; k < n; k++)
+		if (cpus[k] < CPU_SETSIZE && CPU_ISSET(cpus[k], &p->allowed) && !CPU_ISSET(cpus[k], &irq))
+			p->cpus[p->n_cpus++] = cpus[k];
+	if (p->n_cpus == 0)
+		for (k = 0; k < n; k++)
+			if (cpus[k] < CPU_SETSIZE && CPU_ISSET(cpus[k], &p->allowed))
+				p->cpus[p->n_cpus++] = cpus[k];
+
+	for (n = 0, k = 0; k < CPU_SETSIZE && n < MAX_PIN; k++)
+		if (CPU_ISSET(k, &irq))
+			cpus[n++] = k;
+	show_cpus(list, sizeof(list), cpus, n);
+	snprintf(p->why, sizeof(p->why), "auto: %s on node %d, %d IRQs on CPUs %s", ifname, p->node, irqs, n > 0 ? list : "unknown");
+	}
+
+
+
+
+/* bind_node: This function makes the memory the calling thread (and the threads it
+	starts) allocates from now on come from NUMA node node. We use the system call,
+	libnuma would be one dependency more for it */
+
+int bind_node (int node) {
+
+	unsigned long mask[16];
+
+	if (node < 0 || node >= (int) (8 * sizeof(mask)))
+		return -1;
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	return syscall(__NR_set_mempolicy, MPOL_BIND, mask, 8 * sizeof(mask) + 1);
+	}
+
+
+
+
+/* pool_move: This function moves the payload pool to NUMA node node, for a session
+	that sends. The pool is filled (and so faulted in) before the first session, so
+	binding the memory of the session thread doesn't take it along; mbind() with
+	MPOL_MF_MOVE migrates the pages. All the sessions share the pool, so with
+	sessions on different nodes at the same time it goes where the last one runs */
+
+int pool_move (int node) {
+
+	unsigned long mask[16];
+
+	if (node == __atomic_load_n(&si.pool_node, __ATOMIC_RELAXED))
+		return 0;
+	if (node < 0 || node >= (int) (8 * sizeof(mask))) {
+		errno = EINVAL;
+		return -1;
+		}
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	if (syscall(__NR_mbind, si.pool, POOL_SIZE, MPOL_BIND, mask, 8 * sizeof(mask) + 1, MPOL_MF_MOVE) < 0)
+		return -1;
+
+	__atomic_store_n(&si.pool_node, node, __ATOMIC_RELAXED);
+	return 0;
+	}
+
+
+
+
+
+/* tcpi_begin: This function starts sampling TCP_INFO of the test connections, if the
+	client asked for it. A thread of its own, the receive loops don't know about it */
+
+void tcpi_begin (struct test_info * t) {
+
+	pthread_condattr_t attr;
+
+	if (t->tcpi_interval <= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t->tcpi_t0);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->tcpi_smp.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&t->tcpi_smp.lock, NULL);
+	t->tcpi_smp.stop = 0;
+
+	if (pthread_create(&t->tcpi_smp.thread, NULL, run_tcpi, t) != 0) {
+		fprintf(stderr, "[%d] ", t->id);
+		perror("[WARNING]: Could not start the TCP_INFO sampler");
+		return;
+		}
+	t->tcpi_smp.running = 1;
+	}
+
+
+
+
+/* tcpi_end: This function stops the TCP_INFO sampler, which takes one last sample on
+	its way out. Safe to call when there is none */
+
+void tcpi_end (struct test_info * t) {
+
+	if (!t->tcpi_smp.running)
+		return;
+
+	pthread_mutex_lock(&t->tcpi_smp.lock);
+	t->tcpi_smp.stop = 1;
+	pthread_cond_signal(&t->tcpi_smp.cond);
+	pthread_mutex_unlock(&t->tcpi_smp.lock);
+
+	pthread_join(t->tcpi_smp.thread, NULL);
+	pthread_cond_destroy(&t->tcpi_smp.cond);
+	pthread_mutex_destroy(&t->tcpi_smp.lock);
+	t->tcpi_smp.running = 0;
+	}
+
+
+
+
+/* run_tcpi: This is the thread body of the TCP_INFO sampler. Every t->tcpi_interval
+	ms, on absolute deadlines, it samples every test connection of the session. The
+	streams are accepted after it starts and closed before it stops, till then and
+	from then on their socket is -1 */
+
+void * run_tcpi (void * arg) {
+
+	struct test_info * t = (struct test_info *) arg;
+	struct timespec due, now;
+	long int us;
+	int i, n;
+
+	pthread_mutex_lock(&t->tcpi_smp.lock);
+
+	for (n = 1; ; n++) {
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		us = (now.tv_sec - t->tcpi_t0.tv_sec) * 1000000L + (now.tv_nsec - t->tcpi_t0.tv_nsec) / 1000;
+
+		if (t->n_streams > 1)
+			for (i = 0; i < t->n_streams; i++)
+				tcpi_add(&t->tcpi, __atomic_load_n(&t->streams[i].sock, __ATOMIC_RELAXED), i, us);
+		else
+			tcpi_add(&t->tcpi, t->testsock, 0, us);
+
+		if (t->tcpi_smp.stop)
+			break;
+
+		due.tv_sec = t->tcpi_t0.tv_sec + ((long int) n * t->tcpi_interval) / 1000;
+		due.tv_nsec = t->tcpi_t0.tv_nsec + (((long int) n * t->tcpi_interval) % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+			}
+
+		while (!t->tcpi_smp.stop && pthread_cond_timedwait(&t->tcpi_smp.cond, &t->tcpi_smp.lock, &due) != ETIMEDOUT);
+		}
+
+	pthread_mutex_unlock(&t->tcpi_smp.lock);
+	return NULL;
+	}
+
+
+
+
+/* tcpi_add: This function takes a TCP_INFO sample of sock, connection stream of the
+	test, t us into it. An older kernel fills less of struct tcp_info, the rest of
+	the fields stay 0. Beyond MAX_TCPI samples we stop */
+
+void tcpi_add (struct tcpi_series * ts, int sock, int stream, long int t) {
+
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	struct tcpi_sample * s;
+
+	memset(&info, 0, sizeof(info));
+	if (sock < 0 || ts->n >= MAX_TCPI || getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return;
+
+	if (ts->n == ts->size) {
+		s = realloc(ts->s, (ts->size > 0 ? 2 * ts->size : 256) * sizeof(struct tcpi_sample));
+		if (s == NULL)
+			return;
+		ts->s = s;
+		ts->size = ts->size > 0 ? 2 * ts->size : 256;
+		}
+
+	s = &ts->s[ts->n++];
+	s->t = t;
+	s->stream = stream;
+	s->cwnd = info.tcpi_snd_cwnd;
+	s->srtt = info.tcpi_rtt;
+	s->rttvar = info.tcpi_rttvar;
+	s->retrans = info.tcpi_total_retrans;
+	s->pacing_rate = info.tcpi_pacing_rate;
+	s->delivery_rate = info.tcpi_delivery_rate;
+	s->busy = info.tcpi_busy_time;
+	s->rwnd_limited = info.tcpi_rwnd_limited;
+	s->sndbuf_limited = info.tcpi_sndbuf_limited;
+	}
+
+
+
+
+/* tcpi_send: This function sends the client our samples, as many to a MSG_SAMPLES
+	message as fit, and sums them up in our log: the last sample of every stream */
+
+void tcpi_send (struct test_info * t) {
+
+	struct tcpi_sample * s;
+	struct ctrl_msg m;
+	uint64_t buf[CTRL_MAX / sizeof(uint64_t)];
+	int per = (CTRL_MAX - 4) / sizeof(struct tcpi_sample);
+	int i, k, n;
+
+	if (t->tcpi_interval <= 0)
+		return;
+
+	for (i = 0; i < t->tcpi.n; i += n) {
+
+		n = t->tcpi.n - i < per ? t->tcpi.n - i : per;
+		for (k = 0; k < n * (int) TCPI_FIELDS; k++)
+			buf[k] = htobe64(((uint64_t *) &t->tcpi.s[i])[k]);
+
+		ctrl_init(&m, MSG_SAMPLES);
+		ctrl_put_raw(&m, P_SAMPLES, buf, n * sizeof(struct tcpi_sample));
+		if (ctrl_send(t->ctrlsock, &m) < 0)
+			session_error(t, "[ERROR]: Sending the TCP_INFO samples failed");
+		}
+
+	printf("[INFO]: [%d] TCP_INFO: %d samples every %d ms\n", t->id, t->tcpi.n, t->tcpi_interval);
+	for (k = 0; k < (t->n_streams > 1 ? t->n_streams : 1); k++)
+		for (i = t->tcpi.n - 1; i >= 0; i--) {
+			s = &t->tcpi.s[i];
+			if ((int) s->stream != k)
+				continue;
+			printf("[INFO]: [%d] Stream %d at %.3f s: cwnd %lu, srtt %lu us, rttvar %lu us, %lu retransmits\n",
+				t->id, k, s->t / 1e6, (unsigned long) s->cwnd, (unsigned long) s->srtt,
+				(unsigned long) s->rttvar, (unsigned long) s->retrans);
+			break;
+			}
+	}
+
+
+
+
+/* cpu_add: This function adds what the calling thread has used since start (its own
+	RUSAGE_THREAD) to c. The threads of a session may finish at the same time, so
+	the sums are atomic */
+
+void cpu_add (struct cpu_cost * c, struct rusage * start) {
+
+	struct rusage e;
+
+	if (getrusage(RUSAGE_THREAD, &e) < 0)
+		return;
+
+	__atomic_add_fetch(&c->user, (e.ru_utime.tv_sec - start->ru_utime.tv_sec) * 1000000L +
+		(e.ru_utime.tv_usec - start->ru_utime.tv_usec), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->sys, (e.ru_stime.tv_sec - start->ru_stime.tv_sec) * 1000000L +
+		(e.ru_stime.tv_usec - start->ru_stime.tv_usec), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->vcsw, e.ru_nvcsw - start->ru_nvcsw, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->ivcsw, e.ru_nivcsw - start->ru_nivcsw, __ATOMIC_RELAXED);
+	}
+
+
+
+
+/* show_cpu_cost: This function prints what the test cost us. The client prints
+	the same from what we send it */
+
+void show_cpu_cost (struct test_info * t) {
+
+	struct cpu_cost * c = &t->cpu;
+	long int cyc = c->hw[HW_CYCLES];
+
+	if (c->bytes <= 0)
+		return;
+
+	printf("[INFO]: [%d] CPU time: user %.3f s, sys %.3f s, %.3f ns per byte, %ld voluntary and %ld involuntary context switches\n",
+		t->id, c->user / 1e6, c->sys / 1e6, (c->user + c->sys) * 1000.0 / c->bytes, c->vcsw, c->ivcsw);
+
+	if (cyc < 0)
+		printf("[INFO]: [%d] Hardware counters not available (%s)\n", t->id, c->hw_error != 0 ? strerror(c->hw_error) : "not counted");
+	else
+		printf("[INFO]: [%d] Cycles: %.2f per byte, %.0f per packet, IPC %.2f, %.3f cache misses per KB%s\n", t->id,
+			(double) cyc / c->bytes, c->packets > 0 ? (double) cyc / c->packets : 0,
+			cyc > 0 && c->hw[HW_INSTRUCTIONS] >= 0 ? (double) c->hw[HW_INSTRUCTIONS] / cyc : 0,
+			c->hw[HW_CACHE_MISSES] >= 0 ? c->hw[HW_CACHE_MISSES] * 1024.0 / c->bytes : 0,
+			c->user_only ? " (user space only)" : "");
+	}
+
+
+
+
+/* tcp_mss: This function returns the MSS of a TCP connection, 0 if we can't tell */
+
+int tcp_mss (int sock) {
+
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return 0;
+	return info.tcpi_rcv_mss > info.tcpi_snd_mss ? info.tcpi_rcv_mss : info.tcpi_snd_mss;
+	}
+
+
+
+
+/* hw_open: This function starts the hardware counters for the calling thread and
+	all the threads it starts from now on (inherit). Inherited counters can't be
+	read as a group, so they are opened one by one; if the PMU has no room for all
+	of them the kernel takes turns and hw_read() scales.
+
+	With perf_event_paranoid at 2 we may not count the kernel, where most of the
+	receiving happens. We settle for user space then. Without a PMU (many virtual
+	machines) the counters stay at -1 and the test goes on as always */
+
+void hw_open (struct cpu_cost * c, int * fd) {
+
+	static const uint64_t config[N_HW] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+	struct perf_event_attr pa;
+	int i;
+
+	c->user_only = 0;
+	c->hw_error = 0;
+
+	for (i = 0; i < N_HW; i++) {
+
+		memset(&pa, 0, sizeof(pa));
+		pa.type = PERF_TYPE_HARDWARE;
+		pa.size = sizeof(pa);
+		pa.config = config[i];
+		pa.inherit = 1;
+		pa.exclude_hv = 1;
+		pa.exclude_kernel = c->user_only;
+		pa.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		fd[i] = syscall(__NR_perf_event_open, &pa, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+
+		if (fd[i] < 0 && i == 0 && !c->user_only && (errno == EACCES || errno == EPERM)) {
+			c->user_only = 1;
+			i--;
+			continue;
+			}
+
+		if (fd[i] < 0 && i == 0)
+			c->hw_error = errno;
+		}
+	}
+
+
+
+
+/* hw_read: This function stops the counters of hw_open() and puts what they counted
+	in c, scaled up to the whole time if they only ran part of it. The counters
+	are closed and their fds set to -1 */
+
+void hw_read (struct cpu_cost * c, int * fd) {
+
+	uint64_t v[3];		/* value, time enabled, time running */
+	int i;
+
+	for (i = 0; i < N_HW; i++) {
+
+		c->hw[i] = -1;
+		if (fd[i] < 0)
+			continue;
+
+		if (read(fd[i], v, sizeof(v)) == sizeof(v) && v[2] > 0)
+			c->hw[i] = v[2] < v[1] ? (long int) ((double) v[0] * v[1] / v[2]) : (long int) v[0];
+		close(fd[i]);
+		fd[i] = -1;
+		}
+	}
+
+
+
+
+
+
+
+
+/* seq_update: This function accounts for one received datagram with sequence number
+	seq and transit time transit (arrival - send, in ns, with whatever offset there is
+	between the clocks). It is called for every datagram, so it has to stay O(1)
+	(moving the window on after a burst of loss is paid for by the datagrams that were
+	lost) */
+
+void seq_update (struct seq_stats * ss, uint64_t seq, int64_t transit) {
+
+	uint64_t bit, back, s;
+	int64_t d;
+
+	/* Jitter, in arrival order: J += (|D| - J) / 16 */
+	if (ss->have_transit) {
+		d = transit - ss->last_transit;
+		if (d < 0)
+			d = -d;
+		ss->jitter += (d - ss->jitter) / 16.0;
+		}
+	ss->last_transit = transit;
+	ss->have_transit = 1;
+
+	bit = seq % SEQ_WINDOW;
+
+	/* The usual case. Newest datagram so far. Forget whatever the bits of the
+	skipped (so far lost) numbers meant in the last round of the ring */
+	if (seq >= ss->next) {
+
+		if (seq - ss->next >= SEQ_WINDOW)
+			memset(ss->seen, 0, sizeof(ss->seen));
+		else
+			for (s = ss->next; s < seq; s++)
+				ss->seen[(s % SEQ_WINDOW) / 64] &= ~(1ULL << (s % 64));
+
+		ss->seen[bit / 64] |= 1ULL << (bit % 64);
+		ss->next = seq + 1;
+		ss->unique++;
+		return;
+		}
+
+	/* It is late. How late? */
+	back = ss->next - 1 - seq;
+
+	if (back < SEQ_WINDOW) {
+		if (ss->seen[bit / 64] & (1ULL << (bit % 64))) {
+			ss->duplicates++;
+			return;
+			}
+		ss->seen[bit / 64] |= 1ULL << (bit % 64);
+		}
+
+	ss->unique++;
+	ss->reordered++;
+	if (back > ss->max_reorder)
+		ss->max_reorder = back;
+	}
+
+
+
+
+
+
+
+
+
+/* shake_hands: This function is to do initial handshake with the client and tell us how
+	much data are we expecting.
+	This should include the following:
+		1. Receive the hello with the test parameters: the transport layer protocol,
+		   the data size, the number of parallel streams, the UDP batch depth and
+		   offload and the receive path to use
+		2*. Receive confirmation that clock is synced on client (not implemented)
+		3. Set up the test socket and send ready with the test port (or an error
+		   saying why we won't)
+
+	The control connection is non-blocking. This is called from the event loop whenever
+	it is readable and picks up wherever the last call left. We read exactly the hello
+	and nothing more; for TCP the test data follows right behind it on the same
+	connection. It returns 0 if it needs more data, 1 once the handshake is complete
+	and -1 if the handshake failed
+*/
+
+int shake_hands (struct test_info * t) {
+
+	int read_ele;
+	struct ctrl_msg m;
+
+	while (t->hlen < t->hneed) {
+
+		/* Read whatever is missing from the header, and then from the parameters */
+		read_ele = read(t->ctrlsock, t->hbuf + t->hlen, t->hneed - t->hlen);
+
+		if (read_ele < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (read_ele < 0) {
+			perror("[ERROR]: Read failed during handshake.");
+			return -1;
+			}
+		if (read_ele == 0) {
+			fprintf(stderr,"[ERROR]: [%d] Client closed the connection during handshake.\n", t->id);
+			return -1;
+			}
+
+		t->hlen += read_ele;
+
+		/* Got the header. Now we know how long the rest is */
+		if (t->hlen == sizeof(struct ctrl_hdr)) {
+			if (ctrl_check((struct ctrl_hdr *) t->hbuf, &m) < 0)
+				return refuse(t, "Not a control message of a client speaking our version");
+			t->hneed += m.len;
+			}
+		}
+
+	ctrl_check((struct ctrl_hdr *) t->hbuf, &m);
+	memcpy(m.body, t->hbuf + sizeof(struct ctrl_hdr), m.len);
+
+	if (m.type != MSG_HELLO)
+		return refuse(t, "Expected a hello");
+	printf("[INFO]: [%d] Client ready for handshake\n", t->id);
+
+	if (handle_hello(t, &m) < 0)
+		return -1;
+
+
+	/* Now we have to set up a test connection (if any) */
+	if (setup_test(t) < 0)
+		return refuse(t, "Could not set up the test");
+
+
+	/* Tell client we are ready to receive the data and where */
+	ctrl_init(&m, MSG_READY);
+	ctrl_put(&m, P_TEST_PORT, t->test_port);
+
+	if (ctrl_send(t->ctrlsock, &m) < 0) {
+		perror("[ERROR]: Sending the ready signal failed");
+		return -1;
+		}
+	printf("[INFO]: [%d] Server ready for test\n", t->id);
+
+	return 1;
+	}
+
+
+
+
+
+
+
+
+
+/* handle_hello: This function takes the test parameters out of the hello and stores
+	them in the session. The protocol and the data size have to be there, the rest
+	defaults to what a client that doesn't know about them would want. Returns -1
+	(after telling the client) if something does not make sense */
+
+int handle_hello (struct test_info * t, struct ctrl_msg * m) {
+
+	char name[16];
+	int len;
+
+	/* For convinience, the transport layer protocol is an int. TCP = 1, UDP = 0 */
+	if (ctrl_find(m, P_PROTO, &len) == NULL)
+		return refuse(t, "No transport layer protocol");
+	t->t_prot = ctrl_get(m, P_PROTO, -1);
+	if (t->t_prot == 1)
+		printf("[INFO]: [%d] Using TCP in transport layer\n", t->id);
+	else if (t->t_prot == 0)
+		printf("[INFO]: [%d] Using UDP in transport layer\n", t->id);
+	else
+		return refuse(t, "Invalid transport layer protocol");
+
+
+	/* If we are using TCP in transport layer, then this is the datasize.
+	If we are using UDP in transport layer then this is number of messages */
+	t->data_info = ctrl_get(m, P_SIZE, 0);
+	t->duration = ctrl_get(m, P_DURATION, 0);
+	if (t->data_info < 0 || t->duration < 0 || (t->data_info == 0 && t->duration == 0))
+		return refuse(t, "Invalid datasize parameter");
+	printf("[INFO]: [%d] Received data size information (%ld)\n", t->id, t->data_info);
+
+	/* A timed test runs till the client stops sending. The size, if any, is just
+	as far as it goes at most */
+	if (t->duration > 0) {
+		if (t->data_info == 0)
+			t->data_info = LONG_MAX;
+		printf("[INFO]: [%d] Timed test of %.3f s\n", t->id, t->duration / 1000.0);
+		}
+
+
+	/* The number of parallel test connections. 1 means the usual single connection test */
+	t->n_streams = ctrl_get(m, P_STREAMS, 1);
+	if (t->n_streams < 1 || t->n_streams > MAX_STREAMS)
+		return refuse(t, "Invalid number of streams parameter");
+	if (t->n_streams > 1 && t->t_prot != 1)
+		return refuse(t, "Parallel streams are only supported with TCP");
+	printf("[INFO]: [%d] Received number of streams (%d)\n", t->id, t->n_streams);
+
+
+	/* How many datagrams the client hands over per sendmmsg(). We take as many
+	per recvmmsg() */
+	t->batch = ctrl_get(m, P_BATCH, 1);
+	if (t->batch < 1 || t->batch > MAX_BATCH)
+		return refuse(t, "Invalid batch depth parameter");
+
+
+	/* Which UDP offload the client uses */
+	t->offload = ctrl_get(m, P_OFFLOAD, 0);
+	if (t->offload < 0 || t->offload > OFFLOAD_BOTH || (t->offload != 0 && t->t_prot != 0))
+		return refuse(t, "Invalid UDP offload parameter");
+	if (t->offload != 0)
+		printf("[INFO]: [%d] Client uses UDP offload %s\n", t->id, offload_name[t->offload]);
+
+
+	/* The rate the client paces at. When we send UDP, we do too */
+	t->rate = ctrl_get(m, P_RATE, 0);
+	if (t->rate < 0 || (t->rate > 0 && t->t_prot != 0))
+		return refuse(t, "Invalid UDP rate parameter");
+
+
+	/* How the client wants us to receive, by name */
+	if (ctrl_get_str(m, P_RXMODE, name, sizeof(name)) < 0)
+		strcpy(name, rx_mode_name[RX_COPY]);
+	for (t->rx_mode = RX_COPY; t->rx_mode <= RX_DISCARD; t->rx_mode++)
+		if (strcmp(name, rx_mode_name[t->rx_mode]) == 0)
+			break;
+	if (t->rx_mode > RX_DISCARD)
+		return refuse(t, "Invalid receive path parameter");
+	printf("[INFO]: [%d] Using the %s receive path\n", t->id, rx_mode_name[t->rx_mode]);
+
+
+	/* A request/response test instead of a transfer. Then the datasize is the
+	number of transactions */
+	t->req_size = ctrl_get(m, P_REQ_SIZE, 0);
+	t->resp_size = ctrl_get(m, P_RESP_SIZE, t->req_size);
+	if (t->req_size < 0 || t->req_size > MAX_RR_SIZE || t->resp_size < 0 || t->resp_size > MAX_RR_SIZE ||
+		(t->req_size > 0 && (t->resp_size == 0 || t->n_streams > 1)))
+		return refuse(t, "Invalid request/response parameters");
+	if (t->req_size > 0)
+		printf("[INFO]: [%d] Request/response test, %d byte requests, %d byte responses\n",
+			t->id, t->req_size, t->resp_size);
+
+
+	/* A connection rate test, and how much goes each way on every connection */
+	t->crr_size = ctrl_get(m, P_CRR_SIZE, -1);
+	t->fastopen = ctrl_get(m, P_FASTOPEN, 0);
+	if (t->crr_size > MAX_RR_SIZE || (t->crr_size >= 0 && (t->t_prot != 1 || t->n_streams > 1 || t->req_size > 0)))
+		return refuse(t, "Invalid connection rate parameters");
+	if (t->crr_size >= 0)
+		printf("[INFO]: [%d] Connection rate test, %d bytes each way%s\n",
+			t->id, t->crr_size, t->fastopen ? ", TCP Fast Open" : "");
+
+
+	/* How big the client's datagrams are, and ours when we send */
+	t->msg_size = ctrl_get(m, P_MSG_SIZE, BUFF_SIZE-1);
+	if (t->msg_size < MIN_MSG_SIZE || t->msg_size > MAX_RR_SIZE)
+		return refuse(t, "Invalid message size parameter");
+	if (t->msg_size != BUFF_SIZE-1)
+		printf("[INFO]: [%d] Messages of %d bytes\n", t->id, t->msg_size);
+
+
+	/* Which way the data goes. For UDP towards the client we need to know where */
+	t->direction = ctrl_get(m, P_DIRECTION, DIR_FORWARD);
+	t->udp_port = ctrl_get(m, P_UDP_PORT, 0);
+	if (t->direction < DIR_FORWARD || t->direction > DIR_BOTH ||
+		(t->direction != DIR_FORWARD && (t->n_streams > 1 || t->req_size > 0 || t->crr_size >= 0)) ||
+		(t->direction != DIR_FORWARD && t->t_prot == 0 && (t->udp_port <= 0 || t->udp_port > 65535)))
+		return refuse(t, "Invalid direction parameters");
+	if (t->direction != DIR_FORWARD)
+		printf("[INFO]: [%d] Data goes %s\n", t->id, direction_name[t->direction]);
+
+
+	/* How we take the data from the kernel. The io_uring buffers are filled by the
+	kernel, so there is nothing to discard with, and a plain recv gets no GRO size */
+	t->engine = ctrl_get(m, P_ENGINE, ENGINE_SYS);
+	if (t->engine < ENGINE_SYS || t->engine > ENGINE_URING ||
+		(t->engine == ENGINE_URING && (t->rx_mode == RX_DISCARD || (t->offload & OFFLOAD_GRO))))
+		return refuse(t, "Invalid I/O engine parameter");
+	if (t->engine != ENGINE_SYS)
+		printf("[INFO]: [%d] Receiving with %s\n", t->id, engine_name[t->engine]);
+
+	/* Only a TCP connection that lasts has anything to sample */
+	t->tcpi_interval = ctrl_get(m, P_TCPI_INTERVAL, 0);
+	if (t->tcpi_interval < 0 || (t->tcpi_interval > 0 && (t->t_prot != 1 || t->crr_size >= 0)))
+		return refuse(t, "Invalid TCP_INFO interval");
+	if (t->tcpi_interval > 0 && t->tcpi_interval < MIN_INTERVAL)
+		t->tcpi_interval = MIN_INTERVAL;
+
+	/* The payload check needs the data in order and in user space, and it is the
+	client's data we check */
+	t->seed = (uint64_t) ctrl_get(m, P_VERIFY, 0);
+	if (t->seed != 0 && (t->req_size > 0 || t->crr_size >= 0 || t->direction != DIR_FORWARD ||
+						 t->rx_mode == RX_DISCARD || t->engine != ENGINE_SYS))
+		return refuse(t, "The payload can only be checked in a transfer from the client, received with read() or recvmmsg()");
+	if (t->seed != 0)
+		printf("[INFO]: [%d] Checking the payload\n", t->id);
+
+	/* Only the client's sending is timed. Transactions and connections are counted */
+	if (t->duration > 0 && (t->req_size > 0 || t->crr_size >= 0 || t->direction != DIR_FORWARD))
+		return refuse(t, "A timed test can only be a transfer from the client");
+
+	return 0;
+	}
+
+
+
+
+/* refuse: This function tells the client why we won't run its test and returns -1
+	for the caller to pass on. The session is closed after this anyway, so we don't
+	care much whether the message makes it */
+
+int refuse (struct test_info * t, const char * why) {
+
+	struct ctrl_msg m;
+
+	fprintf(stderr,"[ERROR]: [%d] Handshake failed. %s.\n", t->id, why);
+
+	ctrl_init(&m, MSG_ERROR);
+	ctrl_put_str(&m, P_TEXT, why);
+	ctrl_send(t->ctrlsock, &m);
+
+	return -1;
+	}
+
+
+
+
+
+
+
+
+
+/* ctrl_init: This function starts an empty control message of the given type */
+
+void ctrl_init (struct ctrl_msg * m, int type) {
+
+	m->type = type;
+	m->len = 0;
+	}
+
+
+
+
+/* ctrl_put_raw: This function appends a parameter with a value of len bytes to the
+	message. Returns -1 if it does not fit */
+
+int ctrl_put_raw (struct ctrl_msg * m, int param, const void * val, int len) {
+
+	uint16_t h[2];
+
+	if (len < 0 || m->len + sizeof(h) + len > CTRL_MAX)
+		return -1;
+
+	h[0] = htons(param);
+	h[1] = htons(len);
+	memcpy(m->body + m->len, h, sizeof(h));
+	memcpy(m->body + m->len + sizeof(h), val, len);
+	m->len += sizeof(h) + len;
+	return 0;
+	}
+
+
+
+
+/* ctrl_put: This function appends a number. Negative numbers go as their two's
+	complement, ctrl_get() brings them back */
+
+int ctrl_put (struct ctrl_msg * m, int param, long int val) {
+
+	uint64_t v = htobe64((uint64_t) val);
+
+	return ctrl_put_raw(m, param, &v, sizeof(v));
+	}
+
+
+
+
+/* ctrl_put_str: This function appends a name (or any other text) */
+
+int ctrl_put_str (struct ctrl_msg * m, int param, const char * str) {
+
+	return ctrl_put_raw(m, param, str, strlen(str));
+	}
+
+
+
+
+/* ctrl_find: This function looks for a parameter in the message. It returns where
+	its value starts and puts its length in *len, or returns NULL if it isn't there.
+	A parameter running past the end of the message ends the search */
+
+const char * ctrl_find (struct ctrl_msg * m, int param, int * len) {
+
+	uint16_t h[2];
+	uint32_t off = 0;
+
+	while (off + sizeof(h) <= m->len) {
+
+		memcpy(h, m->body + off, sizeof(h));
+		if (off + sizeof(h) + ntohs(h[1]) > m->len)
+			return NULL;
+
+		if (ntohs(h[0]) == param) {
+			*len = ntohs(h[1]);
+			return m->body + off + sizeof(h);
+			}
+		off += sizeof(h) + ntohs(h[1]);
+		}
+
+	return NULL;
+	}
+
+
+
+
+/* ctrl_get: This function returns the number in a parameter, or dflt if the message
+	doesn't have it (or it isn't a number) */
+
+long int ctrl_get (struct ctrl_msg * m, int param, long int dflt) {
+
+	const char * p;
+	uint64_t v;
+	int len;
+
+	p = ctrl_find(m, param, &len);
+	if (p == NULL || len != sizeof(v))
+		return dflt;
+
+	memcpy(&v, p, sizeof(v));
+	return (long int) be64toh(v);
+	}
+
+
+
+
+/* ctrl_get_str: This function copies the text of a parameter into str (of size bytes)
+	and terminates it. Returns -1 if it isn't there or doesn't fit */
+
+int ctrl_get_str (struct ctrl_msg * m, int param, char * str, int size) {
+
+	const char * p;
+	int len;
+
+	p = ctrl_find(m, param, &len);
+	if (p == NULL || len >= size)
+		return -1;
+
+	memcpy(str, p, len);
+	str[len] = '\0';
+	return 0;
+	}
+
+
+
+
+/* ctrl_check: This function checks a received header and sets up m for the body
+	that follows it. Returns -1 if it isn't ours, is of another version or claims a
+	body bigger than we take */
+
+int ctrl_check (struct ctrl_hdr * h, struct ctrl_msg * m) {
+
+	if (ntohs(h->magic) != CTRL_MAGIC || h->version != CTRL_VERSION || ntohl(h->len) > CTRL_MAX)
+		return -1;
+
+	m->type = h->type;
+	m->len = ntohl(h->len);
+	return 0;
+	}
+
+
+
+
+/* ctrl_send: This function sends a control message, header and body in one write()
+	as far as the socket lets us. Returns -1 if the connection failed */
+
+int ctrl_send (int sock, struct ctrl_msg * m) {
+
+	char buff[sizeof(struct ctrl_hdr) + CTRL_MAX];
+	struct ctrl_hdr h;
+	size_t total = sizeof(h) + m->len, done;
+	ssize_t n;
+
+	h.magic = htons(CTRL_MAGIC);
+	h.version = CTRL_VERSION;
+	h.type = m->type;
+	h.len = htonl(m->len);
+
+	memcpy(buff, &h, sizeof(h));
+	memcpy(buff + sizeof(h), m->body, m->len);
+
+	for (done = 0; done < total; done += n) {
+		n = write(sock, buff + done, total - done);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return -1;
+		}
+
+	return 0;
+	}
+
+
+
+
+
+
+
+
+
+/* setup_test: Now we have to set up a test connection (if any)
+		For UDP, we will open a new socket on a port the kernel picks for us. Many
+			sessions can be running at once, so they can't all share one port.
+		For TCP, we will just continue on the control connection. With parallel
+			streams, we open a listening socket (again on a port the kernel picks)
+			for just this session's streams to connect to.
+	Returns -1 if something fails */
+
+int setup_test (struct test_info * t) {
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	int sock, i;
+
+	if (t->t_prot == 1 && t->n_streams == 1 && t->crr_size < 0) {
+
+		/* It is easy for TCP, we will use the same connection. So just copy the socket
+		descriptor and port number (this is actually a port number where server is listening) */
+		t->test_port = si.ctrl_port;
+		t->testsock = t->ctrlsock;
+		printf("[INFO]: [%d] Ready for TCP test\n", t->id);
+		return 0;
+		}
+
+	/* For UDP, we have to create a UDP socket and bind. For parallel TCP and the
+	connection rate test, a TCP socket to listen on */
+	sock = socket(t->fam->domain, t->t_prot == 1 ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("[ERROR]: Could not create socket for test connection");
+		return -1;
+		}
+
+	if ( bind(sock, t->fam->test_addr, t->fam->addr_size) < 0 ||
+		 getsockname(sock, (struct sockaddr *) &addr, &addr_len) < 0 ) {
+		perror("[ERROR]: Could not bind for test connection");
+		close(sock);
+		return -1;
+		}
+
+	if (addr.ss_family == AF_INET)
+		t->test_port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+	else
+		t->test_port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+
+	/* We send to the client's UDP port at the address it has the control connection
+	from. Connecting also means we only take datagrams from there */
+	if (t->t_prot == 0 && t->direction != DIR_FORWARD) {
+
+		struct sockaddr_storage peer;
+		socklen_t peer_len = sizeof(peer);
+
+		if (getpeername(t->ctrlsock, (struct sockaddr *) &peer, &peer_len) < 0) {
+			perror("[ERROR]: Could not find out the client's address");
+			close(sock);
+			return -1;
+			}
+
+		if (peer.ss_family == AF_INET)
+			((struct sockaddr_in *) &peer)->sin_port = htons(t->udp_port);
+		else
+			((struct sockaddr_in6 *) &peer)->sin6_port = htons(t->udp_port);
+
+		if (connect(sock, (struct sockaddr *) &peer, peer_len) < 0) {
+			perror("[ERROR]: Could not connect to the client's UDP port");
+			close(sock);
+			return -1;
+			}
+		}
+
+	if (t->t_prot == 0) {
+		t->testsock = sock;		/* set the test socket descriptor */
+		printf("[INFO]: [%d] Ready for UDP test on port %d\n", t->id, t->test_port);
+		return 0;
+		}
+
+	/* Parallel TCP. Don't let a client that never connects its streams hold the
+	session thread forever. accept() honours the receive timeout */
+	struct timeval tv;
+	tv.tv_sec = ACCEPT_TIMEOUT;
+	tv.tv_usec = 0;
+
+	if ( listen(sock, SOMAXCONN) < 0 ||
+		 setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ) {
+		perror("[ERROR]: Could not listen for the streams");
+		close(sock);
+		return -1;
+		}
+
+	if (t->crr_size >= 0) {
+
+		/* The queue length also turns Fast Open on for this socket. The kernel still
+		has to allow it (net.ipv4.tcp_fastopen), otherwise we just don't see any */
+		int qlen = TFO_QLEN;
+		if (t->fastopen && setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0)
+			perror("[WARNING]: Could not enable TCP Fast Open");
+
+		t->streamsock = sock;
+		t->testsock = t->ctrlsock;
+		printf("[INFO]: [%d] Ready for connection rate test on port %d\n", t->id, t->test_port);
+		return 0;
+		}
+
+	/* calloc() only promises 16 byte alignment, which would leave every stream
+	straddling two cache lines */
+	if (posix_memalign((void **) &t->streams, CACHE_LINE, t->n_streams * sizeof(struct stream_info)) != 0) {
+		t->streams = NULL;
+		perror("[ERROR]: Could not allocate stream information");
+		close(sock);
+		return -1;
+		}
+	memset(t->streams, 0, t->n_streams * sizeof(struct stream_info));
+	for (i = 0; i < t->n_streams; i++)
+		t->streams[i].sock = -1;
+
+	t->streamsock = sock;
+	t->testsock = t->ctrlsock;
+	printf("[INFO]: [%d] Ready for TCP test over %d streams on port %d\n", t->id, t->n_streams, t->test_port);
+	return 0;
+	}
+
+
+
+
+
+
+
+
+
+/* check_input: This function is to check that the input to this program are proper. This
+	includes checking the number of arguments and their types */
+
+
+void check_input (int c, char * v[]) {
+
+	int opt, i;
+	char * prog = v[0];
+
+	si.place.node_opt = -1;
+
+	/* Options come first. Whatever getopt leaves behind are the positional
+	arguments */
+	while ((opt = getopt(c, v, "Di:A:M:p:H")) != -1) {
+		switch (opt) {
+			case 'D': si.daemon = 1;
+					  break;
+
+			case 'i': si.interval = atoi(optarg);
+					  if (si.interval < MIN_INTERVAL) {
+						fprintf(stderr,"The interval must be at least %d ms\n", MIN_INTERVAL);
+						exit(1);
+						}
+					  break;
+
+			case 'A': if (strcmp(optarg, "auto") == 0)
+						si.place.automatic = 1;
+					  else if ((si.place.n_cpus = parse_cpus(optarg, si.place.cpus, MAX_PIN)) <= 0) {
+						fprintf(stderr,"CPUs should be auto or a list like 0-3,8\n");
+						exit(1);
+						}
+					  break;
+
+			case 'M': si.place.node_opt = atoi(optarg);
+					  if (si.place.node_opt < 0 || optarg[0] < '0' || optarg[0] > '9') {
+						fprintf(stderr,"NUMA node should be a number\n");
+						exit(1);
+						}
+					  break;
+
+			case 'p': for (i = 0; payload_name[i] != NULL; i++)
+						  if (strcmp(optarg, payload_name[i]) == 0)
+							  break;
+					  if (payload_name[i] == NULL) {
+						fprintf(stderr,"Payload should be zeros, repeat or random\n");
+						exit(1);
+						}
+					  si.payload = i;
+					  break;
+
+			case 'H': si.huge = 1;
+					  break;
+
+			default:  c = 0;		/* Force the usage message */
+			}
+		}
+
+	c -= optind - 1;
+	v += optind - 1;
+
+	/* Not enough args? */
+	if (c < 3) {
+		printf("Usage: %s [options] [port] [protocol] \n\n\tWhere\n\t\tprotocol can be 4 (ipv4), 6 (ipv6) or 46 (both)\n\
+\n\tOptions\n\t\t-D\tdaemon mode, keep serving sessions\n\t\t-i ms\treport progress every ms milliseconds\n\
+\t\t-A cpus\tpin the test threads to these CPUs (like 0-3,8), auto for near the NIC\n\
+\t\t-M node\tallocate the buffers on this NUMA node\n\
+\t\t-p data\twhat we send: zeros, repeat or random (default zeros)\n\
+\t\t-H\tkeep what we send in huge pages, locked in memory\n",prog);
+		exit(1);
+		}
+
+	/* The port number should not be special */
+	if (atoi(v[1]) < 2000) {
+		fprintf(stderr,"The input port must be greater than 2000");
+		exit(1);
+		}
+
+	/* Network protocol has to be ipv4 or ipv6 (4/6), or both (46) */
+	if (atoi(v[2]) != 4 && atoi(v[2]) != 6 && atoi(v[2]) != 46) {
+		fprintf(stderr,"Invalid protocol number %d\n",atoi(v[2]));
+		exit(1);
+		}
+	}
+
+
+
+
+/* set_nonblocking: This function switches O_NONBLOCK on a descriptor on (1) or
+	off (0). Returns -1 if fcntl fails */
+
+int set_nonblocking (int fd, int on) {
+
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0)
+		return -1;
+
+	if (on)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	return fcntl(fd, F_SETFL, flags);
+	}
+
+
+
+
+/* raise_error: This function is for printing a message from the program, then
+	printing the message from the system and then exit with non-zero status */
+
+void raise_error (const char * msg) {
+
+	perror(msg);
+	exit(1);
+	}
+
+
+
+
+
+/* pool_init: This function sets up the payload pool all the sessions send from:
+	POOL_SIZE bytes, aligned to a huge page, with what -p asks for in it. Nobody
+	writes to it after this, so the senders need no locking and random data doesn't
+	repeat within any compression window.
+
+	With -H we try the huge page pool (vm.nr_hugepages) first, then transparent huge
+	pages, and lock the pool in memory. Anything that doesn't work is only a warning.
+	Filling it faults every page in before the first session */
+
+void pool_init () {
+
+	uint64_t x, w;
+	struct timespec now;
+	size_t i;
+
+	si.pool = MAP_FAILED;
+	si.pool_node = -1;
+	if (si.huge) {
+		si.pool = mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (si.pool == MAP_FAILED)
+			perror("[WARNING]: No huge pages for the payload pool, trying transparent ones");
+		else
+			snprintf(si.pool_desc, sizeof(si.pool_desc), "huge pages");
+		}
+
+	if (si.pool == MAP_FAILED) {
+		if (posix_memalign((void **) &si.pool, HUGE_PAGE, POOL_SIZE) != 0)
+			raise_error("[ERROR]: Could not allocate the payload pool");
+		if (!si.huge)
+			snprintf(si.pool_desc, sizeof(si.pool_desc), "pages");
+		else if (madvise(si.pool, POOL_SIZE, MADV_HUGEPAGE) < 0)
+			perror("[WARNING]: No transparent huge pages for the payload pool");
+		else
+			snprintf(si.pool_desc, sizeof(si.pool_desc), "transparent huge pages");
+		}
+
+	if (si.huge && mlock(si.pool, POOL_SIZE) < 0)
+		perror("[WARNING]: Could not lock the payload pool in memory");
+	else if (si.huge)
+		strncat(si.pool_desc, ", locked", sizeof(si.pool_desc) - strlen(si.pool_desc) - 1);
+
+	switch (si.payload) {
+
+		case PAYLOAD_ZEROS:
+			memset(si.pool, 0, POOL_SIZE);
+			break;
+
+		case PAYLOAD_REPEAT:
+			for (i = 0; i < POOL_SIZE; i++)
+				si.pool[i] = i;
+			break;
+
+		/* splitmix64, a word per step */
+		case PAYLOAD_RANDOM:
+			clock_gettime(CLOCK_REALTIME, &now);
+			x = now.tv_sec ^ now.tv_nsec ^ ((uint64_t) getpid() << 32);
+			for (i = 0; i < POOL_SIZE; i += 8) {
+				w = (x += 0x9e3779b97f4a7c15ULL);
+				w = (w ^ (w >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				w = (w ^ (w >> 27)) * 0x94d049bb133111ebULL;
+				w ^= w >> 31;
+				memcpy(si.pool + i, &w, 8);
+				}
+			break;
+		}
+
+	printf("[INFO]: Payload: %d MB of %s in %s\n", POOL_SIZE >> 20, payload_name[si.payload], si.pool_desc);
+	}
+
+
+
+
+/* pool_next: This function hands a sender the next len bytes of the pool, from
+	where its cursor (*cur) is. A chunk that doesn't fit before the end starts over
+	at the beginning, so every chunk is in one piece */
+
+char * pool_next (size_t * cur, size_t len) {
+
+	char * p;
+
+	if (*cur + len > POOL_SIZE)
+		*cur = 0;
+	p = si.pool + *cur;
+	*cur += len;
+	return p;
+	}